@@ -0,0 +1,471 @@
+#include <stdio.h>
+#include <string.h>
+
+#include <algorithm>
+#include <chrono>
+#include <cmath>
+#include <functional>
+#include <random>
+#include <string>
+#include <vector>
+
+#include <GuillotineBinPack.h>
+#include <MaxRectsBinPack.h>
+#include <ShelfBinPack.h>
+#include <ShelfNextFitBinPack.h>
+#include <SkylineBinPack.h>
+#include <xgetopt.h>
+
+// Measures the packers of RectangleBinPack on glyph like rects, and writes
+// the time per insert, the occupancy and the size of the free structure of
+// every run as JSON, for tracking them across changes.
+
+struct BenchResult
+{
+	size_t placed = 0;
+	double seconds = 0;
+	float occupancy = 0;
+	long long peak_free = -1;  // Largest size of the free structure seen, -1 if not observable.
+	long long final_free = -1; // Its size at the end, -1 if the packer has none.
+};
+
+struct Bench
+{
+	std::string name;
+	std::string mode; // "online" inserts rects one by one, "batch" hands them over at once.
+	std::function<BenchResult(const std::vector<rbp::RectSize>&, int, int)> run;
+};
+
+struct Distribution
+{
+	const char* name;
+	const char* description;
+	rbp::RectSize (*make)(std::mt19937& rng);
+};
+
+static int _uniform(std::mt19937& rng, int lo, int hi)
+{
+	return std::uniform_int_distribution<int>(lo, hi)(rng);
+}
+
+// Every rect gets a pixel of spacing right of and below it, as glyphs do.
+static rbp::RectSize _cjk(std::mt19937&)
+{
+	return rbp::RectSize{ 24 + 1, 24 + 1 };
+}
+
+static rbp::RectSize _latin(std::mt19937& rng)
+{
+	return rbp::RectSize{ _uniform(rng, 6, 20) + 1, 24 + 1 };
+}
+
+static rbp::RectSize _mixed(std::mt19937& rng)
+{
+	int pick = _uniform(rng, 0, 99);
+	if (pick < 50)
+		return _cjk(rng);
+	if (pick < 85)
+		return _latin(rng);
+	// Scripts with taller lines, like Thai or Arabic with their marks.
+	return rbp::RectSize{ _uniform(rng, 4, 24) + 1, 30 + 1 };
+}
+
+static rbp::RectSize _cropped(std::mt19937& rng)
+{
+	return rbp::RectSize{ _uniform(rng, 2, 24) + 1, _uniform(rng, 2, 24) + 1 };
+}
+
+static const Distribution _distributions[] =
+{
+	{ "cjk", "monospace CJK, 24x24 cells", _cjk },
+	{ "latin", "proportional Latin, 6 to 20 wide and 24 high", _latin },
+	{ "mixed", "half CJK, a third Latin, the rest 4 to 24 wide and 30 high", _mixed },
+	{ "cropped", "ink cropped glyphs, 2 to 24 wide and high", _cropped },
+};
+
+typedef std::chrono::steady_clock Clock;
+
+static double _seconds_since(Clock::time_point start)
+{
+	return std::chrono::duration<double>(Clock::now() - start).count();
+}
+
+// Inserts rects one by one with insert(w, h), which returns the height of
+// the placed rect (0 if it did not fit), sampling free_size() after each.
+template<typename Insert, typename FreeSize, typename Occupancy>
+static BenchResult _run_online(const std::vector<rbp::RectSize>& rects, Insert insert, FreeSize free_size, Occupancy occupancy)
+{
+	BenchResult r;
+	r.peak_free = free_size();
+	Clock::time_point start = Clock::now();
+	for (const auto& sz : rects)
+	{
+		if (insert(sz.width, sz.height) != 0)
+			++r.placed;
+		r.peak_free = std::max(r.peak_free, free_size());
+	}
+	r.seconds = _seconds_since(start);
+	r.occupancy = occupancy();
+	r.final_free = free_size();
+	return r;
+}
+
+// Hands all rects over to insert(input), which packs what fits of them and
+// returns how many it placed. The peak of the free structure is the one the
+// packer keeps track of itself, peak_size().
+template<typename Insert, typename FreeSize, typename PeakSize, typename Occupancy>
+static BenchResult _run_batch(const std::vector<rbp::RectSize>& rects, Insert insert, FreeSize free_size, PeakSize peak_size,
+	Occupancy occupancy)
+{
+	BenchResult r;
+	std::vector<rbp::RectSize> input = rects;
+	Clock::time_point start = Clock::now();
+	r.placed = insert(input);
+	r.seconds = _seconds_since(start);
+	r.occupancy = occupancy();
+	r.final_free = free_size();
+	r.peak_free = peak_size();
+	return r;
+}
+
+static std::vector<Bench> _make_benches()
+{
+	static const char* const maxrects_names[] = { "bssf", "blsf", "baf", "bl", "cp" };
+	static const char* const skyline_names[] = { "bl", "mw" };
+	static const char* const guillotine_names[] = { "baf", "bssf", "blsf", "waf", "wssf", "wlsf" };
+	static const char* const split_names[] = { "slas", "llas", "minas", "maxas", "sas", "las" };
+	static const char* const shelf_names[] = { "nf", "ff", "baf", "waf", "bhf", "bwf", "wwf" };
+
+	std::vector<Bench> benches;
+
+	for (int m = 0; m < 5; ++m)
+	{
+		auto method = (rbp::MaxRectsBinPack::FreeRectChoiceHeuristic)m;
+		benches.push_back(Bench{ std::string("maxrects-") + maxrects_names[m], "online",
+			[method](const std::vector<rbp::RectSize>& rects, int w, int h) {
+				rbp::MaxRectsBinPack bin(w, h, false);
+				return _run_online(rects,
+					[&](int rw, int rh) { return bin.Insert(rw, rh, method).height; },
+					[&]() { return (long long)bin.GetFreeRectangles().size(); },
+					[&]() { return bin.Occupancy(); });
+			} });
+		benches.push_back(Bench{ std::string("maxrects-") + maxrects_names[m], "batch",
+			[method](const std::vector<rbp::RectSize>& rects, int w, int h) {
+				rbp::MaxRectsBinPack bin(w, h, false);
+				std::vector<rbp::Rect> dst;
+				return _run_batch(rects,
+					[&](std::vector<rbp::RectSize>& input) { bin.Insert(input, dst, method); return dst.size(); },
+					[&]() { return (long long)bin.GetFreeRectangles().size(); },
+					[&]() { return (long long)bin.PeakFreeCount(); },
+					[&]() { return bin.Occupancy(); });
+			} });
+	}
+
+	for (int m = 0; m < 2; ++m)
+	{
+		for (int wm = 0; wm < 2; ++wm)
+		{
+			auto method = (rbp::SkylineBinPack::LevelChoiceHeuristic)m;
+			bool waste_map = (wm != 0);
+			benches.push_back(Bench{ std::string("skyline-") + skyline_names[m] + (waste_map ? "-wastemap" : ""), "online",
+				[method, waste_map](const std::vector<rbp::RectSize>& rects, int w, int h) {
+					rbp::SkylineBinPack bin(w, h, waste_map, false);
+					return _run_online(rects,
+						[&](int rw, int rh) { return bin.Insert(rw, rh, method).height; },
+						[&]() { return (long long)(bin.SkylineLevels() + bin.WasteMapFreeCount()); },
+						[&]() { return bin.Occupancy(); });
+				} });
+		}
+		auto method = (rbp::SkylineBinPack::LevelChoiceHeuristic)m;
+		benches.push_back(Bench{ std::string("skyline-") + skyline_names[m], "batch",
+			[method](const std::vector<rbp::RectSize>& rects, int w, int h) {
+				rbp::SkylineBinPack bin(w, h, false, false);
+				std::vector<rbp::Rect> dst;
+				return _run_batch(rects,
+					[&](std::vector<rbp::RectSize>& input) { bin.Insert(input, dst, method); return dst.size(); },
+					[&]() { return (long long)bin.SkylineLevels(); },
+					[&]() { return (long long)bin.PeakFreeCount(); },
+					[&]() { return bin.Occupancy(); });
+			} });
+	}
+
+	for (int c = 0; c < 6; ++c)
+	{
+		for (int s = 0; s < 6; ++s)
+		{
+			for (int mg = 0; mg < 2; ++mg)
+			{
+				auto choice = (rbp::GuillotineBinPack::FreeRectChoiceHeuristic)c;
+				auto split = (rbp::GuillotineBinPack::GuillotineSplitHeuristic)s;
+				bool merge = (mg != 0);
+				benches.push_back(Bench{ std::string("guillotine-") + guillotine_names[c] + "-" + split_names[s] + (merge ? "-merge" : ""), "online",
+					[choice, split, merge](const std::vector<rbp::RectSize>& rects, int w, int h) {
+						rbp::GuillotineBinPack bin(w, h, false);
+						return _run_online(rects,
+							[&](int rw, int rh) { return bin.Insert(rw, rh, merge, choice, split).height; },
+							[&]() { return (long long)bin.GetFreeRectangles().size(); },
+							[&]() { return bin.Occupancy(); });
+					} });
+				benches.push_back(Bench{ std::string("guillotine-") + guillotine_names[c] + "-" + split_names[s] + (merge ? "-merge" : ""), "batch",
+					[choice, split, merge](const std::vector<rbp::RectSize>& rects, int w, int h) {
+						rbp::GuillotineBinPack bin(w, h, false);
+						return _run_batch(rects,
+							[&](std::vector<rbp::RectSize>& input) { bin.Insert(input, merge, choice, split); return bin.GetUsedRectangles().size(); },
+							[&]() { return (long long)bin.GetFreeRectangles().size(); },
+							[&]() { return (long long)bin.PeakFreeCount(); },
+							[&]() { return bin.Occupancy(); });
+					} });
+			}
+		}
+	}
+
+	for (int m = 0; m < 7; ++m)
+	{
+		for (int wm = 0; wm < 2; ++wm)
+		{
+			auto method = (rbp::ShelfBinPack::ShelfChoiceHeuristic)m;
+			bool waste_map = (wm != 0);
+			benches.push_back(Bench{ std::string("shelf-") + shelf_names[m] + (waste_map ? "-wastemap" : ""), "online",
+				[method, waste_map](const std::vector<rbp::RectSize>& rects, int w, int h) {
+					rbp::ShelfBinPack bin(w, h, waste_map);
+					return _run_online(rects,
+						[&](int rw, int rh) { return bin.Insert(rw, rh, method).height; },
+						[&]() { return (long long)bin.ShelfCount(); },
+						[&]() { return bin.Occupancy(); });
+				} });
+		}
+	}
+
+	benches.push_back(Bench{ "shelfnextfit", "online",
+		[](const std::vector<rbp::RectSize>& rects, int w, int h) {
+			rbp::ShelfNextFitBinPack bin;
+			bin.Init(w, h);
+			BenchResult r = _run_online(rects,
+				[&](int rw, int rh) { return bin.Insert(rw, rh).height; },
+				[]() { return -1LL; },
+				[&]() { return bin.Occupancy(); });
+			return r;
+		} });
+
+	return benches;
+}
+
+static std::vector<std::string> _split(const std::string& list)
+{
+	std::vector<std::string> items;
+	size_t begin = 0;
+	while (begin <= list.size())
+	{
+		size_t end = list.find(',', begin);
+		if (end == std::string::npos)
+			end = list.size();
+		if (end > begin)
+			items.push_back(list.substr(begin, end - begin));
+		begin = end + 1;
+	}
+	return items;
+}
+
+static bool _selected(const std::string& name, const std::vector<std::string>& filters)
+{
+	if (filters.empty())
+		return true;
+	for (const auto& f : filters)
+		if (name.compare(0, f.size(), f) == 0)
+			return true;
+	return false;
+}
+
+void show_help()
+{
+	::printf(
+		"Usage: \n\tpackbench [-n counts] [-d distributions] [-p packers] [-t seconds] [-s seed] [-W width] [-H height] [-o json_file]\n\tpackbench -h\n\n"
+		"packbench measures the packers of RectangleBinPack on glyph like rects and reports them as JSON.\n"
+		"\'-n\' comma separated rect counts (default is 1000,10000,100000).\n"
+		"\'-d\' comma separated distributions: cjk, latin, mixed, cropped (default is all of them).\n"
+		"\'-p\' comma separated prefixes of packer names, like \'maxrects\' or \'guillotine-baf\' (default is every packer).\n"
+		"\'-t\' once a packer takes longer than that for a count, larger counts are skipped for it (default is 5).\n"
+		"\'-s\' seed of the rect sizes (default is 1).\n"
+		"\'-W\' and \'-H\' the bin size. By default a square bin of 1.25 times the area of the rects.\n"
+		"\'-o\' writes the JSON to that file instead of the standard output.\n"
+		"\'-h\' shows this message.\n");
+}
+
+int main(int argc, char *argv[])
+{
+	std::vector<size_t> counts = { 1000, 10000, 100000 };
+	std::vector<std::string> distribution_names;
+	std::vector<std::string> packer_filters;
+	double budget = 5;
+	unsigned int seed = 1;
+	int binW = 0;
+	int binH = 0;
+	std::string output;
+
+	int opt;
+	while ((opt = xgetopt(argc, argv, "n:d:p:t:s:W:H:o:h")) != -1)
+	{
+		switch (opt)
+		{
+		case 'n':
+			counts.clear();
+			for (const auto& item : _split(xoptarg))
+			{
+				unsigned long count = 0;
+				if (0 >= ::sscanf(item.c_str(), "%lu", &count) || count == 0)
+				{
+					fprintf(stderr, "Error: \'%s\' is not a valid count.\n", item.c_str());
+					return 1;
+				}
+				counts.push_back((size_t)count);
+			}
+			std::sort(counts.begin(), counts.end());
+			break;
+		case 'd':
+			distribution_names = _split(xoptarg);
+			break;
+		case 'p':
+			packer_filters = _split(xoptarg);
+			break;
+		case 't':
+			if (0 >= ::sscanf(xoptarg, "%lf", &budget))
+			{
+				fprintf(stderr, "Error: \'%s\' is not a number.\n", xoptarg);
+				return 1;
+			}
+			break;
+		case 's':
+			if (0 >= ::sscanf(xoptarg, "%u", &seed))
+			{
+				fprintf(stderr, "Error: \'%s\' is not a number.\n", xoptarg);
+				return 1;
+			}
+			break;
+		case 'W':
+			if (0 >= ::sscanf(xoptarg, "%d", &binW))
+			{
+				fprintf(stderr, "Error: \'%s\' is not a number.\n", xoptarg);
+				return 1;
+			}
+			break;
+		case 'H':
+			if (0 >= ::sscanf(xoptarg, "%d", &binH))
+			{
+				fprintf(stderr, "Error: \'%s\' is not a number.\n", xoptarg);
+				return 1;
+			}
+			break;
+		case 'o':
+			output = xoptarg;
+			break;
+		default:
+		case 'h':
+			show_help();
+			return (opt == 'h') ? 0 : 1;
+		}
+	}
+
+	std::vector<const Distribution*> distributions;
+	for (const auto& d : _distributions)
+	{
+		if (distribution_names.empty() || std::find(distribution_names.begin(), distribution_names.end(), d.name) != distribution_names.end())
+			distributions.push_back(&d);
+	}
+	for (const auto& name : distribution_names)
+	{
+		if (std::none_of(distributions.begin(), distributions.end(), [&name](const Distribution* d) { return name == d->name; }))
+		{
+			fprintf(stderr, "Error: Unknown distribution \'%s\'.\n", name.c_str());
+			return 1;
+		}
+	}
+
+	std::vector<Bench> benches;
+	for (auto& b : _make_benches())
+	{
+		if (_selected(b.name, packer_filters))
+			benches.push_back(b);
+	}
+	if (benches.empty())
+	{
+		fprintf(stderr, "Error: No packer matches \'-p\'.\n");
+		return 1;
+	}
+
+	FILE* out = stdout;
+	if (!output.empty() && !(out = ::fopen(output.c_str(), "wb")))
+	{
+		fprintf(stderr, "Error: Unable to open file: %s for writing.\n", output.c_str());
+		return 1;
+	}
+
+	fprintf(out, "{\n  \"benchmark\": \"packbench\",\n  \"version\": 1,\n  \"seed\": %u,\n  \"budget_seconds\": %.9g,\n  \"distributions\": [", seed, budget);
+	for (size_t d = 0; d < distributions.size(); ++d)
+		fprintf(out, "%s\n    { \"name\": \"%s\", \"description\": \"%s\" }", d ? "," : "", distributions[d]->name, distributions[d]->description);
+	fprintf(out, "\n  ],\n  \"results\": [");
+
+	bool first = true;
+	std::vector<std::string> skipped;
+	for (const Distribution* d : distributions)
+	{
+		// Each count gets its own rects, the same for every packer.
+		std::vector<std::vector<rbp::RectSize>> inputs;
+		for (size_t count : counts)
+		{
+			std::mt19937 rng(seed);
+			std::vector<rbp::RectSize> rects;
+			rects.reserve(count);
+			for (size_t i = 0; i < count; ++i)
+				rects.push_back(d->make(rng));
+			inputs.push_back(rects);
+		}
+
+		for (const auto& b : benches)
+		{
+			for (size_t c = 0; c < counts.size(); ++c)
+			{
+				const std::vector<rbp::RectSize>& rects = inputs[c];
+				unsigned long long area = 0;
+				for (const auto& sz : rects)
+					area += (unsigned long long)sz.width * sz.height;
+				int side = (int)std::ceil(std::sqrt(area * 1.25));
+				int w = binW > 0 ? binW : side;
+				int h = binH > 0 ? binH : side;
+
+				fprintf(stderr, "%s %s %s %u...\n", d->name, b.name.c_str(), b.mode.c_str(), (unsigned int)rects.size());
+				BenchResult r = b.run(rects, w, h);
+
+				fprintf(out, "%s\n    { \"distribution\": \"%s\", \"packer\": \"%s\", \"mode\": \"%s\", \"count\": %u, \"bin\": [%d, %d], "
+					"\"placed\": %u, \"seconds\": %.9g, \"ns_per_insert\": %.9g, \"occupancy\": %.9g, ",
+					first ? "" : ",", d->name, b.name.c_str(), b.mode.c_str(), (unsigned int)rects.size(), w, h,
+					(unsigned int)r.placed, r.seconds, r.seconds * 1e9 / rects.size(), r.occupancy);
+				if (r.peak_free >= 0)
+					fprintf(out, "\"peak_free\": %lld, ", r.peak_free);
+				else
+					fprintf(out, "\"peak_free\": null, ");
+				if (r.final_free >= 0)
+					fprintf(out, "\"final_free\": %lld }", r.final_free);
+				else
+					fprintf(out, "\"final_free\": null }");
+				first = false;
+
+				if (r.seconds > budget)
+				{
+					for (size_t s = c + 1; s < counts.size(); ++s)
+						skipped.push_back(std::string("{ \"distribution\": \"") + d->name + "\", \"packer\": \"" + b.name
+							+ "\", \"mode\": \"" + b.mode + "\", \"count\": " + std::to_string(counts[s]) + " }");
+					break;
+				}
+			}
+		}
+	}
+
+	fprintf(out, "\n  ],\n  \"skipped\": [");
+	for (size_t s = 0; s < skipped.size(); ++s)
+		fprintf(out, "%s\n    %s", s ? "," : "", skipped[s].c_str());
+	fprintf(out, "\n  ]\n}\n");
+
+	if (out != stdout)
+		::fclose(out);
+	return 0;
+}
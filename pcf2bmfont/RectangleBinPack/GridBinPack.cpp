@@ -0,0 +1,113 @@
+/** @file GridBinPack.cpp
+
+	@brief Implements a bin packer for rectangles that all have the same size.
+*/
+#include <algorithm>
+
+#include "GridBinPack.h"
+
+namespace rbp {
+
+using namespace std;
+
+GridBinPack::GridBinPack()
+:binWidth(0),
+binHeight(0),
+cellWidth(0),
+cellHeight(0),
+cellOrder(CellRowMajor),
+columns(0),
+rows(0),
+nextCell(0),
+usedSurfaceArea(0)
+{
+}
+
+GridBinPack::GridBinPack(int width, int height, int cellW, int cellH, CellOrder order)
+{
+	Init(width, height, cellW, cellH, order);
+}
+
+void GridBinPack::Init(int width, int height, int cellW, int cellH, CellOrder order)
+{
+	binWidth = width;
+	binHeight = height;
+	cellWidth = cellW;
+	cellHeight = cellH;
+	cellOrder = order;
+
+	columns = (cellWidth > 0) ? max(binWidth, 0) / cellWidth : 0;
+	rows = (cellHeight > 0) ? max(binHeight, 0) / cellHeight : 0;
+	nextCell = 0;
+	usedSurfaceArea = 0;
+}
+
+bool GridBinPack::IsUniform(const std::vector<RectSize> &rects)
+{
+	for(size_t i = 1; i < rects.size(); ++i)
+		if (rects[i].width != rects[0].width || rects[i].height != rects[0].height)
+			return false;
+	return true;
+}
+
+void GridBinPack::Insert(std::vector<RectSize> &rects, std::vector<Rect> &dst)
+{
+	dst.reserve(dst.size() + min(rects.size(), (size_t)FreeCells()));
+
+	// Keep what does not fit in place, in order, by compacting it to the front.
+	size_t kept = 0;
+	for(size_t i = 0; i < rects.size(); ++i)
+	{
+		Rect r = Insert(rects[i].width, rects[i].height);
+		if (r.height != 0)
+			dst.push_back(r);
+		else
+			rects[kept++] = rects[i];
+	}
+	rects.resize(kept);
+}
+
+Rect GridBinPack::Insert(int width, int height)
+{
+	Rect newNode = { 0, 0, 0, 0 };
+	if (width <= 0 || height <= 0 || width > cellWidth || height > cellHeight || nextCell >= Capacity())
+		return newNode;
+
+	newNode = CellRect(nextCell++);
+	newNode.width = width;
+	newNode.height = height;
+	usedSurfaceArea += (unsigned long)width * height;
+	return newNode;
+}
+
+int GridBinPack::Capacity() const
+{
+	return columns * rows;
+}
+
+int GridBinPack::FreeCells() const
+{
+	return Capacity() - nextCell;
+}
+
+float GridBinPack::Occupancy() const
+{
+	if (binWidth <= 0 || binHeight <= 0)
+		return 0.f;
+	return (float)usedSurfaceArea / ((float)binWidth * binHeight);
+}
+
+Rect GridBinPack::CellRect(int cell) const
+{
+	int column = (cellOrder == CellRowMajor) ? cell % columns : cell / rows;
+	int row = (cellOrder == CellRowMajor) ? cell / columns : cell % rows;
+
+	Rect r;
+	r.x = column * cellWidth;
+	r.y = row * cellHeight;
+	r.width = cellWidth;
+	r.height = cellHeight;
+	return r;
+}
+
+}
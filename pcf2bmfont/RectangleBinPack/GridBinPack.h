@@ -0,0 +1,74 @@
+/** @file GridBinPack.h
+
+	@brief Implements a bin packer for rectangles that all have the same size.
+
+	The bin is cut into equal cells and the rectangles take the cells in
+	order, so the layout is computed arithmetically in O(n). Fixed cell
+	fonts pack into exactly this, without the cost of MaxRects.
+*/
+#pragma once
+
+#include <vector>
+
+#include "Rect.h"
+
+namespace rbp {
+
+class GridBinPack
+{
+public:
+	/// Specifies the order in which cells are handed out.
+	enum CellOrder
+	{
+		CellRowMajor, ///< Left to right, then top to bottom.
+		CellColumnMajor ///< Top to bottom, then left to right.
+	};
+
+	/// Instantiates a bin of size (0,0). Call Init to create a new bin.
+	GridBinPack();
+
+	/// Instantiates a bin of the given size, cut into cells of cellWidth x cellHeight units.
+	GridBinPack(int width, int height, int cellWidth, int cellHeight, CellOrder order = CellRowMajor);
+
+	/// (Re)initializes the packer to an empty bin.
+	void Init(int width, int height, int cellWidth, int cellHeight, CellOrder order = CellRowMajor);
+
+	/// @return True if every rectangle of rects has the same size.
+	static bool IsUniform(const std::vector<RectSize> &rects);
+
+	/// Inserts the given list of rectangles, in order, into the next free cells.
+	/// Rectangles bigger than a cell are not placed. Placed rectangles are removed
+	/// from rects and appended to dst in the same order; the rest stay in rects.
+	void Insert(std::vector<RectSize> &rects, std::vector<Rect> &dst);
+
+	/// Inserts a single rectangle into the next free cell.
+	/// @return The placed rectangle, or a rectangle of height 0 if it is bigger than a cell or the bin is full.
+	Rect Insert(int width, int height);
+
+	/// @return The number of cells of the bin.
+	int Capacity() const;
+
+	/// @return The number of cells still free.
+	int FreeCells() const;
+
+	/// Computes the ratio of used surface area to the total bin area.
+	float Occupancy() const;
+
+private:
+	int binWidth;
+	int binHeight;
+	int cellWidth;
+	int cellHeight;
+	CellOrder cellOrder;
+
+	int columns;
+	int rows;
+	int nextCell;
+
+	unsigned long usedSurfaceArea;
+
+	/// @return The rectangle of the given cell, which is less than Capacity().
+	Rect CellRect(int cell) const;
+};
+
+}
@@ -24,19 +24,22 @@ using namespace std;
 
 GuillotineBinPack::GuillotineBinPack()
 :binWidth(0),
-binHeight(0)
+binHeight(0),
+binAllowFlip(true),
+peakFreeCount(0)
 {
 }
 
-GuillotineBinPack::GuillotineBinPack(int width, int height)
+GuillotineBinPack::GuillotineBinPack(int width, int height, bool allowFlip)
 {
-	Init(width, height);
+	Init(width, height, allowFlip);
 }
 
-void GuillotineBinPack::Init(int width, int height)
+void GuillotineBinPack::Init(int width, int height, bool allowFlip)
 {
 	binWidth = width;
 	binHeight = height;
+	binAllowFlip = allowFlip;
 
 #ifdef _DEBUG
 	disjointRects.Clear();
@@ -54,6 +57,7 @@ void GuillotineBinPack::Init(int width, int height)
 
 	freeRectangles.clear();
 	freeRectangles.push_back(n);
+	peakFreeCount = 1;
 }
 
 void GuillotineBinPack::Insert(std::vector<RectSize> &rects, bool merge, 
@@ -86,7 +90,7 @@ void GuillotineBinPack::Insert(std::vector<RectSize> &rects, bool merge,
 					break;
 				}
 				// If flipping this rectangle is a perfect match, pick that then.
-				else if (rects[j].height == freeRectangles[i].width && rects[j].width == freeRectangles[i].height)
+				else if (binAllowFlip && rects[j].height == freeRectangles[i].width && rects[j].width == freeRectangles[i].height)
 				{
 					bestFreeRect = i;
 					bestRect = j;
@@ -108,7 +112,7 @@ void GuillotineBinPack::Insert(std::vector<RectSize> &rects, bool merge,
 					}
 				}
 				// If not, then perhaps flipping sideways will make it fit?
-				else if (rects[j].height <= freeRectangles[i].width && rects[j].width <= freeRectangles[i].height)
+				else if (binAllowFlip && rects[j].height <= freeRectangles[i].width && rects[j].width <= freeRectangles[i].height)
 				{
 					int score = ScoreByHeuristic(rects[j].height, rects[j].width, freeRectangles[i], rectChoice);
 					if (score < bestScore)
@@ -149,6 +153,7 @@ void GuillotineBinPack::Insert(std::vector<RectSize> &rects, bool merge,
 
 		// Remember the new used rectangle.
 		usedRectangles.push_back(newNode);
+		peakFreeCount = max(peakFreeCount, freeRectangles.size());
 
 		// Check that we're really producing correct packings here.
 		debug_assert(disjointRects.Add(newNode) == true);
@@ -360,6 +365,7 @@ Rect GuillotineBinPack::Insert(int width, int height, bool merge, FreeRectChoice
 
 	// Remember the new used rectangle.
 	usedRectangles.push_back(newRect);
+	peakFreeCount = max(peakFreeCount, freeRectangles.size());
 
 	// Check that we're really producing correct packings here.
 	debug_assert(disjointRects.Add(newRect) == true);
@@ -453,7 +459,7 @@ Rect GuillotineBinPack::FindPositionForNewNode(int width, int height, FreeRectCh
 			break;
 		}
 		// If this is a perfect fit sideways, choose it.
-		else if (height == freeRectangles[i].width && width == freeRectangles[i].height)
+		else if (binAllowFlip && height == freeRectangles[i].width && width == freeRectangles[i].height)
 		{
 			bestNode.x = freeRectangles[i].x;
 			bestNode.y = freeRectangles[i].y;
@@ -481,7 +487,7 @@ Rect GuillotineBinPack::FindPositionForNewNode(int width, int height, FreeRectCh
 			}
 		}
 		// Does the rectangle fit sideways?
-		else if (height <= freeRectangles[i].width && width <= freeRectangles[i].height)
+		else if (binAllowFlip && height <= freeRectangles[i].width && width <= freeRectangles[i].height)
 		{
 			int score = ScoreByHeuristic(height, width, freeRectangles[i], rectChoice);
 
@@ -586,6 +592,69 @@ void GuillotineBinPack::SplitFreeRectAlongAxis(const Rect &freeRect, const Rect
 	debug_assert(disjointRects.Disjoint(right));
 }
 
+/// Merges b into a if the two are adjacent and together form a single rectangle.
+/// @return True if b was merged into a.
+static bool MergeAdjacent(Rect &a, const Rect &b)
+{
+	if (a.width == b.width && a.x == b.x)
+	{
+		if (a.y == b.y + b.height)
+		{
+			a.y -= b.height;
+			a.height += b.height;
+			return true;
+		}
+		else if (a.y + a.height == b.y)
+		{
+			a.height += b.height;
+			return true;
+		}
+	}
+	else if (a.height == b.height && a.y == b.y)
+	{
+		if (a.x == b.x + b.width)
+		{
+			a.x -= b.width;
+			a.width += b.width;
+			return true;
+		}
+		else if (a.x + a.width == b.x)
+		{
+			a.width += b.width;
+			return true;
+		}
+	}
+	return false;
+}
+
+/// Identifies one edge of a rectangle: which side it is, the position and length of the side,
+/// and the coordinate it lies at. Different edges may share a key, so matches need checking.
+static unsigned long long EdgeKey(int side, int position, int length, int coordinate)
+{
+	unsigned long long key = (unsigned int)position;
+	key = key * 0x9E3779B97F4A7C15ull + (unsigned int)length;
+	key = key * 0x9E3779B97F4A7C15ull + (unsigned int)coordinate;
+	return key * 4 + side;
+}
+
+enum { EdgeBottom, EdgeTop, EdgeRight, EdgeLeft };
+
+/// Returns the slot of the edge table of mask+1 slots that looking for key starts at.
+static size_t EdgeSlot(unsigned long long key, size_t mask)
+{
+	return (size_t)((key * 0x9E3779B97F4A7C15ull) >> 32) & mask;
+}
+
+void GuillotineBinPack::AddEdge(unsigned long long key, int rectIndex)
+{
+	size_t mask = edgeTable.size() - 1;
+	size_t slot = EdgeSlot(key, mask);
+	while(edgeTable[slot].rectIndex >= 0)
+		slot = (slot + 1) & mask;
+	edgeTable[slot].key = key;
+	edgeTable[slot].rectIndex = rectIndex;
+}
+
 void GuillotineBinPack::MergeFreeList()
 {
 #ifdef _DEBUG
@@ -594,44 +663,74 @@ void GuillotineBinPack::MergeFreeList()
 		assert(test.Add(freeRectangles[i]) == true);
 #endif
 
-	// Do a Theta(n^2) loop to see if any pair of free rectangles could me merged into one.
-	// Note that we miss any opportunities to merge three rectangles into one. (should call this function again to detect that)
-	for(size_t i = 0; i < freeRectangles.size(); ++i)
-		for(size_t j = i+1; j < freeRectangles.size(); ++j)
+	// Merges the same pairs as comparing every rectangle i with each later rectangle j in turn would,
+	// but finds the j to merge from the edges i touches. Note that we miss any opportunities to merge
+	// three rectangles into one. (should call this function again to detect that)
+	const int count = (int)freeRectangles.size();
+	size_t tableSize = 16;
+	while(tableSize < 8 * (size_t)count)
+		tableSize *= 2;
+	EdgeEntry empty = { 0, -1 };
+	edgeTable.assign(tableSize, empty);
+	for(int j = 0; j < count; ++j)
+	{
+		const Rect &r = freeRectangles[j];
+		AddEdge(EdgeKey(EdgeBottom, r.x, r.width, r.y + r.height), j);
+		AddEdge(EdgeKey(EdgeTop, r.x, r.width, r.y), j);
+		AddEdge(EdgeKey(EdgeRight, r.y, r.height, r.x + r.width), j);
+		AddEdge(EdgeKey(EdgeLeft, r.y, r.height, r.x), j);
+	}
+
+	// Rectangles after i are only changed by being merged away, so their edges stay as indexed.
+	mergedAway.assign(count, false);
+	const size_t mask = tableSize - 1;
+	for(int i = 0; i < count; ++i)
+	{
+		if (mergedAway[i])
+			continue;
+
+		for(int last = i;;)
 		{
-			if (freeRectangles[i].width == freeRectangles[j].width && freeRectangles[i].x == freeRectangles[j].x)
+			Rect &r = freeRectangles[i];
+			const unsigned long long touching[4] =
 			{
-				if (freeRectangles[i].y == freeRectangles[j].y + freeRectangles[j].height)
-				{
-					freeRectangles[i].y -= freeRectangles[j].height;
-					freeRectangles[i].height += freeRectangles[j].height;
-					freeRectangles.erase(freeRectangles.begin() + j);
-					--j;
-				}
-				else if (freeRectangles[i].y + freeRectangles[i].height == freeRectangles[j].y)
-				{
-					freeRectangles[i].height += freeRectangles[j].height;
-					freeRectangles.erase(freeRectangles.begin() + j);
-					--j;
-				}
-			}
-			else if (freeRectangles[i].height == freeRectangles[j].height && freeRectangles[i].y == freeRectangles[j].y)
+				EdgeKey(EdgeBottom, r.x, r.width, r.y),
+				EdgeKey(EdgeTop, r.x, r.width, r.y + r.height),
+				EdgeKey(EdgeRight, r.y, r.height, r.x),
+				EdgeKey(EdgeLeft, r.y, r.height, r.x + r.width)
+			};
+
+			// The first rectangle after the last one merged that i merges with.
+			int next = count;
+			Rect mergedRect;
+			for(int k = 0; k < 4; ++k)
 			{
-				if (freeRectangles[i].x == freeRectangles[j].x + freeRectangles[j].width)
+				for(size_t slot = EdgeSlot(touching[k], mask); edgeTable[slot].rectIndex >= 0; slot = (slot + 1) & mask)
 				{
-					freeRectangles[i].x -= freeRectangles[j].width;
-					freeRectangles[i].width += freeRectangles[j].width;
-					freeRectangles.erase(freeRectangles.begin() + j);
-					--j;
-				}
-				else if (freeRectangles[i].x + freeRectangles[i].width == freeRectangles[j].x)
-				{
-					freeRectangles[i].width += freeRectangles[j].width;
-					freeRectangles.erase(freeRectangles.begin() + j);
-					--j;
+					int j = edgeTable[slot].rectIndex;
+					Rect candidate = r;
+					if (edgeTable[slot].key == touching[k] && j > last && j < next && !mergedAway[j] &&
+						MergeAdjacent(candidate, freeRectangles[j]))
+					{
+						next = j;
+						mergedRect = candidate;
+					}
 				}
 			}
+			if (next == count)
+				break;
+
+			r = mergedRect;
+			mergedAway[next] = true;
+			last = next;
 		}
+	}
+
+	int kept = 0;
+	for(int i = 0; i < count; ++i)
+		if (!mergedAway[i])
+			freeRectangles[kept++] = freeRectangles[i];
+	freeRectangles.resize(kept);
 
 #ifdef _DEBUG
 	test.Clear();
@@ -22,11 +22,12 @@ public:
 	GuillotineBinPack();
 
 	/// Initializes a new bin of the given size.
-	GuillotineBinPack(int width, int height);
+	/// @param allowFlip Specifies whether the packing algorithm is allowed to rotate the input rectangles by 90 degrees to consider a better placement.
+	GuillotineBinPack(int width, int height, bool allowFlip = true);
 
 	/// (Re)initializes the packer to an empty bin of width x height units. Call whenever
 	/// you need to restart with a new bin.
-	void Init(int width, int height);
+	void Init(int width, int height, bool allowFlip = true);
 
 	/// Specifies the different choice heuristics that can be used when deciding which of the free subrectangles
 	/// to place the to-be-packed rectangle into.
@@ -79,25 +80,33 @@ public:
 	/// Returns the internal list of disjoint rectangles that track the free area of the bin. You may alter this vector
 	/// any way desired, as long as the end result still is a list of disjoint rectangles.
 	std::vector<Rect> &GetFreeRectangles() { return freeRectangles; }
+	const std::vector<Rect> &GetFreeRectangles() const { return freeRectangles; }
+
+	/// @return The largest number of free rectangles the bin had after any Insert since it was (re)initialized.
+	size_t PeakFreeCount() const { return peakFreeCount; }
 
 	/// Returns the list of packed rectangles. You may alter this vector at will, for example, you can move a Rect from
 	/// this list to the Free Rectangles list to free up space on-the-fly, but notice that this causes fragmentation.
 	std::vector<Rect> &GetUsedRectangles() { return usedRectangles; }
 
 	/// Performs a Rectangle Merge operation. This procedure looks for adjacent free rectangles and merges them if they
-	/// can be represented with a single rectangle. Takes up Theta(|freeRectangles|^2) time.
+	/// can be represented with a single rectangle. Finds the neighbors of each rectangle through a hash map keyed by
+	/// the edges of the rectangles, taking up expected O(|freeRectangles|) time.
 	void MergeFreeList();
 
 private:
 	int binWidth;
 	int binHeight;
 
+	bool binAllowFlip;
+
 	/// Stores a list of all the rectangles that we have packed so far. This is used only to compute the Occupancy ratio,
 	/// so if you want to have the packer consume less memory, this can be removed.
 	std::vector<Rect> usedRectangles;
 
 	/// Stores a list of rectangles that represents the free area of the bin. This rectangles in this list are disjoint.
 	std::vector<Rect> freeRectangles;
+	size_t peakFreeCount;
 
 #ifdef _DEBUG
 	/// Used to track that the packer produces proper packings.
@@ -129,6 +138,20 @@ private:
 
 	/// Splits the given L-shaped free rectangle into two new free rectangles along the given fixed split axis.
 	void SplitFreeRectAlongAxis(const Rect &freeRect, const Rect &placedRect, bool splitHorizontal);
+
+	/// An edge of a free rectangle, in the open addressing hash table MergeFreeList finds neighbors with.
+	struct EdgeEntry
+	{
+		unsigned long long key;
+		/// The index of the free rectangle, or -1 for an empty slot.
+		int rectIndex;
+	};
+
+	/// Kept between calls to MergeFreeList to save allocating them each time.
+	std::vector<EdgeEntry> edgeTable;
+	std::vector<bool> mergedAway;
+
+	void AddEdge(unsigned long long key, int rectIndex);
 };
 
 }
@@ -9,6 +9,7 @@
 #include <utility>
 #include <iostream>
 #include <limits>
+#include <map>
 
 #include <cassert>
 #include <cstring>
@@ -22,7 +23,14 @@ using namespace std;
 
 MaxRectsBinPack::MaxRectsBinPack()
 :binWidth(0),
-binHeight(0)
+binHeight(0),
+peakFreeCount(0),
+nextFreeRectangleId(0),
+gridCellWidth(1),
+gridCellHeight(1),
+gridColumns(0),
+gridRows(0),
+gridQuery(0)
 {
 }
 
@@ -46,7 +54,22 @@ void MaxRectsBinPack::Init(int width, int height, bool allowFlip)
 	usedRectangles.clear();
 
 	freeRectangles.clear();
-	freeRectangles.push_back(n);
+	freeRectangleIds.clear();
+	freeRectangleById.clear();
+	nextFreeRectangleId = 0;
+
+	// Up to 32x32 cells, of at least 16x16 units.
+	gridCellWidth = max(16, (width + 31) / 32);
+	gridCellHeight = max(16, (height + 31) / 32);
+	gridColumns = max(1, (width + gridCellWidth - 1) / gridCellWidth);
+	gridRows = max(1, (height + gridCellHeight - 1) / gridCellHeight);
+	gridCells.assign((size_t)gridColumns * gridRows, std::vector<unsigned int>());
+	gridVisited.clear();
+	gridQuery = 0;
+
+	AddFreeRect(n);
+	GridInsert(freeRectangleIds.back());
+	peakFreeCount = freeRectangles.size();
 }
 
 Rect MaxRectsBinPack::Insert(int width, int height, FreeRectChoiceHeuristic method)
@@ -67,74 +90,342 @@ Rect MaxRectsBinPack::Insert(int width, int height, FreeRectChoiceHeuristic meth
 	if (newNode.height == 0)
 		return newNode;
 
-	size_t numRectanglesToProcess = freeRectangles.size();
-	for(size_t i = 0; i < numRectanglesToProcess; ++i)
+	PlaceRect(newNode);
+	return newNode;
+}
+
+void MaxRectsBinPack::Occupy(const Rect &rect)
+{
+	if (rect.width > 0 && rect.height > 0)
+		PlaceRect(rect);
+}
+
+void MaxRectsBinPack::Restore(int width, int height, bool allowFlip, const std::vector<Rect> &used, const std::vector<Rect> &free)
+{
+	Init(width, height, allowFlip);
+
+	// Swap the single free rectangle of an empty bin for the given ones.
+	GridRemove(freeRectangleIds[0]);
+	freeRectangles.clear();
+	freeRectangleIds.clear();
+	for(size_t i = 0; i < free.size(); ++i)
 	{
-		if (SplitFreeNode(freeRectangles[i], newNode))
-		{
-			freeRectangles.erase(freeRectangles.begin() + i);
-			--i;
-			--numRectanglesToProcess;
-		}
+		AddFreeRect(free[i]);
+		GridInsert(freeRectangleIds.back());
 	}
 
-	PruneFreeList();
+	usedRectangles = used;
+	peakFreeCount = freeRectangles.size();
+}
+
+namespace {
+
+/// Rectangles of the same size score the same, so the batch Insert scores each size once.
+struct SizeClass
+{
+	int width;
+	int height;
+	std::vector<size_t> members; ///< Indices into rects, ascending.
+	size_t next; ///< The first member not placed yet.
+
+	Rect node; ///< Where the next member would go, of height 0 if it fits nowhere.
+	int score1;
+	int score2;
+	unsigned int freeId; ///< Id of the free rectangle node lies in.
+};
 
-	usedRectangles.push_back(newNode);
-	return newNode;
 }
 
 void MaxRectsBinPack::Insert(std::vector<RectSize> &rects, std::vector<Rect> &dst, FreeRectChoiceHeuristic method)
 {
 	dst.clear();
 
-	while(rects.size() > 0)
+	// The contact point score also depends on the used rectangles, which every placement changes,
+	// so every rectangle is scored again on every round.
+	if (method == RectContactPointRule)
+	{
+		while(rects.size() > 0)
+		{
+			int bestScore1 = std::numeric_limits<int>::max();
+			int bestScore2 = std::numeric_limits<int>::max();
+			int bestRectIndex = -1;
+			Rect bestNode;
+
+			for(size_t i = 0; i < rects.size(); ++i)
+			{
+				int score1;
+				int score2;
+				Rect newNode = ScoreRect(rects[i].width, rects[i].height, method, score1, score2);
+
+				if (score1 < bestScore1 || (score1 == bestScore1 && score2 < bestScore2))
+				{
+					bestScore1 = score1;
+					bestScore2 = score2;
+					bestNode = newNode;
+					bestRectIndex = i;
+				}
+			}
+
+			if (bestRectIndex == -1)
+				return;
+
+			PlaceRect(bestNode);
+			dst.push_back(bestNode);
+			rects.erase(rects.begin() + bestRectIndex);
+		}
+		return;
+	}
+
+	// Places the same rectangles in the same order as scoring all of them against all free
+	// rectangles on every round would, but keeps the best placement of each size from round to
+	// round. A placement removes some free rectangles and appends new ones behind the rest, so
+	// a kept placement stays the first best one unless its free rectangle went away (then the
+	// size is scored again) or one of the new free rectangles beats it.
+	std::vector<SizeClass> classes;
+	std::map<std::pair<int, int>, size_t> classOf;
+	for(size_t i = 0; i < rects.size(); ++i)
 	{
-		int bestScore1 = std::numeric_limits<int>::max();
-		int bestScore2 = std::numeric_limits<int>::max();
-		int bestRectIndex = -1;
-		Rect bestNode;
+		std::pair<int, int> size(rects[i].width, rects[i].height);
+		std::map<std::pair<int, int>, size_t>::iterator it = classOf.find(size);
+		if (it == classOf.end())
+		{
+			SizeClass sc;
+			sc.width = rects[i].width;
+			sc.height = rects[i].height;
+			sc.next = 0;
+			memset(&sc.node, 0, sizeof(Rect));
+			sc.score1 = std::numeric_limits<int>::max();
+			sc.score2 = std::numeric_limits<int>::max();
+			sc.freeId = 0;
+			it = classOf.insert(std::make_pair(size, classes.size())).first;
+			classes.push_back(sc);
+		}
+		classes[it->second].members.push_back(i);
+	}
+
+	// Sizes with rectangles left that fit somewhere, in no particular order.
+	std::vector<size_t> active(classes.size());
+	for(size_t c = 0; c < classes.size(); ++c)
+		active[c] = c;
 
-		for(size_t i = 0; i < rects.size(); ++i)
+	std::vector<bool> placed(rects.size(), false);
+	std::vector<bool> removed; // By free rectangle id.
+	std::vector<unsigned int> idsBefore;
+	size_t firstNew = 0;
+	for(;;)
+	{
+		// Bring every size up to date and pick the best one along the way. Ties go to the
+		// size whose next rectangle comes first in rects, as they would in the plain loop.
+		SizeClass *best = 0;
+		for(size_t k = 0; k < active.size(); )
 		{
-			int score1;
-			int score2;
-			Rect newNode = ScoreRect(rects[i].width, rects[i].height, method, score1, score2);
+			SizeClass &sc = classes[active[k]];
+			if (sc.next < sc.members.size())
+			{
+				size_t from = firstNew;
+				if (sc.node.height == 0 || removed[sc.freeId])
+				{
+					memset(&sc.node, 0, sizeof(Rect));
+					sc.score1 = std::numeric_limits<int>::max();
+					sc.score2 = std::numeric_limits<int>::max();
+					from = 0;
+				}
+				ScoreFreeRects(from, sc.width, sc.height, method, sc.node, sc.score1, sc.score2, sc.freeId);
+			}
 
-			if (score1 < bestScore1 || (score1 == bestScore1 && score2 < bestScore2))
+			// Free rectangles only ever shrink, a size that fits nowhere never will.
+			if (sc.next == sc.members.size() || sc.node.height == 0)
 			{
-				bestScore1 = score1;
-				bestScore2 = score2;
-				bestNode = newNode;
-				bestRectIndex = i;
+				active[k] = active.back();
+				active.pop_back();
+				continue;
 			}
+
+			if (!best || sc.score1 < best->score1 || (sc.score1 == best->score1 && (sc.score2 < best->score2 ||
+				(sc.score2 == best->score2 && sc.members[sc.next] < best->members[best->next]))))
+				best = &sc;
+			++k;
 		}
 
-		if (bestRectIndex == -1)
-			return;
+		if (!best)
+			break;
 
-		PlaceRect(bestNode);
-		dst.push_back(bestNode);
-		rects.erase(rects.begin() + bestRectIndex);
+		const unsigned int firstNewId = nextFreeRectangleId;
+		idsBefore.assign(freeRectangleIds.begin(), freeRectangleIds.end());
+		PlaceRect(best->node);
+		dst.push_back(best->node);
+		placed[best->members[best->next++]] = true;
+
+		// Both id lists are ascending: the old ids missing now were removed, and the free
+		// rectangles this placement added are at the back.
+		removed.resize(nextFreeRectangleId, false);
+		size_t j = 0;
+		for(size_t i = 0; i < idsBefore.size(); ++i)
+		{
+			while(j < freeRectangleIds.size() && freeRectangleIds[j] < idsBefore[i])
+				++j;
+			if (j == freeRectangleIds.size() || freeRectangleIds[j] != idsBefore[i])
+				removed[idsBefore[i]] = true;
+		}
+		firstNew = lower_bound(freeRectangleIds.begin(), freeRectangleIds.end(), firstNewId) - freeRectangleIds.begin();
 	}
+
+	// Leave what did not fit, in order.
+	size_t kept = 0;
+	for(size_t i = 0; i < rects.size(); ++i)
+		if (!placed[i])
+			rects[kept++] = rects[i];
+	rects.resize(kept);
 }
 
 void MaxRectsBinPack::PlaceRect(const Rect &node)
 {
-	size_t numRectanglesToProcess = freeRectangles.size();
-	for(size_t i = 0; i < numRectanglesToProcess; ++i)
-	{
-		if (SplitFreeNode(freeRectangles[i], node))
+	// The free rectangles the node overlaps, all of which share a grid cell with it.
+	std::vector<unsigned int> hit;
+	int x0, y0, x1, y1;
+	GridCellRange(node, x0, y0, x1, y1);
+	++gridQuery;
+	for(int y = y0; y <= y1; ++y)
+		for(int x = x0; x <= x1; ++x)
 		{
-			freeRectangles.erase(freeRectangles.begin() + i);
-			--i;
-			--numRectanglesToProcess;
+			const std::vector<unsigned int> &cell = gridCells[(size_t)y * gridColumns + x];
+			for(size_t k = 0; k < cell.size(); ++k)
+			{
+				const unsigned int id = cell[k];
+				if (gridVisited[id] == gridQuery)
+					continue;
+				gridVisited[id] = gridQuery;
+
+				// Same test as SplitFreeNode.
+				const Rect &freeNode = freeRectangleById[id];
+				if (node.x >= freeNode.x + freeNode.width || node.x + node.width <= freeNode.x ||
+					node.y >= freeNode.y + freeNode.height || node.y + node.height <= freeNode.y)
+					continue;
+				hit.push_back(id);
+			}
 		}
+
+	// Split them in list order, which is id order, so the new free rectangles are appended
+	// in the same order as going through the whole list would.
+	const unsigned int firstNewId = nextFreeRectangleId;
+	sort(hit.begin(), hit.end());
+	for(size_t k = 0; k < hit.size(); ++k)
+	{
+		GridRemove(hit[k]);
+		SplitFreeNode(freeRectangleById[hit[k]], node);
 	}
 
-	PruneFreeList();
+	// Drop the split ones, keeping the order of the rest.
+	size_t kept = 0;
+	size_t h = 0;
+	for(size_t i = 0; i < freeRectangles.size(); ++i)
+	{
+		while(h < hit.size() && hit[h] < freeRectangleIds[i])
+			++h;
+		if (h < hit.size() && hit[h] == freeRectangleIds[i])
+			continue;
+		freeRectangles[kept] = freeRectangles[i];
+		freeRectangleIds[kept] = freeRectangleIds[i];
+		++kept;
+	}
+	freeRectangles.resize(kept);
+	freeRectangleIds.resize(kept);
+
+	size_t firstNew = kept - (nextFreeRectangleId - firstNewId);
+	PruneFreeList(firstNew);
+	for(size_t i = firstNew; i < freeRectangleIds.size(); ++i)
+		GridInsert(freeRectangleIds[i]);
 
 	usedRectangles.push_back(node);
+	peakFreeCount = max(peakFreeCount, freeRectangles.size());
+}
+
+void MaxRectsBinPack::ScoreFreeRects(size_t first, int width, int height, FreeRectChoiceHeuristic method,
+	Rect &bestNode, int &bestScore1, int &bestScore2, unsigned int &bestId) const
+{
+	switch(method)
+	{
+	case RectBestShortSideFit: ScoreFreeRects<RectBestShortSideFit>(first, width, height, bestNode, bestScore1, bestScore2, bestId); break;
+	case RectBestLongSideFit: ScoreFreeRects<RectBestLongSideFit>(first, width, height, bestNode, bestScore1, bestScore2, bestId); break;
+	case RectBestAreaFit: ScoreFreeRects<RectBestAreaFit>(first, width, height, bestNode, bestScore1, bestScore2, bestId); break;
+	case RectBottomLeftRule: ScoreFreeRects<RectBottomLeftRule>(first, width, height, bestNode, bestScore1, bestScore2, bestId); break;
+	case RectContactPointRule: debug_assert(false); break;
+	}
+}
+
+namespace {
+
+/// The scores of placing a width x height rectangle (as placed) into freeRect, like the
+/// FindPositionForNewNode functions compute them.
+template<MaxRectsBinPack::FreeRectChoiceHeuristic method>
+inline void PlacementScore(const Rect &freeRect, int width, int height, int &score1, int &score2)
+{
+	int leftoverHoriz = freeRect.width - width;
+	int leftoverVert = freeRect.height - height;
+	switch(method)
+	{
+	default:
+	case MaxRectsBinPack::RectBestShortSideFit: score1 = min(leftoverHoriz, leftoverVert); score2 = max(leftoverHoriz, leftoverVert); break;
+	case MaxRectsBinPack::RectBestLongSideFit: score1 = max(leftoverHoriz, leftoverVert); score2 = min(leftoverHoriz, leftoverVert); break;
+	case MaxRectsBinPack::RectBestAreaFit: score1 = freeRect.width * freeRect.height - width * height; score2 = min(leftoverHoriz, leftoverVert); break;
+	case MaxRectsBinPack::RectBottomLeftRule: score1 = freeRect.y + height; score2 = freeRect.x; break;
+	}
+}
+
+}
+
+template<MaxRectsBinPack::FreeRectChoiceHeuristic method>
+void MaxRectsBinPack::ScoreFreeRects(size_t first, int width, int height,
+	Rect &bestNode, int &bestScore1, int &bestScore2, unsigned int &bestId) const
+{
+	// Kept in locals, which stay in registers, and written back at the end.
+	Rect node = bestNode;
+	int best1 = bestScore1;
+	int best2 = bestScore2;
+	unsigned int id = bestId;
+
+	// Upright first, then flipped, as the FindPositionForNewNode functions try them.
+	const Rect *freeRects = freeRectangles.data();
+	const size_t count = freeRectangles.size();
+	for(size_t i = first; i < count; ++i)
+	{
+		int score1;
+		int score2;
+		if (freeRects[i].width >= width && freeRects[i].height >= height)
+		{
+			PlacementScore<method>(freeRects[i], width, height, score1, score2);
+			if (score1 < best1 || (score1 == best1 && score2 < best2))
+			{
+				node.x = freeRects[i].x;
+				node.y = freeRects[i].y;
+				node.width = width;
+				node.height = height;
+				best1 = score1;
+				best2 = score2;
+				id = freeRectangleIds[i];
+			}
+		}
+
+		if (binAllowFlip && freeRects[i].width >= height && freeRects[i].height >= width)
+		{
+			PlacementScore<method>(freeRects[i], height, width, score1, score2);
+			if (score1 < best1 || (score1 == best1 && score2 < best2))
+			{
+				node.x = freeRects[i].x;
+				node.y = freeRects[i].y;
+				node.width = height;
+				node.height = width;
+				best1 = score1;
+				best2 = score2;
+				id = freeRectangleIds[i];
+			}
+		}
+	}
+
+	bestNode = node;
+	bestScore1 = best1;
+	bestScore2 = best2;
+	bestId = id;
 }
 
 Rect MaxRectsBinPack::ScoreRect(int width, int height, FreeRectChoiceHeuristic method, int &score1, int &score2) const
@@ -163,6 +454,55 @@ Rect MaxRectsBinPack::ScoreRect(int width, int height, FreeRectChoiceHeuristic m
 	return newNode;
 }
 
+void MaxRectsBinPack::AddFreeRect(const Rect &freeRect)
+{
+	freeRectangles.push_back(freeRect);
+	freeRectangleIds.push_back(nextFreeRectangleId++);
+	freeRectangleById.push_back(freeRect);
+	gridVisited.push_back(0);
+}
+
+void MaxRectsBinPack::RemoveFreeRect(size_t i)
+{
+	freeRectangles.erase(freeRectangles.begin() + i);
+	freeRectangleIds.erase(freeRectangleIds.begin() + i);
+}
+
+void MaxRectsBinPack::GridCellRange(const Rect &r, int &x0, int &y0, int &x1, int &y1) const
+{
+	// A rectangle of no width or height still counts as touching the cell it lies in.
+	x0 = min(max(r.x / gridCellWidth, 0), gridColumns - 1);
+	y0 = min(max(r.y / gridCellHeight, 0), gridRows - 1);
+	x1 = min(max((r.x + max(r.width, 1) - 1) / gridCellWidth, x0), gridColumns - 1);
+	y1 = min(max((r.y + max(r.height, 1) - 1) / gridCellHeight, y0), gridRows - 1);
+}
+
+void MaxRectsBinPack::GridInsert(unsigned int id)
+{
+	int x0, y0, x1, y1;
+	GridCellRange(freeRectangleById[id], x0, y0, x1, y1);
+	for(int y = y0; y <= y1; ++y)
+		for(int x = x0; x <= x1; ++x)
+			gridCells[(size_t)y * gridColumns + x].push_back(id);
+}
+
+void MaxRectsBinPack::GridRemove(unsigned int id)
+{
+	int x0, y0, x1, y1;
+	GridCellRange(freeRectangleById[id], x0, y0, x1, y1);
+	for(int y = y0; y <= y1; ++y)
+		for(int x = x0; x <= x1; ++x)
+		{
+			std::vector<unsigned int> &cell = gridCells[(size_t)y * gridColumns + x];
+			std::vector<unsigned int>::iterator it = find(cell.begin(), cell.end(), id);
+			if (it != cell.end())
+			{
+				*it = cell.back();
+				cell.pop_back();
+			}
+		}
+}
+
 /// Computes the ratio of used surface area.
 float MaxRectsBinPack::Occupancy() const
 {
@@ -416,7 +756,7 @@ Rect MaxRectsBinPack::FindPositionForNewNodeContactPoint(int width, int height,
 				bestContactScore = score;
 			}
 		}
-		if (freeRectangles[i].width >= height && freeRectangles[i].height >= width)
+		if (binAllowFlip && freeRectangles[i].width >= height && freeRectangles[i].height >= width)
 		{
 			int score = ContactPointScoreNode(freeRectangles[i].x, freeRectangles[i].y, height, width);
 			if (score > bestContactScore)
@@ -446,7 +786,7 @@ bool MaxRectsBinPack::SplitFreeNode(Rect freeNode, const Rect &usedNode)
 		{
 			Rect newNode = freeNode;
 			newNode.height = usedNode.y - newNode.y;
-			freeRectangles.push_back(newNode);
+			AddFreeRect(newNode);
 		}
 
 		// New node at the bottom side of the used node.
@@ -455,7 +795,7 @@ bool MaxRectsBinPack::SplitFreeNode(Rect freeNode, const Rect &usedNode)
 			Rect newNode = freeNode;
 			newNode.y = usedNode.y + usedNode.height;
 			newNode.height = freeNode.y + freeNode.height - (usedNode.y + usedNode.height);
-			freeRectangles.push_back(newNode);
+			AddFreeRect(newNode);
 		}
 	}
 
@@ -466,7 +806,7 @@ bool MaxRectsBinPack::SplitFreeNode(Rect freeNode, const Rect &usedNode)
 		{
 			Rect newNode = freeNode;
 			newNode.width = usedNode.x - newNode.x;
-			freeRectangles.push_back(newNode);
+			AddFreeRect(newNode);
 		}
 
 		// New node at the right side of the used node.
@@ -475,47 +815,58 @@ bool MaxRectsBinPack::SplitFreeNode(Rect freeNode, const Rect &usedNode)
 			Rect newNode = freeNode;
 			newNode.x = usedNode.x + usedNode.width;
 			newNode.width = freeNode.x + freeNode.width - (usedNode.x + usedNode.width);
-			freeRectangles.push_back(newNode);
+			AddFreeRect(newNode);
 		}
 	}
 
 	return true;
 }
 
-void MaxRectsBinPack::PruneFreeList()
+void MaxRectsBinPack::PruneFreeList(size_t firstNew)
 {
-	/* 
-	///  Would be nice to do something like this, to avoid a Theta(n^2) loop through each pair.
-	///  But unfortunately it doesn't quite cut it, since we also want to detect containment. 
-	///  Perhaps there's another way to do this faster than Theta(n^2).
-
-	if (freeRectangles.size() > 0)
-		clb::sort::QuickSort(&freeRectangles[0], freeRectangles.size(), NodeSortCmp);
-
-	for(size_t i = 0; i < freeRectangles.size()-1; ++i)
-		if (freeRectangles[i].x == freeRectangles[i+1].x &&
-		    freeRectangles[i].y == freeRectangles[i+1].y &&
-		    freeRectangles[i].width == freeRectangles[i+1].width &&
-		    freeRectangles[i].height == freeRectangles[i+1].height)
-		{
-			freeRectangles.erase(freeRectangles.begin() + i);
-			--i;
-		}
-	*/
+	// The free rectangles before firstNew were pruned already, so none of them contains another.
+	// Each new one is a piece of one of them that got split, so none of the old ones can be
+	// contained in a new one either. What is left to find is new ones contained in old ones,
+	// and new ones contained in each other. An old one containing a new one also covers its
+	// corner, so only the grid cell of that corner is looked in (the new ones are not in the
+	// grid yet). This removes the same rectangles as going through every pair would.
+	size_t kept = firstNew;
+	for(size_t i = firstNew; i < freeRectangles.size(); ++i)
+	{
+		const Rect &r = freeRectangles[i];
+		Rect corner = r;
+		corner.width = 1;
+		corner.height = 1;
+		int x0, y0, x1, y1;
+		GridCellRange(corner, x0, y0, x1, y1);
+
+		bool contained = false;
+		const std::vector<unsigned int> &cell = gridCells[(size_t)y0 * gridColumns + x0];
+		for(size_t k = 0; k < cell.size() && !contained; ++k)
+			contained = IsContainedIn(r, freeRectangleById[cell[k]]);
+		if (contained)
+			continue;
+
+		freeRectangles[kept] = freeRectangles[i];
+		freeRectangleIds[kept] = freeRectangleIds[i];
+		++kept;
+	}
+	freeRectangles.resize(kept);
+	freeRectangleIds.resize(kept);
 
-	/// Go through each pair and remove any rectangle that is redundant.
-	for(size_t i = 0; i < freeRectangles.size(); ++i)
+	/// Go through each pair of new ones and remove any rectangle that is redundant.
+	for(size_t i = firstNew; i < freeRectangles.size(); ++i)
 		for(size_t j = i+1; j < freeRectangles.size(); ++j)
 		{
 			if (IsContainedIn(freeRectangles[i], freeRectangles[j]))
 			{
-				freeRectangles.erase(freeRectangles.begin()+i);
+				RemoveFreeRect(i);
 				--i;
 				break;
 			}
 			if (IsContainedIn(freeRectangles[j], freeRectangles[i]))
 			{
-				freeRectangles.erase(freeRectangles.begin()+j);
+				RemoveFreeRect(j);
 				--j;
 			}
 		}
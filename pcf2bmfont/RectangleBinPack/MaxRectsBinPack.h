@@ -48,9 +48,26 @@ public:
 	/// Inserts a single rectangle into the bin, possibly rotated.
 	Rect Insert(int width, int height, FreeRectChoiceHeuristic method);
 
+	/// Marks the given rectangle of the bin as used, as if a rectangle had been placed there.
+	/// Used to rebuild a bin from where its rectangles went.
+	void Occupy(const Rect &rect);
+
+	/// (Re)initializes the packer to a bin of width x height units in the state given by
+	/// GetUsedRectangles() and GetFreeRectangles() of an earlier bin of that size.
+	void Restore(int width, int height, bool allowFlip, const std::vector<Rect> &used, const std::vector<Rect> &free);
+
 	/// Computes the ratio of used surface area to the total bin area.
 	float Occupancy() const;
 
+	/// @return The rectangles placed so far.
+	const std::vector<Rect> &GetUsedRectangles() const { return usedRectangles; }
+
+	/// @return The maximal free rectangles of the bin. They may overlap each other.
+	const std::vector<Rect> &GetFreeRectangles() const { return freeRectangles; }
+
+	/// @return The largest number of free rectangles the bin had after any placement since it was (re)initialized.
+	size_t PeakFreeCount() const { return peakFreeCount; }
+
 private:
 	int binWidth;
 	int binHeight;
@@ -59,6 +76,27 @@ private:
 
 	std::vector<Rect> usedRectangles;
 	std::vector<Rect> freeRectangles;
+	size_t peakFreeCount;
+
+	/// Ids of freeRectangles, in the same order. Every new free rectangle gets the next id and
+	/// goes to the back, and removals keep the order, so the ids are always ascending.
+	std::vector<unsigned int> freeRectangleIds;
+	unsigned int nextFreeRectangleId;
+
+	/// Every free rectangle ever made, by id.
+	std::vector<Rect> freeRectangleById;
+
+	/// A uniform grid over the bin, each cell listing the ids of the free rectangles overlapping it,
+	/// so the free rectangles near a placement are found without going through all of them.
+	std::vector<std::vector<unsigned int> > gridCells;
+	int gridCellWidth;
+	int gridCellHeight;
+	int gridColumns;
+	int gridRows;
+
+	/// Per id, the last grid query that came across it, so queries see each free rectangle once.
+	std::vector<unsigned int> gridVisited;
+	unsigned int gridQuery;
 
 	/// Computes the placement score for placing the given rectangle with the given method.
 	/// @param score1 [out] The primary placement score will be outputted here.
@@ -66,9 +104,34 @@ private:
 	/// @return This struct identifies where the rectangle would be placed if it were placed.
 	Rect ScoreRect(int width, int height, FreeRectChoiceHeuristic method, int &score1, int &score2) const;
 
+	/// Scores placing the given rectangle into freeRectangles[first] and on, like ScoreRect does for
+	/// all of them, for any method but -CP. Updates bestNode, the scores and bestId (the id of the
+	/// free rectangle bestNode lies in) where a placement is strictly better than them.
+	void ScoreFreeRects(size_t first, int width, int height, FreeRectChoiceHeuristic method,
+		Rect &bestNode, int &bestScore1, int &bestScore2, unsigned int &bestId) const;
+
+	template<FreeRectChoiceHeuristic method>
+	void ScoreFreeRects(size_t first, int width, int height,
+		Rect &bestNode, int &bestScore1, int &bestScore2, unsigned int &bestId) const;
+
 	/// Places the given rectangle into the bin.
 	void PlaceRect(const Rect &node);
 
+	/// Appends a free rectangle under a new id. It is not in the grid yet, see GridInsert.
+	void AddFreeRect(const Rect &freeRect);
+
+	/// Removes the i-th free rectangle, keeping the order of the others. The grid is left as it is.
+	void RemoveFreeRect(size_t i);
+
+	/// The range [x0, x1] x [y0, y1] of grid cells the given rectangle overlaps.
+	void GridCellRange(const Rect &r, int &x0, int &y0, int &x1, int &y1) const;
+
+	/// Adds the free rectangle of the given id to the grid cells it overlaps.
+	void GridInsert(unsigned int id);
+
+	/// Removes the free rectangle of the given id from the grid cells it overlaps.
+	void GridRemove(unsigned int id);
+
 	/// Computes the placement score for the -CP variant.
 	int ContactPointScoreNode(int x, int y, int width, int height) const;
 
@@ -81,8 +144,9 @@ private:
 	/// @return True if the free node was split.
 	bool SplitFreeNode(Rect freeNode, const Rect &usedNode);
 
-	/// Goes through the free rectangle list and removes any redundant entries.
-	void PruneFreeList();
+	/// Removes the redundant ones of the free rectangles from freeRectangles[firstNew] on, which a
+	/// placement has just added. The ones before it, and the grid, are checked against.
+	void PruneFreeList(size_t firstNew);
 };
 
 }
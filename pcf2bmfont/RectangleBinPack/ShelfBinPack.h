@@ -47,6 +47,9 @@ public:
 	/// Computes the ratio of used surface area to the total bin area.
 	float Occupancy() const;
 
+	/// @return The number of shelves opened so far.
+	size_t ShelfCount() const { return shelves.size(); }
+
 private:
 	int binWidth;
 	int binHeight;
@@ -24,19 +24,24 @@ using namespace std;
 
 SkylineBinPack::SkylineBinPack()
 :binWidth(0),
-binHeight(0)
+binHeight(0),
+binAllowFlip(true),
+usedSurfaceArea(0),
+peakFreeCount(0),
+useWasteMap(false)
 {
 }
 
-SkylineBinPack::SkylineBinPack(int width, int height, bool useWasteMap)
+SkylineBinPack::SkylineBinPack(int width, int height, bool useWasteMap, bool allowFlip)
 {
-	Init(width, height, useWasteMap);
+	Init(width, height, useWasteMap, allowFlip);
 }
 
-void SkylineBinPack::Init(int width, int height, bool useWasteMap_)
+void SkylineBinPack::Init(int width, int height, bool useWasteMap_, bool allowFlip)
 {
 	binWidth = width;
 	binHeight = height;
+	binAllowFlip = allowFlip;
 
 	useWasteMap = useWasteMap_;
 
@@ -52,11 +57,17 @@ void SkylineBinPack::Init(int width, int height, bool useWasteMap_)
 	node.width = binWidth;
 	skyLine.push_back(node);
 
+	// The bin starts out empty, with the skyline at 0 everywhere.
+	levelMax.assign(4 * _max(binWidth, 1), 0);
+	levelSum.assign(levelMax.size(), 0);
+	levelSet.assign(levelMax.size(), -1);
+
 	if (useWasteMap)
 	{
-		wasteMap.Init(width, height);
+		wasteMap.Init(width, height, allowFlip);
 		wasteMap.GetFreeRectangles().clear();
 	}
+	peakFreeCount = SkylineLevels() + WasteMapFreeCount();
 }
 
 void SkylineBinPack::Insert(std::vector<RectSize> &rects, std::vector<Rect> &dst, LevelChoiceHeuristic method)
@@ -131,6 +142,7 @@ Rect SkylineBinPack::Insert(int width, int height, LevelChoiceHeuristic method)
 		newNode.width = node.width;
 		newNode.height = node.height;
 		usedSurfaceArea += width * height;
+		peakFreeCount = _max(peakFreeCount, SkylineLevels() + WasteMapFreeCount());
 #ifdef _DEBUG
 		assert(disjointRects.Disjoint(newNode));
 		disjointRects.Add(newNode);
@@ -154,8 +166,14 @@ bool SkylineBinPack::RectangleFits(int skylineNodeIndex, int width, int height,
 	int widthLeft = width;
 	int i = skylineNodeIndex;
 	y = skyLine[skylineNodeIndex].y;
-	while(widthLeft > 0)
+	for(int walked = 0; widthLeft > 0; ++walked)
 	{
+		// Past a few nodes, the level tree finds the highest of the rest faster.
+		if (walked == maxWalkedNodes)
+		{
+			y = _max(y, MaxLevel(skyLine[i].x, widthLeft));
+			break;
+		}
 		y = _max(y, skyLine[i].y);
 		if (y + height > binHeight)
 			return false;
@@ -163,7 +181,7 @@ bool SkylineBinPack::RectangleFits(int skylineNodeIndex, int width, int height,
 		++i;
 		assert(i < (int)skyLine.size() || widthLeft <= 0);
 	}
-	return true;
+	return y + height <= binHeight;
 }
 
 int SkylineBinPack::ComputeWastedArea(int skylineNodeIndex, int width, int height, int y) const
@@ -171,12 +189,18 @@ int SkylineBinPack::ComputeWastedArea(int skylineNodeIndex, int width, int heigh
 	int wastedArea = 0;
 	const int rectLeft = skyLine[skylineNodeIndex].x;
 	const int rectRight = rectLeft + width;
-	for(; skylineNodeIndex < (int)skyLine.size() && skyLine[skylineNodeIndex].x < rectRight; ++skylineNodeIndex)
+	for(int walked = 0; skylineNodeIndex < (int)skyLine.size() && skyLine[skylineNodeIndex].x < rectRight; ++skylineNodeIndex, ++walked)
 	{
 		if (skyLine[skylineNodeIndex].x >= rectRight || skyLine[skylineNodeIndex].x + skyLine[skylineNodeIndex].width <= rectLeft)
 			break;
 
 		int leftSide = skyLine[skylineNodeIndex].x;
+		// Past a few nodes, take the area between y and the rest of the skyline from the level tree.
+		if (walked == maxWalkedNodes)
+		{
+			wastedArea += (int)((long long)(rectRight - leftSide) * y - LevelArea(leftSide, rectRight - leftSide));
+			break;
+		}
 		int rightSide = _min(rectRight, leftSide + skyLine[skylineNodeIndex].width);
 		assert(y >= skyLine[skylineNodeIndex].y);
 		wastedArea += (rightSide - leftSide) * (y - skyLine[skylineNodeIndex].y);
@@ -229,6 +253,7 @@ void SkylineBinPack::AddSkylineLevel(int skylineNodeIndex, const Rect &rect)
 	newNode.y = rect.y + rect.height;
 	newNode.width = rect.width;
 	skyLine.insert(skyLine.begin() + skylineNodeIndex, newNode);
+	SetLevel(newNode.x, newNode.width, newNode.y);
 
 	assert(newNode.x + newNode.width <= binWidth);
 	assert(newNode.y <= binHeight);
@@ -255,18 +280,95 @@ void SkylineBinPack::AddSkylineLevel(int skylineNodeIndex, const Rect &rect)
 		else
 			break;
 	}
-	MergeSkylines();
+	MergeSkylines(skylineNodeIndex);
+	peakFreeCount = _max(peakFreeCount, SkylineLevels() + WasteMapFreeCount());
 }
 
-void SkylineBinPack::MergeSkylines()
+void SkylineBinPack::MergeSkylines(int skylineNodeIndex)
 {
-	for(size_t i = 0; i < skyLine.size()-1; ++i)
-		if (skyLine[i].y == skyLine[i+1].y)
-		{
-			skyLine[i].width += skyLine[i+1].width;
-			skyLine.erase(skyLine.begin() + (i+1));
-			--i;
-		}
+	int i = skylineNodeIndex;
+	if (i+1 < (int)skyLine.size() && skyLine[i].y == skyLine[i+1].y)
+	{
+		skyLine[i].width += skyLine[i+1].width;
+		skyLine.erase(skyLine.begin() + (i+1));
+	}
+	if (i > 0 && skyLine[i-1].y == skyLine[i].y)
+	{
+		skyLine[i-1].width += skyLine[i].width;
+		skyLine.erase(skyLine.begin() + i);
+	}
+}
+
+void SkylineBinPack::SetLevel(int x, int width, int y)
+{
+	SetLevel(1, 0, binWidth, x, x + width, y);
+}
+
+int SkylineBinPack::MaxLevel(int x, int width) const
+{
+	return MaxLevel(1, 0, binWidth, x, x + width);
+}
+
+long long SkylineBinPack::LevelArea(int x, int width) const
+{
+	return LevelArea(1, 0, binWidth, x, x + width);
+}
+
+void SkylineBinPack::SetNodeLevel(int node, int lo, int hi, int y)
+{
+	levelMax[node] = y;
+	levelSum[node] = (long long)y * (hi - lo);
+	levelSet[node] = y;
+}
+
+void SkylineBinPack::SetLevel(int node, int lo, int hi, int x0, int x1, int y)
+{
+	if (x1 <= lo || hi <= x0)
+		return;
+	if (x0 <= lo && hi <= x1)
+	{
+		SetNodeLevel(node, lo, hi, y);
+		return;
+	}
+
+	int mid = (lo + hi) / 2;
+	if (levelSet[node] >= 0)
+	{
+		SetNodeLevel(2*node, lo, mid, levelSet[node]);
+		SetNodeLevel(2*node+1, mid, hi, levelSet[node]);
+		levelSet[node] = -1;
+	}
+	SetLevel(2*node, lo, mid, x0, x1, y);
+	SetLevel(2*node+1, mid, hi, x0, x1, y);
+	levelMax[node] = _max(levelMax[2*node], levelMax[2*node+1]);
+	levelSum[node] = levelSum[2*node] + levelSum[2*node+1];
+}
+
+int SkylineBinPack::MaxLevel(int node, int lo, int hi, int x0, int x1) const
+{
+	if (x1 <= lo || hi <= x0)
+		return 0;
+	// A node set as a whole is at the same level everywhere.
+	if ((x0 <= lo && hi <= x1) || levelSet[node] >= 0)
+		return levelMax[node];
+
+	int mid = (lo + hi) / 2;
+	int left = MaxLevel(2*node, lo, mid, x0, x1);
+	int right = MaxLevel(2*node+1, mid, hi, x0, x1);
+	return _max(left, right);
+}
+
+long long SkylineBinPack::LevelArea(int node, int lo, int hi, int x0, int x1) const
+{
+	if (x1 <= lo || hi <= x0)
+		return 0;
+	if (x0 <= lo && hi <= x1)
+		return levelSum[node];
+	if (levelSet[node] >= 0)
+		return (long long)levelSet[node] * (_min(hi, x1) - _max(lo, x0));
+
+	int mid = (lo + hi) / 2;
+	return LevelArea(2*node, lo, mid, x0, x1) + LevelArea(2*node+1, mid, hi, x0, x1);
 }
 
 Rect SkylineBinPack::InsertBottomLeft(int width, int height)
@@ -305,7 +407,8 @@ Rect SkylineBinPack::FindPositionForNewNodeBottomLeft(int width, int height, int
 	for(size_t i = 0; i < skyLine.size(); ++i)
 	{
 		int y;
-		if (RectangleFits(i, width, height, y))
+		// The rectangle cannot sit lower than the node, so skip the fit test if that is no better already.
+		if (skyLine[i].y + height <= bestHeight && RectangleFits(i, width, height, y))
 		{
 			if (y + height < bestHeight || (y + height == bestHeight && skyLine[i].width < bestWidth))
 			{
@@ -319,7 +422,7 @@ Rect SkylineBinPack::FindPositionForNewNodeBottomLeft(int width, int height, int
 				debug_assert(disjointRects.Disjoint(newNode));
 			}
 		}
-		if (RectangleFits(i, height, width, y))
+		if (binAllowFlip && skyLine[i].y + width <= bestHeight && RectangleFits(i, height, width, y))
 		{
 			if (y + width < bestHeight || (y + width == bestHeight && skyLine[i].width < bestWidth))
 			{
@@ -389,7 +492,7 @@ Rect SkylineBinPack::FindPositionForNewNodeMinWaste(int width, int height, int &
 				debug_assert(disjointRects.Disjoint(newNode));
 			}
 		}
-		if (RectangleFits(i, height, width, y, wastedArea))
+		if (binAllowFlip && RectangleFits(i, height, width, y, wastedArea))
 		{
 			if (wastedArea < bestWastedArea || (wastedArea == bestWastedArea && y + width < bestHeight))
 			{
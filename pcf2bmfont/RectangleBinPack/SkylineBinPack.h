@@ -23,11 +23,12 @@ public:
 	SkylineBinPack();
 
 	/// Instantiates a bin of the given size.
-	SkylineBinPack(int binWidth, int binHeight, bool useWasteMap);
+	/// @param allowFlip Specifies whether the packing algorithm is allowed to rotate the input rectangles by 90 degrees to consider a better placement.
+	SkylineBinPack(int binWidth, int binHeight, bool useWasteMap, bool allowFlip = true);
 
 	/// (Re)initializes the packer to an empty bin of width x height units. Call whenever
 	/// you need to restart with a new bin.
-	void Init(int binWidth, int binHeight, bool useWasteMap);
+	void Init(int binWidth, int binHeight, bool useWasteMap, bool allowFlip = true);
 
 	/// Defines the different heuristic rules that can be used to decide how to make the rectangle placements.
 	enum LevelChoiceHeuristic
@@ -48,10 +49,21 @@ public:
 	/// Computes the ratio of used surface area to the total bin area.
 	float Occupancy() const;
 
+	/// @return The number of levels the skyline is made of.
+	size_t SkylineLevels() const { return skyLine.size(); }
+
+	/// @return The number of free rectangles in the waste map, 0 if the bin does not use one.
+	size_t WasteMapFreeCount() const { return useWasteMap ? wasteMap.GetFreeRectangles().size() : 0; }
+
+	/// @return The largest SkylineLevels() + WasteMapFreeCount() after any placement since the bin was (re)initialized.
+	size_t PeakFreeCount() const { return peakFreeCount; }
+
 private:
 	int binWidth;
 	int binHeight;
 
+	bool binAllowFlip;
+
 #ifdef _DEBUG
 	DisjointRectCollection disjointRects;
 #endif
@@ -71,7 +83,31 @@ private:
 
 	std::vector<SkylineNode> skyLine;
 
+	/// The skyline level of every x-coordinate of the bin, kept in a segment tree so that the highest
+	/// level and the area under the skyline over a span of x-coordinates are found in O(log binWidth),
+	/// however many skyline nodes the span covers. Node 1 covers [0, binWidth), and the children
+	/// 2*i and 2*i+1 of node i each cover one half of its span.
+	std::vector<int> levelMax;
+	std::vector<long long> levelSum;
+	/// The level all of the span of a node is at, if it was set as a whole and not yet pushed down
+	/// to its children, or -1.
+	std::vector<int> levelSet;
+
+	/// Fit tests walk this many skyline nodes under a rectangle before asking the level tree about
+	/// the rest. Glyph sized rectangles seldom span more, and walking a few nodes is cheaper.
+	static const int maxWalkedNodes = 32;
+
+	void SetLevel(int x, int width, int y);
+	int MaxLevel(int x, int width) const;
+	long long LevelArea(int x, int width) const;
+
+	void SetLevel(int node, int lo, int hi, int x0, int x1, int y);
+	int MaxLevel(int node, int lo, int hi, int x0, int x1) const;
+	long long LevelArea(int node, int lo, int hi, int x0, int x1) const;
+	void SetNodeLevel(int node, int lo, int hi, int y);
+
 	unsigned long usedSurfaceArea;
+	size_t peakFreeCount;
 
 	/// If true, we use the GuillotineBinPack structure to recover wasted areas into a waste map.
 	bool useWasteMap;
@@ -91,8 +127,9 @@ private:
 
 	void AddSkylineLevel(int skylineNodeIndex, const Rect &rect);
 
-	/// Merges all skyline nodes that are at the same level.
-	void MergeSkylines();
+	/// Merges the skyline node at the given index with its neighbors that are at the same level.
+	/// As all other neighboring nodes are merged already, these are the only ones left to merge.
+	void MergeSkylines(int skylineNodeIndex);
 };
 
 }
\ No newline at end of file
@@ -4,10 +4,17 @@
 
 #include "atlas.h"
 #include "utils.h"
+#include "blend.h"
+#include "hash.h"
 #include <cassert>
 #include <png.h>
+#include <zlib.h>
 #include <string.h>
 #include <stdlib.h>
+#include <condition_variable>
+#include <mutex>
+#include <thread>
+#include <atomic>
 
 using namespace bmfm;
 
@@ -23,21 +30,121 @@ static void _png_warn_callback(::png_structp structp, const char* msg)
 		(const char*)png_get_error_ptr(structp), msg);
 }
 
+static void _png_set_encoding(::png_structp png_ptr, const PNGEncoding& encoding)
+{
+	if (encoding.filters >= 0)
+		::png_set_filter(png_ptr, PNG_FILTER_TYPE_BASE, encoding.filters);
+	if (encoding.level >= 0)
+		::png_set_compression_level(png_ptr, encoding.level);
+	if (encoding.strategy >= 0)
+		::png_set_compression_strategy(png_ptr, encoding.strategy);
+}
+
+static PNGEncoding _png_profile_encoding(PNGWriteProfile profile)
+{
+	// Glyph atlases are mostly empty runs and repeated rows, which
+	// deflate finds as well with or without filtering.
+	if (profile == PNGWriteProfile::Fast)
+		return { PNG_FILTER_NONE, -1, Z_QUICK };
+	return { -1, -1, -1 };
+}
+
+// The combinations PNGWriteProfile::Smallest tries, all at the best level.
+// Which one wins depends on the image: adaptive filtering for smooth
+// images, no filter or Sub with plain deflate or RLE for sharp glyphs.
+static const PNGEncoding _smallest_trials[] =
+{
+	{ PNG_ALL_FILTERS, 9, Z_FILTERED },
+	{ PNG_ALL_FILTERS, 9, Z_DEFAULT_STRATEGY },
+	{ PNG_FILTER_NONE, 9, Z_DEFAULT_STRATEGY },
+	{ PNG_FILTER_NONE, 9, Z_RLE },
+	{ PNG_FILTER_SUB, 9, Z_DEFAULT_STRATEGY },
+	{ PNG_FILTER_SUB, 9, Z_FILTERED },
+	{ PNG_FILTER_SUB, 9, Z_RLE },
+	{ PNG_FILTER_UP, 9, Z_DEFAULT_STRATEGY },
+	{ PNG_FILTER_UP, 9, Z_FILTERED },
+	{ PNG_FILTER_UP, 9, Z_RLE },
+	{ PNG_FILTER_AVG, 9, Z_FILTERED },
+	{ PNG_FILTER_PAETH, 9, Z_DEFAULT_STRATEGY },
+	{ PNG_FILTER_PAETH, 9, Z_FILTERED },
+	{ PNG_FILTER_PAETH, 9, Z_RLE },
+};
+
+static void _png_write_to_vector(::png_structp png_ptr, ::png_bytep data, size_t length)
+{
+	std::vector<unsigned char>* mem = (std::vector<unsigned char>*)::png_get_io_ptr(png_ptr);
+	mem->insert(mem->end(), data, data + length);
+}
+
+static void _png_flush_nothing(::png_structp png_ptr)
+{
+	(void)png_ptr;
+}
+
+static bool _rect_inside(unsigned int x, unsigned int y, unsigned int w, unsigned int h,
+	unsigned int boundW, unsigned int boundH)
+{
+	return x <= boundW && w <= boundW - x && y <= boundH && h <= boundH - y;
+}
+
+static std::shared_ptr<char> _alloc_pixels(size_t len)
+{
+	return std::shared_ptr<char>(new char[len], std::default_delete<char[]>());
+}
+
+static std::shared_ptr<char> _map_pixels(size_t len)
+{
+	char* p = mapscratch(len);
+	if (!p)
+		return nullptr;
+	return std::shared_ptr<char>(p, [len](char* q) { unmapscratch(q, len); });
+}
+
+// Hints the kernel that a mapped buffer is read front to back while
+// the object lives. Nothing for buffers in memory.
+class _SequentialScan
+{
+public:
+	_SequentialScan(AtlasStorage storage, const std::shared_ptr<char>& buffer, size_t len)
+		: mBuffer(storage == AtlasStorage::Mapped ? buffer.get() : nullptr)
+		, mLen(len)
+	{
+		if (mBuffer)
+			mapadvise(mBuffer, mLen, true);
+	}
+	~_SequentialScan()
+	{
+		if (mBuffer)
+			mapadvise(mBuffer, mLen, false);
+	}
+
+private:
+	char* mBuffer;
+	size_t mLen;
+};
 
 Atlas::Atlas()
 	: mWidth(0)
 	, mHeight(0)
-	, mBuffer(nullptr)
+	, mStorage(AtlasStorage::Dense)
+	, mTilesPerRow(0)
 {
 }
 
-Atlas::Atlas(unsigned int w, unsigned int h)
+Atlas::Atlas(unsigned int w, unsigned int h, AtlasStorage storage)
 	: mWidth(w)
 	, mHeight(h)
+	, mStorage(storage)
+	, mTilesPerRow(0)
 {
-	size_t len = (size_t)w*(size_t)h * 4;
-	mBuffer = new char[len];
-	::memset(mBuffer, 0, len);
+	if (mStorage == AtlasStorage::Sparse)
+	{
+		mTilesPerRow = (w + TileSize - 1) / TileSize;
+		mTiles.resize((size_t)mTilesPerRow * ((h + TileSize - 1) / TileSize));
+		return;
+	}
+
+	mBuffer = AllocBuffer();
 }
 
 Atlas::~Atlas()
@@ -46,49 +153,301 @@ Atlas::~Atlas()
 }
 
 Atlas::Atlas(const Atlas& that)
+	: mWidth(that.mWidth)
+	, mHeight(that.mHeight)
+	, mPath(that.mPath)
+	, mStorage(that.mStorage)
+	, mBuffer(that.mBuffer)
+	, mTiles(that.mTiles)
+	, mTilesPerRow(that.mTilesPerRow)
 {
-	mBuffer = nullptr;
-	*this = that;
 }
 
 Atlas::Atlas(Atlas&& that)
+	: mWidth(that.mWidth)
+	, mHeight(that.mHeight)
+	, mPath(std::move(that.mPath))
+	, mStorage(that.mStorage)
+	, mBuffer(std::move(that.mBuffer))
+	, mTiles(std::move(that.mTiles))
+	, mTilesPerRow(that.mTilesPerRow)
 {
-	mBuffer = nullptr;
-	*this = that;
+	that.Free();
 }
 
 Atlas& Atlas::operator=(const Atlas& that)
 {
-	Free();
+	if (this == &that)
+		return *this;
 
-	// clone
+	// share, the buffer gets cloned on the first write
 	mPath = that.mPath;
 	mWidth = that.mWidth;
 	mHeight = that.mHeight;
-	if (that.mBuffer == nullptr)
-		mBuffer = nullptr;
-	else
-	{
-		size_t len = (size_t)mWidth*(size_t)mHeight * 4;
-		mBuffer = new char[len];
-		::memcpy(mBuffer, that.mBuffer, len);
-	}
+	mStorage = that.mStorage;
+	mBuffer = that.mBuffer;
+	mTiles = that.mTiles;
+	mTilesPerRow = that.mTilesPerRow;
 	return *this;
 }
 
 Atlas& Atlas::operator=(Atlas&& that)
 {
-	Free();
+	if (this == &that)
+		return *this;
 
 	// move
-	mPath = that.mPath; that.mPath = "";
-	mWidth = that.mWidth; that.mWidth = 0;
-	mHeight = that.mHeight; that.mHeight = 0;
-	mBuffer = that.mBuffer; that.mBuffer = nullptr;
+	mPath = std::move(that.mPath);
+	mWidth = that.mWidth;
+	mHeight = that.mHeight;
+	mStorage = that.mStorage;
+	mBuffer = std::move(that.mBuffer);
+	mTiles = std::move(that.mTiles);
+	mTilesPerRow = that.mTilesPerRow;
+	that.Free();
 	return *this;
 }
 
-Atlas Atlas::LoadFromPNG(std::string path)
+void Atlas::Detach()
+{
+	if (!mBuffer || mBuffer.use_count() == 1)
+		return;
+
+	size_t len = (size_t)mWidth*(size_t)mHeight * 4;
+	std::shared_ptr<char> clone = AllocBuffer();
+	::memcpy(clone.get(), mBuffer.get(), len);
+	mBuffer = std::move(clone);
+}
+
+std::shared_ptr<char> Atlas::AllocBuffer() const
+{
+	size_t len = (size_t)mWidth*(size_t)mHeight * 4;
+	if (mStorage == AtlasStorage::Mapped)
+	{
+		// Scratch files start out zeroed, clearing would only touch every page.
+		std::shared_ptr<char> mapped = _map_pixels(len);
+		if (mapped)
+			return mapped;
+		logerr("Error: Atlas: Unable to map a scratch file, the pixels are kept in memory.");
+	}
+
+	std::shared_ptr<char> buffer = _alloc_pixels(len);
+	::memset(buffer.get(), 0, len);
+	return buffer;
+}
+
+size_t Atlas::GetAllocatedTileCount() const
+{
+	size_t cnt = 0;
+	for (const auto& tile : mTiles)
+		if (tile)
+			++cnt;
+	return cnt;
+}
+
+unsigned long long Atlas::GetContentHash() const
+{
+	Hash64 hash;
+	unsigned int dims[2] = { mWidth, mHeight };
+	hash.Update(dims, sizeof(dims));
+	if (mWidth == 0 || mHeight == 0 || (mBuffer == nullptr && mTiles.empty()))
+		return hash.Digest();
+
+	std::vector<char> scratch((size_t)mWidth * 4);
+	std::vector<char> zerorow((size_t)mWidth * 4, 0);
+	_SequentialScan scan(mStorage, mBuffer, (size_t)mWidth * mHeight * 4);
+	for (unsigned int y = 0; y < mHeight; ++y)
+		hash.Update(GetRow(y, &scratch[0], &zerorow[0]), (size_t)mWidth * 4);
+	return hash.Digest();
+}
+
+const char* Atlas::GetSpan(unsigned int x, unsigned int y, unsigned int& count) const
+{
+	if (count > mWidth - x)
+		count = mWidth - x;
+
+	if (mStorage != AtlasStorage::Sparse)
+		return &mBuffer.get()[((size_t)y*mWidth + x) * 4];
+
+	unsigned int tx = x % TileSize;
+	if (count > TileSize - tx)
+		count = TileSize - tx;
+
+	const std::shared_ptr<char>& tile = mTiles[(size_t)(y / TileSize)*mTilesPerRow + (x / TileSize)];
+	if (!tile)
+		return nullptr;
+	return &tile.get()[((y % TileSize)*TileSize + tx) * 4];
+}
+
+char* Atlas::GetSpanForWrite(unsigned int x, unsigned int y, unsigned int& count)
+{
+	if (count > mWidth - x)
+		count = mWidth - x;
+
+	if (mStorage != AtlasStorage::Sparse)
+	{
+		Detach();
+		return &mBuffer.get()[((size_t)y*mWidth + x) * 4];
+	}
+
+	unsigned int tx = x % TileSize;
+	if (count > TileSize - tx)
+		count = TileSize - tx;
+
+	const size_t tile_len = (size_t)TileSize * TileSize * 4;
+	std::shared_ptr<char>& tile = mTiles[(size_t)(y / TileSize)*mTilesPerRow + (x / TileSize)];
+	if (!tile)
+	{
+		tile = _alloc_pixels(tile_len);
+		::memset(tile.get(), 0, tile_len);
+	}
+	else if (tile.use_count() > 1)
+	{
+		std::shared_ptr<char> clone = _alloc_pixels(tile_len);
+		::memcpy(clone.get(), tile.get(), tile_len);
+		tile = std::move(clone);
+	}
+	return &tile.get()[((y % TileSize)*TileSize + tx) * 4];
+}
+
+const char* Atlas::GetRow(unsigned int y, char* scratch, const char* zeroRow) const
+{
+	if (mStorage != AtlasStorage::Sparse)
+		return &mBuffer.get()[(size_t)y*mWidth * 4];
+
+	bool touched = false;
+	for (unsigned int x = 0; x < mWidth; )
+	{
+		unsigned int n = mWidth - x;
+		const char* p = GetSpan(x, y, n);
+		if (p)
+		{
+			::memcpy(&scratch[x * 4], p, n * 4);
+			touched = true;
+		}
+		else
+			::memset(&scratch[x * 4], 0, n * 4);
+		x += n;
+	}
+	return touched ? scratch : zeroRow;
+}
+
+// Asks libpng to hand out 8-bit RGBA rows whatever the image format is:
+// palettes and tRNS are expanded, gray is copied to RGB, 16-bit channels
+// are scaled down and a missing alpha channel is filled as opaque.
+// Returns the number of interlace passes.
+static int _png_set_rgba8_transforms(::png_structp png_ptr, ::png_infop info_ptr)
+{
+	unsigned char color_type = ::png_get_color_type(png_ptr, info_ptr);
+	unsigned char bit_depth = ::png_get_bit_depth(png_ptr, info_ptr);
+	bool has_trns = (0 != ::png_get_valid(png_ptr, info_ptr, PNG_INFO_tRNS));
+
+	if (color_type == PNG_COLOR_TYPE_PALETTE)
+		::png_set_palette_to_rgb(png_ptr);
+	if (color_type == PNG_COLOR_TYPE_GRAY && bit_depth < 8)
+		::png_set_expand_gray_1_2_4_to_8(png_ptr);
+	if (has_trns)
+		::png_set_tRNS_to_alpha(png_ptr);
+	if (bit_depth == 16)
+		::png_set_scale_16(png_ptr);
+	if (color_type == PNG_COLOR_TYPE_GRAY || color_type == PNG_COLOR_TYPE_GRAY_ALPHA)
+		::png_set_gray_to_rgb(png_ptr);
+	if (!has_trns && (color_type & PNG_COLOR_MASK_ALPHA) == 0)
+		::png_set_filler(png_ptr, 0xFF, PNG_FILLER_AFTER);
+
+	int passes = ::png_set_interlace_handling(png_ptr);
+	::png_read_update_info(png_ptr, info_ptr);
+	return passes;
+}
+
+// State of a progressive read, shared with the libpng callbacks below.
+struct _ProgressiveRead
+{
+	unsigned int width;
+	unsigned int height;
+	std::shared_ptr<char> pixels;
+	bool done;
+};
+
+static void _png_progressive_info(::png_structp png_ptr, ::png_infop info_ptr);
+static void _png_progressive_row(::png_structp png_ptr, ::png_bytep new_row, ::png_uint_32 row_num, int pass);
+static void _png_progressive_end(::png_structp png_ptr, ::png_infop info_ptr);
+
+// Feeds one chunk of the file to libpng. Kept apart so that no C++ object
+// is skipped over when libpng longjmp()s out on an error.
+static bool _png_feed(::png_structp png_ptr, ::png_infop info_ptr, unsigned char* data, size_t len)
+{
+	if (setjmp(png_jmpbuf(png_ptr)))
+		return false;
+
+	::png_process_data(png_ptr, info_ptr, data, len);
+	return true;
+}
+
+// Reads the rest of f, sig being its first 8 bytes, as chunks are decoded.
+static bool _png_read_progressive(::png_structp png_ptr, ::png_infop info_ptr,
+	FILE* f, const unsigned char* sig, _ProgressiveRead& state)
+{
+	static const size_t ChunkSize = 256 * 1024;
+
+	::png_set_progressive_read_fn(png_ptr, &state, _png_progressive_info, _png_progressive_row, _png_progressive_end);
+
+	// One reader thread fills two buffers in turn, the next chunk while
+	// libpng decodes the current one. A length of 0 marks the end of f.
+	std::vector<unsigned char> chunks[2] = { std::vector<unsigned char>(ChunkSize), std::vector<unsigned char>(ChunkSize) };
+	size_t lens[2] = { 0, 0 };
+	bool full[2] = { false, false };
+	bool stop = false;
+	std::mutex lock;
+	std::condition_variable changed;
+
+	std::thread reader([&]() {
+		for (int i = 0; ; i ^= 1)
+		{
+			{
+				std::unique_lock<std::mutex> guard(lock);
+				changed.wait(guard, [&]() { return stop || !full[i]; });
+				if (stop)
+					return;
+			}
+
+			size_t len = ::fread(&chunks[i][0], 1, ChunkSize, f);
+			std::lock_guard<std::mutex> guard(lock);
+			lens[i] = len;
+			full[i] = true;
+			changed.notify_all();
+			if (len == 0)
+				return;
+		}
+	});
+
+	bool ok = _png_feed(png_ptr, info_ptr, const_cast<unsigned char*>(sig), 8);
+	for (int i = 0; ok && !state.done; i ^= 1)
+	{
+		{
+			std::unique_lock<std::mutex> guard(lock);
+			changed.wait(guard, [&]() { return full[i]; });
+		}
+		if (lens[i] == 0)
+			break;
+
+		ok = _png_feed(png_ptr, info_ptr, &chunks[i][0], lens[i]);
+		std::lock_guard<std::mutex> guard(lock);
+		full[i] = false;
+		changed.notify_all();
+	}
+
+	{
+		std::lock_guard<std::mutex> guard(lock);
+		stop = true;
+		changed.notify_all();
+	}
+	reader.join();
+
+	return ok && state.done;
+}
+
+Atlas Atlas::LoadFromPNG(std::string path, PNGReadMode mode)
 {
 	Atlas ret;
 	ret.mPath = path;
@@ -105,8 +464,7 @@ Atlas Atlas::LoadFromPNG(std::string path)
 	::png_infop end_ptr = nullptr;
 
 	unsigned char pngheader[8];
-	::fread(pngheader, 1, 8, f);
-	if (0 != ::png_sig_cmp(pngheader, 0, 8))
+	if (8 != ::fread(pngheader, 1, 8, f) || 0 != ::png_sig_cmp(pngheader, 0, 8))
 	{
 		logerrfmt("Atlas::LoadFromPNG(): %s is not a valid PNG file.", path.c_str());
 		::abort();
@@ -127,6 +485,23 @@ Atlas Atlas::LoadFromPNG(std::string path)
 		::abort();
 	}
 
+	if (mode == PNGReadMode::Progressive)
+	{
+		_ProgressiveRead state{ 0, 0, nullptr, false };
+		if (!_png_read_progressive(png_ptr, info_ptr, f, pngheader, state))
+		{
+			logerrfmt("Atlas::LoadFromPNG(): Failed to decode, or truncated file. %s", path.c_str());
+			::abort();
+		}
+
+		ret.mWidth = state.width;
+		ret.mHeight = state.height;
+		ret.mBuffer = state.pixels;
+		::png_destroy_read_struct(&png_ptr, &info_ptr, &end_ptr);
+		::fclose(f);
+		return ret;
+	}
+
 	if (setjmp(png_jmpbuf(png_ptr)))
 	{
 		logerrfmt("Atlas::LoadFromPNG(): png_init_io() failed. %s", path.c_str());
@@ -136,26 +511,17 @@ Atlas Atlas::LoadFromPNG(std::string path)
 	::png_init_io(png_ptr, f);
 	::png_set_sig_bytes(png_ptr, 8);
 	::png_read_info(png_ptr, info_ptr);
-		
+	_png_set_rgba8_transforms(png_ptr, info_ptr);
+
 	unsigned int width = ::png_get_image_width(png_ptr, info_ptr);
 	unsigned int height = ::png_get_image_height(png_ptr, info_ptr);
-	unsigned char color_type = ::png_get_color_type(png_ptr, info_ptr);
-	unsigned char bit_depth = ::png_get_bit_depth(png_ptr, info_ptr);
 	size_t rowbytes = ::png_get_rowbytes(png_ptr, info_ptr);
 
-	// FIXME: For now expect only RGBA, 8bits per channel images.
-	if (color_type != PNG_COLOR_TYPE_RGBA || bit_depth != 8)
-	{
-		logerrfmt("Error: Unexpected color_type:%u (should be %u) or bit_depth:%u (should be 8).\nMake sure the input PNG is in RGBA 32bits format.",
-			color_type, PNG_COLOR_TYPE_RGBA, bit_depth);
-		::abort();
-	}
-
 	assert(rowbytes == width * 4);
 
 	ret.mWidth = width;
 	ret.mHeight = height;
-	ret.mBuffer = new char[width*height*4];
+	ret.mBuffer = _alloc_pixels((size_t)width*(size_t)height*4);
 
 	if (setjmp(png_jmpbuf(png_ptr)))
 	{
@@ -165,7 +531,7 @@ Atlas Atlas::LoadFromPNG(std::string path)
 
 	png_bytep* rawbuf = new png_bytep[height];
 	for (unsigned int i=0; i<height; ++i)
-		rawbuf[i] = (unsigned char*)&ret.mBuffer[i*rowbytes];
+		rawbuf[i] = (unsigned char*)&ret.mBuffer.get()[i*rowbytes];
 	::png_read_image(png_ptr, rawbuf);
 	delete[] rawbuf;
 
@@ -174,14 +540,56 @@ Atlas Atlas::LoadFromPNG(std::string path)
 	return ret;
 }
 
-bool Atlas::SaveToPNG(std::string path)
+static void _png_progressive_info(::png_structp png_ptr, ::png_infop info_ptr)
 {
-	if (mWidth == 0 || mHeight == 0 || mBuffer == nullptr)
+	_ProgressiveRead* state = (_ProgressiveRead*)::png_get_progressive_ptr(png_ptr);
+	_png_set_rgba8_transforms(png_ptr, info_ptr);
+
+	unsigned int width = ::png_get_image_width(png_ptr, info_ptr);
+	unsigned int height = ::png_get_image_height(png_ptr, info_ptr);
+	assert(::png_get_rowbytes(png_ptr, info_ptr) == width * 4);
+
+	state->width = width;
+	state->height = height;
+	state->pixels = _alloc_pixels((size_t)width*(size_t)height*4);
+
+	// Interlaced images are combined into rows, which must start out cleared.
+	if (::png_get_interlace_type(png_ptr, info_ptr) != PNG_INTERLACE_NONE)
+		::memset(state->pixels.get(), 0, (size_t)width*(size_t)height*4);
+}
+
+static void _png_progressive_row(::png_structp png_ptr, ::png_bytep new_row, ::png_uint_32 row_num, int pass)
+{
+	(void)pass;
+	_ProgressiveRead* state = (_ProgressiveRead*)::png_get_progressive_ptr(png_ptr);
+	if (new_row == nullptr)
+		return;
+
+	if (row_num >= state->height)
+		return;
+
+	size_t stride = (size_t)state->width * 4;
+	::png_progressive_combine_row(png_ptr, (::png_bytep)&state->pixels.get()[row_num * stride], new_row);
+}
+
+static void _png_progressive_end(::png_structp png_ptr, ::png_infop info_ptr)
+{
+	(void)info_ptr;
+	_ProgressiveRead* state = (_ProgressiveRead*)::png_get_progressive_ptr(png_ptr);
+	state->done = true;
+}
+
+bool Atlas::SaveToPNG(std::string path, PNGWriteProfile profile, unsigned int threads)
+{
+	if (mWidth == 0 || mHeight == 0 || (mBuffer == nullptr && mTiles.empty()))
 	{
 		logerr("Error: Atlas::SaveToPNG(): Unable to save an empty atlas.");
 		return false;
 	}
 
+	if (profile == PNGWriteProfile::Smallest)
+		return SaveToPNGSmallest(path, threads);
+
 	FILE* f = ::fopen(path.c_str(), "wb");
 	if (!f)
 	{
@@ -189,6 +597,58 @@ bool Atlas::SaveToPNG(std::string path)
 		return false;
 	}
 
+	bool ok = WritePNG(path, f, nullptr, _png_profile_encoding(profile));
+	::fclose(f);
+	return ok;
+}
+
+bool Atlas::SaveToPNGSmallest(const std::string& path, unsigned int threads) const
+{
+	const size_t count = sizeof(_smallest_trials) / sizeof(_smallest_trials[0]);
+	std::vector<std::vector<unsigned char>> results(count);
+	std::vector<char> succeeded(count, 0);
+
+	if (threads == 0)
+		threads = std::thread::hardware_concurrency();
+	if (threads == 0)
+		threads = 1;
+	if (threads > count)
+		threads = (unsigned int)count;
+
+	std::atomic<size_t> next(0);
+	auto worker = [&]() {
+		for (size_t i = next++; i < count; i = next++)
+			succeeded[i] = WritePNG(path, nullptr, &results[i], _smallest_trials[i]) ? 1 : 0;
+	};
+
+	std::vector<std::thread> pool;
+	for (unsigned int i = 1; i < threads; ++i)
+		pool.emplace_back(worker);
+	worker();
+	for (auto& t : pool)
+		t.join();
+
+	// Ties go to the earlier trial, so the output does not depend on timing.
+	size_t best = count;
+	for (size_t i = 0; i < count; ++i)
+	{
+		if (succeeded[i] && (best == count || results[i].size() < results[best].size()))
+			best = i;
+	}
+	if (best == count)
+		return false;
+
+	if (!savefile(path.c_str(), &results[best][0], results[best].size()))
+	{
+		logerrfmt("Error: Atlas::SaveToPNG(): Unable to write file: %s", path.c_str());
+		return false;
+	}
+	return true;
+}
+
+bool Atlas::WritePNG(const std::string& path, FILE* f, std::vector<unsigned char>* mem,
+	const PNGEncoding& encoding) const
+{
 	::png_structp png_ptr = nullptr;
 	png_infop info_ptr = nullptr;
 
@@ -196,7 +656,6 @@ bool Atlas::SaveToPNG(std::string path)
 	if (!png_ptr)
 	{
 		logerr("Error: Atlas::SaveToPNG(): png_create_write_struct() failed.");
-		::fclose(f);
 		return false;
 	}
 
@@ -205,7 +664,6 @@ bool Atlas::SaveToPNG(std::string path)
 	{
 		logerr("Error: Atlas::SaveToPNG(): png_create_info_struct() failed.");
 		::png_destroy_write_struct(&png_ptr, &info_ptr);
-		::fclose(f);
 		return false;
 	}
 
@@ -213,101 +671,249 @@ bool Atlas::SaveToPNG(std::string path)
 	{
 		logerr("Error: Atlas::SaveToPNG(): png_init_io() failed.");
 		::png_destroy_write_struct(&png_ptr, &info_ptr);
-		::fclose(f);
 		return false;
 	}
 
-	::png_init_io(png_ptr, f);
+	if (f)
+		::png_init_io(png_ptr, f);
+	else
+		::png_set_write_fn(png_ptr, mem, _png_write_to_vector, _png_flush_nothing);
 
 	if (setjmp(png_jmpbuf(png_ptr)))
 	{
 		logerr("Error: Atlas::SaveToPNG(): Failed on writing PNG header.");
 		::png_destroy_write_struct(&png_ptr, &info_ptr);
-		::fclose(f);
 		return false;
 	}
 
 	::png_set_IHDR(png_ptr, info_ptr, mWidth, mHeight,
 		8, PNG_COLOR_TYPE_RGBA, PNG_INTERLACE_NONE,
 		PNG_COMPRESSION_TYPE_BASE, PNG_FILTER_TYPE_BASE);
+	_png_set_encoding(png_ptr, encoding);
 	::png_write_info(png_ptr, info_ptr);
 
 	if (setjmp(png_jmpbuf(png_ptr)))
 	{
 		logerr("Error: Atlas::SaveToPNG(): png_write_image() failed.");
 		::png_destroy_write_struct(&png_ptr, &info_ptr);
-		::fclose(f);
 		return false;
 	}
 
-	png_bytep* rawbuf = new png_bytep[mHeight];
+	std::vector<char> scratch((size_t)mWidth * 4);
+	std::vector<char> zerorow((size_t)mWidth * 4, 0);
+	_SequentialScan scan(mStorage, mBuffer, (size_t)mWidth * mHeight * 4);
 	for (unsigned int i = 0; i < mHeight; ++i)
-		rawbuf[i] = (unsigned char*)&mBuffer[i*mWidth*4];
-	::png_write_image(png_ptr, rawbuf);
-	delete[] rawbuf;
+		::png_write_row(png_ptr, (png_const_bytep)GetRow(i, &scratch[0], &zerorow[0]));
 
 	if (setjmp(png_jmpbuf(png_ptr)))
 	{
 		logerr("Error: Atlas::SaveToPNG(): png_write_end() failed.");
 		::png_destroy_write_struct(&png_ptr, &info_ptr);
-		::fclose(f);
 		return false;
 	}
 
 	::png_write_end(png_ptr, nullptr);
 	::png_destroy_write_struct(&png_ptr, &info_ptr);
-	::fclose(f);
+	return true;
+}
+
+bool Atlas::SaveToKTX2(std::string path, TextureFormat format, unsigned int channel,
+	const MipSettings* mips, unsigned int threads) const
+{
+	std::vector<TextureLevel> levels;
+	if (!GetLevels("Atlas::SaveToKTX2()", channel, mips, levels))
+		return false;
+	return WriteKTX2(path, levels, format, threads);
+}
+
+bool Atlas::SaveToDDS(std::string path, TextureFormat format, unsigned int channel,
+	const MipSettings* mips, unsigned int threads) const
+{
+	std::vector<TextureLevel> levels;
+	if (!GetLevels("Atlas::SaveToDDS()", channel, mips, levels))
+		return false;
+	return WriteDDS(path, levels, format, threads);
+}
+
+bool Atlas::GetLevels(const char* caller, unsigned int channel, const MipSettings* mips,
+	std::vector<TextureLevel>& levels) const
+{
+	levels.assign(1, TextureLevel{ mWidth, mHeight, std::vector<unsigned char>() });
+	if (!GetPlane(caller, channel, levels[0].plane))
+		return false;
+	if (mips)
+		BuildMipChain(levels, *mips);
+	return true;
+}
+
+bool Atlas::GetPlane(const char* caller, unsigned int channel, std::vector<unsigned char>& plane) const
+{
+	if (mWidth == 0 || mHeight == 0 || (mBuffer == nullptr && mTiles.empty()))
+	{
+		logerrfmt("Error: %s: Unable to save an empty atlas.", caller);
+		return false;
+	}
+
+	if (channel > 3)
+	{
+		logerrfmt("Error: %s: Invalid channel: %u", caller, channel);
+		return false;
+	}
+
+	plane.resize((size_t)mWidth * mHeight);
+	std::vector<char> scratch((size_t)mWidth * 4);
+	std::vector<char> zerorow((size_t)mWidth * 4, 0);
+	_SequentialScan scan(mStorage, mBuffer, (size_t)mWidth * mHeight * 4);
+	for (unsigned int y = 0; y < mHeight; ++y)
+	{
+		const char* row = GetRow(y, &scratch[0], &zerorow[0]);
+		unsigned char* dst = &plane[(size_t)y * mWidth];
+		for (unsigned int x = 0; x < mWidth; ++x)
+			dst[x] = (unsigned char)row[x * 4 + channel];
+	}
 	return true;
 }
 
 void Atlas::Free()
 {
-	delete[] mBuffer;
-	mBuffer = nullptr;
+	mBuffer.reset();
+	mTiles.clear();
+	mTilesPerRow = 0;
 	mHeight = mWidth = 0;
 	mPath = "";
 }
 
+template<typename Kernel>
+void Atlas::ComposeSpans(const Atlas& srcAtlas,
+	unsigned int dstX, unsigned int dstY,
+	unsigned int srcX, unsigned int srcY,
+	unsigned int width, unsigned int height,
+	bool zeroSrcIsNoop, Kernel kernel)
+{
+	// Untouched sparse tiles read as zero. Their spans never exceed a tile row.
+	static const char zeros[TileSize * 4] = {0};
+
+	// Compositing within the same atlas between overlapping rects works on a
+	// snapshot of src, which is cheap thanks to copy-on-write and keeps the
+	// source pixels intact. Otherwise src is read as is: writes only ever
+	// detach pixels shared with another atlas, which keeps the old ones alive.
+	Atlas snapshot;
+	const bool overlap = &srcAtlas == this &&
+		srcX < dstX + width && dstX < srcX + width && srcY < dstY + height && dstY < srcY + height;
+	if (overlap)
+		snapshot = srcAtlas;
+	const Atlas& src = overlap ? snapshot : srcAtlas;
+
+	for (unsigned int y = 0; y < height; ++y)
+	{
+		unsigned int sy = srcY + y;
+		unsigned int dy = dstY + y;
+
+		for (unsigned int x = 0; x < width; )
+		{
+			unsigned int n = width - x;
+			const char* s = src.GetSpan(srcX + x, sy, n);
+			if (s == nullptr && (zeroSrcIsNoop || GetSpan(dstX + x, dy, n) == nullptr))
+			{
+				// Nothing would change.
+				x += n;
+				continue;
+			}
+
+			char* d = GetSpanForWrite(dstX + x, dy, n);
+			kernel(d, s ? s : zeros, n);
+			x += n;
+		}
+	}
+}
+
 bool Atlas::BitBlt(const Atlas& srcAtlas,
 	unsigned int dstX, unsigned int dstY,
 	unsigned int srcX, unsigned int srcY,
 	unsigned int width, unsigned int height)
 {
-	if (dstX >= mWidth || (dstX + width) >= mWidth ||
-		dstY >= mHeight || (dstY + height) >= mHeight ||
-		srcX >= srcAtlas.GetWidth() || (srcX + width) >= srcAtlas.GetWidth() ||
-		srcY >= srcAtlas.GetHeight() || (srcY + height) >= srcAtlas.GetHeight())
+	return Composite(srcAtlas, dstX, dstY, srcX, srcY, width, height, BlendMode::Copy);
+}
+
+bool Atlas::Composite(const Atlas& srcAtlas,
+	unsigned int dstX, unsigned int dstY,
+	unsigned int srcX, unsigned int srcY,
+	unsigned int width, unsigned int height, BlendMode mode)
+{
+	if (!_rect_inside(dstX, dstY, width, height, mWidth, mHeight) ||
+		!_rect_inside(srcX, srcY, width, height, srcAtlas.GetWidth(), srcAtlas.GetHeight()))
+	{
+		logerr("Warning: Atlas::Composite(): Either dst or src rect is out of range.");
+		return false;
+	}
+
+	// Only copying lets zeros from untouched src tiles change dst.
+	ComposeSpans(srcAtlas, dstX, dstY, srcX, srcY, width, height, mode != BlendMode::Copy,
+		[mode](char* d, const char* s, unsigned int n) { BlendSpan(mode, d, s, n); });
+	return true;
+}
+
+bool Atlas::CopyChannel(const Atlas& srcAtlas, unsigned int dstChannel, unsigned int srcChannel,
+	unsigned int dstX, unsigned int dstY,
+	unsigned int srcX, unsigned int srcY,
+	unsigned int width, unsigned int height)
+{
+	if (dstChannel > 3 || srcChannel > 3)
 	{
-		logerr("Warning: Atlas::BitBlt(): Either dst or src rect is out of range.");
+		logerr("Warning: Atlas::CopyChannel(): Invalid channel.");
 		return false;
 	}
 
-	for (unsigned int y = 0; y < height; ++y)
+	if (!_rect_inside(dstX, dstY, width, height, mWidth, mHeight) ||
+		!_rect_inside(srcX, srcY, width, height, srcAtlas.GetWidth(), srcAtlas.GetHeight()))
 	{
-		unsigned int sy = srcY + y;
-		unsigned int dy = dstY + y;
+		logerr("Warning: Atlas::CopyChannel(): Either dst or src rect is out of range.");
+		return false;
+	}
 
-		unsigned int src_row_stride = srcAtlas.GetWidth() * 4;
-		unsigned int dst_row_stride = mWidth * 4;
+	ComposeSpans(srcAtlas, dstX, dstY, srcX, srcY, width, height, false,
+		[dstChannel, srcChannel](char* d, const char* s, unsigned int n) { CopyChannelSpan(d, s, dstChannel, srcChannel, n); });
+	return true;
+}
 
-		::memcpy(&mBuffer[(dy*dst_row_stride) + (dstX * 4)],
-			&srcAtlas.mBuffer[(sy*src_row_stride) + (srcX * 4)],
-			width*4);
+bool Atlas::Fill(unsigned int x, unsigned int y,
+	unsigned int width, unsigned int height, const Color& c)
+{
+	if (!_rect_inside(x, y, width, height, mWidth, mHeight))
+	{
+		logerr("Warning: Atlas::Fill(): The rect is out of range.");
+		return false;
 	}
 
+	bool zero = (c.R == 0 && c.G == 0 && c.B == 0 && c.A == 0);
+	for (unsigned int row = y; row < y + height; ++row)
+	{
+		for (unsigned int col = x; col < x + width; )
+		{
+			unsigned int n = x + width - col;
+			if (zero && GetSpan(col, row, n) == nullptr)
+			{
+				col += n;
+				continue;
+			}
+
+			FillSpan(GetSpanForWrite(col, row, n), c, n);
+			col += n;
+		}
+	}
 	return true;
 }
 
 void Atlas::SetPixel(unsigned int x, unsigned int y, const Color& c)
 {
-	if (x >= mWidth || y >= mHeight || mBuffer == nullptr)
+	if (x >= mWidth || y >= mHeight || (mBuffer == nullptr && mTiles.empty()))
 	{
 		logerr("Warning: Atlas::SetPixel(): Either x or y is out of range.");
 		return;
 	}
 
-	unsigned int row_stride = mWidth*4;
-	char* p = &mBuffer[(y*row_stride) + (x*4)];
+	unsigned int n = 1;
+	char* p = GetSpanForWrite(x, y, n);
 	p[0] = (char)c.R;
 	p[1] = (char)c.G;
 	p[2] = (char)c.B;
@@ -318,14 +924,17 @@ Color Atlas::GetPixel(unsigned int x, unsigned int y) const
 {
 	Color ret = {0};
 
-	if (x >= mWidth || y >= mHeight || mBuffer == nullptr)
+	if (x >= mWidth || y >= mHeight || (mBuffer == nullptr && mTiles.empty()))
 	{
 		logerr("Warning: Atlas::GetPixel(): Either x or y is out of range.");
 		return ret;
 	}
 
-	unsigned int row_stride = mWidth * 4;
-	char* p = &mBuffer[(y*row_stride) + (x * 4)];
+	unsigned int n = 1;
+	const char* p = GetSpan(x, y, n);
+	if (p == nullptr)
+		return ret;
+
 	ret.R = (unsigned char)p[0];
 	ret.G = (unsigned char)p[1];
 	ret.B = (unsigned char)p[2];
@@ -1,5 +1,10 @@
 #pragma once
+#include <stdio.h>
 #include <string>
+#include <memory>
+#include <vector>
+#include "texture.h"
+#include "mipmap.h"
 
 namespace bmfm
 {
@@ -12,38 +17,143 @@ struct Color
 	unsigned char A;
 };
 
+enum class AtlasStorage
+{
+	Dense = 0, // One contiguous buffer, allocated and cleared up front.
+	Sparse,    // Tiles of TileSize x TileSize pixels, allocated on the first write into them.
+	Mapped,    // Like Dense, in a memory mapped scratch file the kernel can page out, for pages larger than RAM.
+};
+
+enum class BlendMode
+{
+	Copy = 0,  // dst = src
+	AlphaOver, // dst = src over dst, non-premultiplied alpha
+	Max,       // dst = max(src, dst), per channel
+	Masked,    // dst = src where src alpha is not zero
+};
+
+enum class PNGWriteProfile
+{
+	Default = 0, // libpng defaults: adaptive row filters, zlib level 6.
+	Fast,        // No row filters and the Z_QUICK deflate strategy, made for glyph atlases.
+	Smallest,    // Several filter and zlib strategy combinations encoded concurrently, the smallest kept.
+};
+
+// Row filters (a PNG_FILTER_* mask), zlib level and zlib strategy of one PNG
+// encoding. -1 keeps the libpng default.
+struct PNGEncoding
+{
+	int filters;
+	int level;
+	int strategy;
+};
+
+enum class PNGReadMode
+{
+	Sequential = 0, // Read the whole image through png_read_image().
+	Progressive,    // Decode the file chunk by chunk while the next chunk is being read.
+};
+
+/*
+   Pixel buffers are reference counted and copy-on-write: copying
+   an Atlas only shares the buffer, which gets cloned the first time
+   one of the sharing atlases modifies it. Moving never copies.
+   Sparse atlases do the same per tile. Untouched tiles read as
+   zero (transparent black) and cost no memory.
+*/
 class Atlas
 {
 public:
 	Atlas();
-	Atlas(unsigned int w, unsigned int h);
+	Atlas(unsigned int w, unsigned int h, AtlasStorage storage = AtlasStorage::Dense);
 	virtual ~Atlas();
 	Atlas(const Atlas& that);
 	Atlas(Atlas&& that);
 	Atlas& operator=(const Atlas& that);
 	Atlas& operator=(Atlas&& that);
 
-	static Atlas LoadFromPNG(std::string path);
-	bool SaveToPNG(std::string path);
+	// Any PNG color type and bit depth is accepted and converted to 8-bit RGBA.
+	static Atlas LoadFromPNG(std::string path, PNGReadMode mode = PNGReadMode::Sequential);
+	// Encoding may use up to threads worker threads, 0 means one per hardware thread.
+	bool SaveToPNG(std::string path, PNGWriteProfile profile = PNGWriteProfile::Default, unsigned int threads = 0);
+
+	// Save one channel (0:R, 1:G, 2:B, 3:A) as a GPU texture, a single level
+	// one or, given mip settings, with the whole chain from BuildMipChain().
+	bool SaveToKTX2(std::string path, TextureFormat format, unsigned int channel = 3,
+		const MipSettings* mips = nullptr, unsigned int threads = 0) const;
+	bool SaveToDDS(std::string path, TextureFormat format, unsigned int channel = 3,
+		const MipSettings* mips = nullptr, unsigned int threads = 0) const;
 
 	bool BitBlt(const Atlas& srcAtlas, 
 		unsigned int dstX, unsigned int dstY, 
 		unsigned int srcX, unsigned int srcY,
 		unsigned int width, unsigned int height);
 
+	// Compositor API. Rects must lie within both atlases, src may be this atlas.
+	// Channels are numbered 0:R, 1:G, 2:B, 3:A.
+	bool Composite(const Atlas& srcAtlas,
+		unsigned int dstX, unsigned int dstY,
+		unsigned int srcX, unsigned int srcY,
+		unsigned int width, unsigned int height, BlendMode mode);
+	bool CopyChannel(const Atlas& srcAtlas, unsigned int dstChannel, unsigned int srcChannel,
+		unsigned int dstX, unsigned int dstY,
+		unsigned int srcX, unsigned int srcY,
+		unsigned int width, unsigned int height);
+	bool Fill(unsigned int x, unsigned int y,
+		unsigned int width, unsigned int height, const Color& c);
+
 	unsigned int GetWidth() const { return mWidth; }
 	unsigned int GetHeight() const { return mHeight; }
 	const std::string& GetPath() const { return mPath; }
+	AtlasStorage GetStorage() const { return mStorage; }
+	size_t GetAllocatedTileCount() const;
+	// Hash of the size and pixels, the same for dense and sparse storage.
+	unsigned long long GetContentHash() const;
 	void SetPixel(unsigned int x, unsigned int y, const Color& c);
 	Color GetPixel(unsigned int x, unsigned int y) const;
 
+	static const unsigned int TileSize = 64;
+
 private:
 	void Free();
+	void Detach(); // Clone the pixel buffer if it is shared with others.
+	std::shared_ptr<char> AllocBuffer() const; // A cleared buffer for the whole atlas.
+
+	// Returns the pixels from (x,y) on which are contiguous in memory and clips
+	// count to their number. A null return means the span reads as zero.
+	const char* GetSpan(unsigned int x, unsigned int y, unsigned int& count) const;
+	char* GetSpanForWrite(unsigned int x, unsigned int y, unsigned int& count);
+
+	// Returns row y as one contiguous run of pixels. Rows of a sparse atlas
+	// are assembled in scratch, or are zeroRow if no tile of them was touched.
+	const char* GetRow(unsigned int y, char* scratch, const char* zeroRow) const;
+
+	// Encodes the atlas as PNG into f, or appends it to mem when f is null.
+	bool WritePNG(const std::string& path, FILE* f, std::vector<unsigned char>* mem,
+		const PNGEncoding& encoding) const;
+	bool SaveToPNGSmallest(const std::string& path, unsigned int threads) const;
+
+	// Gathers one channel of the whole atlas into a w x h plane of bytes.
+	bool GetPlane(const char* caller, unsigned int channel, std::vector<unsigned char>& plane) const;
+	// The same as level 0, followed by the mip chain if mips is given.
+	bool GetLevels(const char* caller, unsigned int channel, const MipSettings* mips,
+		std::vector<TextureLevel>& levels) const;
+
+	// Runs kernel(dst, src, count) over the matching spans of both rects.
+	template<typename Kernel>
+	void ComposeSpans(const Atlas& srcAtlas,
+		unsigned int dstX, unsigned int dstY,
+		unsigned int srcX, unsigned int srcY,
+		unsigned int width, unsigned int height,
+		bool zeroSrcIsNoop, Kernel kernel);
 
 	unsigned int mWidth;
 	unsigned int mHeight;
 	std::string mPath;
-	char* mBuffer; // Buffer pointing to a pixel buffer. (RGBA)
+	AtlasStorage mStorage;
+	std::shared_ptr<char> mBuffer; // Shared, copy-on-write pixel buffer. (RGBA, dense and mapped storage)
+	std::vector<std::shared_ptr<char>> mTiles; // Shared, copy-on-write tiles. (RGBA, sparse storage)
+	unsigned int mTilesPerRow;
 };
 
 }; // namespace bmfm
@@ -0,0 +1,138 @@
+#ifdef USE_VLD
+#  include <vld.h>
+#endif
+
+#include "atlasmap.h"
+#include <atomic>
+#include <stdexcept>
+#include <thread>
+#include <vector>
+
+using namespace bmfm;
+
+AtlasMap::AtlasMap()
+{
+}
+
+AtlasMap::AtlasMap(const AtlasMap& that)
+{
+	*this = that;
+}
+
+AtlasMap& AtlasMap::operator=(const AtlasMap& that)
+{
+	if (this == &that)
+		return *this;
+
+	// Pending pages stay pending in the copy, loaded ones share their pixels.
+	std::map<unsigned int, std::unique_ptr<Page>> pages;
+	for (const auto& pair : that.mPages)
+	{
+		std::unique_ptr<Page> p(new Page());
+		std::lock_guard<std::mutex> guard(pair.second->lock);
+		p->path = pair.second->path;
+		p->atlas = pair.second->atlas;
+		pages.insert(std::make_pair(pair.first, std::move(p)));
+	}
+	mPages.swap(pages);
+	return *this;
+}
+
+void AtlasMap::AddLazy(unsigned int id, const std::string& path)
+{
+	std::unique_ptr<Page> p(new Page());
+	p->path = path;
+	mPages.insert(std::make_pair(id, std::move(p)));
+}
+
+bool AtlasMap::IsLoaded(unsigned int id) const
+{
+	auto it = mPages.find(id);
+	if (it == mPages.end())
+		return false;
+
+	std::lock_guard<std::mutex> guard(it->second->lock);
+	return it->second->path.empty();
+}
+
+void AtlasMap::Prefetch(unsigned int threads)
+{
+	Prefetch(std::vector<AtlasMap*>{ this }, threads);
+}
+
+void AtlasMap::Prefetch(const std::vector<AtlasMap*>& maps, unsigned int threads)
+{
+	std::vector<Page*> pending;
+	for (AtlasMap* m : maps)
+		for (auto& pair : m->mPages)
+			if (!m->IsLoaded(pair.first))
+				pending.push_back(pair.second.get());
+	if (pending.empty())
+		return;
+
+	if (threads == 0)
+		threads = std::thread::hardware_concurrency();
+	if (threads == 0)
+		threads = 1;
+	if (threads > pending.size())
+		threads = (unsigned int)pending.size();
+
+	std::atomic<size_t> next(0);
+	auto worker = [&]() {
+		for (size_t i = next++; i < pending.size(); i = next++)
+			Load(*pending[i]);
+	};
+
+	std::vector<std::thread> pool;
+	for (unsigned int i = 1; i < threads; ++i)
+		pool.emplace_back(worker);
+	worker();
+	for (auto& t : pool)
+		t.join();
+}
+
+bool AtlasMap::insert(const std::pair<unsigned int, Atlas>& page)
+{
+	if (mPages.count(page.first))
+		return false;
+
+	std::unique_ptr<Page> p(new Page());
+	p->atlas = page.second;
+	mPages.insert(std::make_pair(page.first, std::move(p)));
+	return true;
+}
+
+Atlas& AtlasMap::operator[](unsigned int id)
+{
+	std::unique_ptr<Page>& p = mPages[id];
+	if (!p)
+		p.reset(new Page());
+	return Load(*p);
+}
+
+Atlas& AtlasMap::at(unsigned int id)
+{
+	auto it = mPages.find(id);
+	if (it == mPages.end())
+		throw std::out_of_range("AtlasMap::at(): no such page");
+	return Load(*it->second);
+}
+
+const Atlas& AtlasMap::at(unsigned int id) const
+{
+	auto it = mPages.find(id);
+	if (it == mPages.end())
+		throw std::out_of_range("AtlasMap::at(): no such page");
+	return Load(*it->second);
+}
+
+Atlas& AtlasMap::Load(Page& page)
+{
+	std::lock_guard<std::mutex> guard(page.lock);
+	if (!page.path.empty())
+	{
+		page.atlas = Atlas::LoadFromPNG(page.path, PNGReadMode::Progressive);
+		page.path.clear();
+	}
+	return page.atlas;
+}
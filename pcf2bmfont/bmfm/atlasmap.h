@@ -0,0 +1,63 @@
+#pragma once
+#include <map>
+#include <memory>
+#include <mutex>
+#include <string>
+#include <vector>
+#include "atlas.h"
+
+namespace bmfm
+{
+
+/*
+   Page id to Atlas map of a BMFontDocument. Pages added with
+   AddLazy() are only decoded the first time they are accessed, so
+   documents opened just for their metrics never touch their images.
+   Prefetch() decodes all pending pages at once on worker threads.
+   Accessing pages is thread safe, modifying the map is not.
+*/
+class AtlasMap
+{
+public:
+	AtlasMap();
+	AtlasMap(const AtlasMap& that);
+	AtlasMap(AtlasMap&& that) = default;
+	AtlasMap& operator=(const AtlasMap& that);
+	AtlasMap& operator=(AtlasMap&& that) = default;
+
+	// Adds a page which is loaded from the PNG at path on first access.
+	void AddLazy(unsigned int id, const std::string& path);
+	bool IsLoaded(unsigned int id) const;
+
+	// Decodes every page not loaded yet, using up to threads worker
+	// threads (0 means one per hardware thread).
+	void Prefetch(unsigned int threads = 0);
+
+	// Same as above for the pages of several maps at once, sharing one
+	// pool of up to threads worker threads between all of them.
+	static void Prefetch(const std::vector<AtlasMap*>& maps, unsigned int threads = 0);
+
+	// std::map alike accessors. at() throws std::out_of_range for unknown ids.
+	bool insert(const std::pair<unsigned int, Atlas>& page);
+	Atlas& operator[](unsigned int id);
+	Atlas& at(unsigned int id);
+	const Atlas& at(unsigned int id) const;
+	size_t count(unsigned int id) const { return mPages.count(id); }
+	size_t size() const { return mPages.size(); }
+	bool empty() const { return mPages.empty(); }
+	void clear() { mPages.clear(); }
+
+private:
+	struct Page
+	{
+		std::string path; // Empty once loaded.
+		Atlas atlas;
+		std::mutex lock;
+	};
+
+	static Atlas& Load(Page& page);
+
+	std::map<unsigned int, std::unique_ptr<Page>> mPages;
+};
+
+}; // namespace bmfm
@@ -0,0 +1,260 @@
+#ifdef USE_VLD
+#  include <vld.h>
+#endif
+
+#include "bandwriter.h"
+#include "utils.h"
+#include <png.h>
+#include <zlib.h>
+#include <string.h>
+
+using namespace bmfm;
+
+static void _png_error_callback(::png_structp structp, const char* msg)
+{
+	bmfm::logerrfmt("libpng error: file: %s, msg: %s",
+		(const char*)png_get_error_ptr(structp), msg);
+}
+
+static void _png_warn_callback(::png_structp structp, const char* msg)
+{
+	bmfm::logerrfmt("libpng warning: file: %s, msg: %s",
+		(const char*)png_get_error_ptr(structp), msg);
+}
+
+static void _png_set_write_profile(::png_structp png_ptr, PNGWriteProfile profile)
+{
+	if (profile == PNGWriteProfile::Fast)
+	{
+		::png_set_filter(png_ptr, PNG_FILTER_TYPE_BASE, PNG_FILTER_NONE);
+		::png_set_compression_strategy(png_ptr, Z_QUICK);
+	}
+	else if (profile == PNGWriteProfile::Smallest)
+	{
+		// Bands are encoded once as they come, so there is no trying several
+		// encodings. Take the one that is most often the smallest.
+		::png_set_filter(png_ptr, PNG_FILTER_TYPE_BASE, PNG_ALL_FILTERS);
+		::png_set_compression_level(png_ptr, 9);
+	}
+}
+
+
+AtlasBandWriter::AtlasBandWriter()
+	: mWidth(0)
+	, mHeight(0)
+	, mBandHeight(0)
+	, mBandTop(0)
+	, mFile(nullptr)
+	, mPngPtr(nullptr)
+	, mInfoPtr(nullptr)
+	, mCurrentBand(0)
+{
+	mBands[0] = mBands[1] = nullptr;
+}
+
+AtlasBandWriter::~AtlasBandWriter()
+{
+	if (IsOpen())
+	{
+		logerrfmt("Warning: AtlasBandWriter: %s was not closed, the file is incomplete.", mPath.c_str());
+		Abort();
+	}
+}
+
+bool AtlasBandWriter::Open(std::string path, unsigned int w, unsigned int h, unsigned int bandHeight,
+	PNGWriteProfile profile)
+{
+	if (IsOpen())
+	{
+		logerr("Error: AtlasBandWriter::Open(): Already opened.");
+		return false;
+	}
+
+	if (w == 0 || h == 0 || bandHeight == 0)
+	{
+		logerr("Error: AtlasBandWriter::Open(): Unable to write an empty atlas.");
+		return false;
+	}
+
+	mPath = path;
+	mWidth = w;
+	mHeight = h;
+	mBandHeight = (bandHeight > h) ? h : bandHeight;
+	mBandTop = 0;
+	mCurrentBand = 0;
+
+	mFile = ::fopen(path.c_str(), "wb");
+	if (!mFile)
+	{
+		logerrfmt("Error: AtlasBandWriter::Open(): Unable to open file: %s for writing.", path.c_str());
+		return false;
+	}
+
+	::png_structp png_ptr = ::png_create_write_struct(PNG_LIBPNG_VER_STRING, (void*)mPath.c_str(), _png_error_callback, _png_warn_callback);
+	if (!png_ptr)
+	{
+		logerr("Error: AtlasBandWriter::Open(): png_create_write_struct() failed.");
+		Abort();
+		return false;
+	}
+	mPngPtr = png_ptr;
+
+	::png_infop info_ptr = ::png_create_info_struct(png_ptr);
+	if (!info_ptr)
+	{
+		logerr("Error: AtlasBandWriter::Open(): png_create_info_struct() failed.");
+		Abort();
+		return false;
+	}
+	mInfoPtr = info_ptr;
+
+	if (setjmp(png_jmpbuf(png_ptr)))
+	{
+		logerr("Error: AtlasBandWriter::Open(): Failed on writing PNG header.");
+		Abort();
+		return false;
+	}
+
+	::png_init_io(png_ptr, mFile);
+	::png_set_IHDR(png_ptr, info_ptr, mWidth, mHeight,
+		8, PNG_COLOR_TYPE_RGBA, PNG_INTERLACE_NONE,
+		PNG_COMPRESSION_TYPE_BASE, PNG_FILTER_TYPE_BASE);
+	_png_set_write_profile(png_ptr, profile);
+	::png_write_info(png_ptr, info_ptr);
+
+	size_t len = (size_t)mWidth*(size_t)mBandHeight * 4;
+	mBands[0] = new char[len];
+	mBands[1] = new char[len];
+	::memset(mBands[0], 0, len);
+	mRowPointers.assign(mBandHeight, nullptr);
+	return true;
+}
+
+unsigned int AtlasBandWriter::GetBandBottom() const
+{
+	unsigned int bottom = mBandTop + mBandHeight;
+	return (bottom > mHeight) ? mHeight : bottom;
+}
+
+void AtlasBandWriter::SetPixel(unsigned int x, unsigned int y, const Color& c)
+{
+	if (x >= mWidth || y < mBandTop || y >= GetBandBottom() || !IsOpen())
+	{
+		logerr("Warning: AtlasBandWriter::SetPixel(): Either x or y is out of the current band.");
+		return;
+	}
+
+	size_t row_stride = (size_t)mWidth * 4;
+	char* p = &mBands[mCurrentBand][((y - mBandTop)*row_stride) + (x * 4)];
+	p[0] = (char)c.R;
+	p[1] = (char)c.G;
+	p[2] = (char)c.B;
+	p[3] = (char)c.A;
+}
+
+bool AtlasBandWriter::NextBand()
+{
+	if (!IsOpen() || mBandTop >= mHeight)
+	{
+		logerr("Error: AtlasBandWriter::NextBand(): No band left to write.");
+		return false;
+	}
+
+	// The previous band must be fully compressed before its buffer gets reused.
+	if (!WaitPending())
+	{
+		Abort();
+		return false;
+	}
+
+	unsigned int rows = GetBandBottom() - mBandTop;
+	char* filled = mBands[mCurrentBand];
+	mPending = std::async(std::launch::async, &AtlasBandWriter::WriteRows, this, filled, rows);
+
+	mCurrentBand ^= 1;
+	mBandTop += rows;
+	if (mBandTop < mHeight)
+		::memset(mBands[mCurrentBand], 0, (size_t)mWidth*(size_t)mBandHeight * 4);
+	return true;
+}
+
+bool AtlasBandWriter::Close()
+{
+	if (!IsOpen())
+	{
+		logerr("Error: AtlasBandWriter::Close(): Not opened.");
+		return false;
+	}
+
+	while (mBandTop < mHeight)
+	{
+		if (!NextBand())
+			return false;
+	}
+
+	if (!WaitPending())
+	{
+		Abort();
+		return false;
+	}
+
+	::png_structp png_ptr = (::png_structp)mPngPtr;
+	if (setjmp(png_jmpbuf(png_ptr)))
+	{
+		logerr("Error: AtlasBandWriter::Close(): png_write_end() failed.");
+		Abort();
+		return false;
+	}
+
+	::png_write_end(png_ptr, nullptr);
+	Abort(); // Nothing left to write, just release everything.
+	return true;
+}
+
+bool AtlasBandWriter::WaitPending()
+{
+	if (!mPending.valid())
+		return true;
+	return mPending.get();
+}
+
+bool AtlasBandWriter::WriteRows(char* buffer, unsigned int rows)
+{
+	// Runs on a worker thread. libpng longjmp()s back to the
+	// setjmp() of the calling thread, so set up one here.
+	::png_structp png_ptr = (::png_structp)mPngPtr;
+	if (setjmp(png_jmpbuf(png_ptr)))
+	{
+		logerrfmt("Error: AtlasBandWriter: png_write_rows() failed. %s", mPath.c_str());
+		return false;
+	}
+
+	size_t row_stride = (size_t)mWidth * 4;
+	for (unsigned int i = 0; i < rows; ++i)
+		mRowPointers[i] = (unsigned char*)&buffer[i*row_stride];
+	::png_write_rows(png_ptr, &mRowPointers[0], rows);
+	return true;
+}
+
+void AtlasBandWriter::Abort()
+{
+	if (mPending.valid())
+		mPending.wait();
+	mPending = std::future<bool>();
+
+	::png_structp png_ptr = (::png_structp)mPngPtr;
+	::png_infop info_ptr = (::png_infop)mInfoPtr;
+	if (png_ptr)
+		::png_destroy_write_struct(&png_ptr, &info_ptr);
+	mPngPtr = nullptr;
+	mInfoPtr = nullptr;
+
+	if (mFile)
+		::fclose(mFile);
+	mFile = nullptr;
+
+	delete[] mBands[0];
+	delete[] mBands[1];
+	mBands[0] = mBands[1] = nullptr;
+	mRowPointers.clear();
+}
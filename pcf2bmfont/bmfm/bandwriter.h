@@ -0,0 +1,63 @@
+#pragma once
+#include <stdio.h>
+#include <string>
+#include <vector>
+#include <future>
+#include "atlas.h"
+
+namespace bmfm
+{
+
+/*
+   Writes an atlas page into a PNG file band by band, so the
+   whole page never has to be held in memory. Only the current
+   band (and the previous one, while it is being compressed on
+   a worker thread) is kept around.
+
+   Usage: Open() the file, draw into rows [GetBandTop(), GetBandBottom())
+   with SetPixel(), call NextBand() to hand the band over to libpng,
+   and finally Close() to flush the remaining bands.
+*/
+class AtlasBandWriter
+{
+public:
+	AtlasBandWriter();
+	virtual ~AtlasBandWriter();
+	AtlasBandWriter(const AtlasBandWriter& that) = delete;
+	AtlasBandWriter& operator=(const AtlasBandWriter& that) = delete;
+
+	bool Open(std::string path, unsigned int w, unsigned int h, unsigned int bandHeight,
+		PNGWriteProfile profile = PNGWriteProfile::Default);
+	bool NextBand();
+	bool Close();
+
+	bool IsOpen() const { return mPngPtr != nullptr; }
+	unsigned int GetWidth() const { return mWidth; }
+	unsigned int GetHeight() const { return mHeight; }
+	unsigned int GetBandTop() const { return mBandTop; }
+	unsigned int GetBandBottom() const; // exclusive
+	const std::string& GetPath() const { return mPath; }
+
+	// x and y are page coordinates, y must be inside the current band.
+	void SetPixel(unsigned int x, unsigned int y, const Color& c);
+
+private:
+	bool WaitPending();
+	bool WriteRows(char* buffer, unsigned int rows);
+	void Abort();
+
+	unsigned int mWidth;
+	unsigned int mHeight;
+	unsigned int mBandHeight;
+	unsigned int mBandTop;
+	std::string mPath;
+	FILE* mFile;
+	void* mPngPtr;  // png_structp
+	void* mInfoPtr; // png_infop
+	char* mBands[2]; // Band buffers being drawn/written alternately. (RGBA)
+	std::vector<unsigned char*> mRowPointers;
+	unsigned int mCurrentBand;
+	std::future<bool> mPending;
+};
+
+}; // namespace bmfm
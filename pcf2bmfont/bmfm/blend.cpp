@@ -0,0 +1,179 @@
+#ifdef USE_VLD
+#  include <vld.h>
+#endif
+
+#include "blend.h"
+#include <string.h>
+
+#ifdef BMFM_USE_SSE2
+#  include <emmintrin.h>
+#endif
+
+using namespace bmfm;
+
+// Non-premultiplied "src over dst" of one pixel. The SSE2 path below
+// performs exactly the same float operations, 4 channels at a time.
+static void _alpha_over_pixel(unsigned char* d, const unsigned char* s)
+{
+	float sa = s[3] * (1.0f / 255.0f);
+	float da = d[3] * (1.0f / 255.0f);
+	float dw = da * (1.0f - sa);
+	float oa = sa + dw;
+	if (oa <= 0.0f)
+	{
+		d[0] = d[1] = d[2] = d[3] = 0;
+		return;
+	}
+
+	float inv = 1.0f / oa;
+	for (int i = 0; i < 3; ++i)
+		d[i] = (unsigned char)(((float)s[i] * sa + (float)d[i] * dw) * inv + 0.5f);
+	d[3] = (unsigned char)(oa * 255.0f + 0.5f);
+}
+
+#ifdef BMFM_USE_SSE2
+static inline __m128 _alpha_over_lane(__m128 s, __m128 d)
+{
+	const __m128 one = _mm_set1_ps(1.0f);
+	const __m128 norm = _mm_set1_ps(1.0f / 255.0f);
+	const __m128 alphaLane = _mm_castsi128_ps(_mm_set_epi32(-1, 0, 0, 0));
+
+	__m128 sa = _mm_mul_ps(_mm_shuffle_ps(s, s, _MM_SHUFFLE(3, 3, 3, 3)), norm);
+	__m128 da = _mm_mul_ps(_mm_shuffle_ps(d, d, _MM_SHUFFLE(3, 3, 3, 3)), norm);
+	__m128 dw = _mm_mul_ps(da, _mm_sub_ps(one, sa));
+	__m128 oa = _mm_add_ps(sa, dw);
+	__m128 valid = _mm_cmpgt_ps(oa, _mm_setzero_ps());
+
+	// Avoid dividing by zero, invalid lanes are masked out below anyway.
+	__m128 inv = _mm_div_ps(one, _mm_or_ps(_mm_and_ps(valid, oa), _mm_andnot_ps(valid, one)));
+	__m128 c = _mm_mul_ps(_mm_add_ps(_mm_mul_ps(s, sa), _mm_mul_ps(d, dw)), inv);
+	__m128 a = _mm_mul_ps(oa, _mm_set1_ps(255.0f));
+	__m128 r = _mm_or_ps(_mm_and_ps(alphaLane, a), _mm_andnot_ps(alphaLane, c));
+	r = _mm_add_ps(r, _mm_set1_ps(0.5f));
+	return _mm_and_ps(valid, r);
+}
+
+static void _alpha_over_sse2(char* dst, const char* src, unsigned int count)
+{
+	const __m128i zero = _mm_setzero_si128();
+	unsigned int i = 0;
+	for (; i + 4 <= count; i += 4)
+	{
+		__m128i s8 = _mm_loadu_si128((const __m128i*)&src[i * 4]);
+		__m128i d8 = _mm_loadu_si128((__m128i*)&dst[i * 4]);
+
+		__m128i s16lo = _mm_unpacklo_epi8(s8, zero);
+		__m128i s16hi = _mm_unpackhi_epi8(s8, zero);
+		__m128i d16lo = _mm_unpacklo_epi8(d8, zero);
+		__m128i d16hi = _mm_unpackhi_epi8(d8, zero);
+
+		__m128 r0 = _alpha_over_lane(_mm_cvtepi32_ps(_mm_unpacklo_epi16(s16lo, zero)), _mm_cvtepi32_ps(_mm_unpacklo_epi16(d16lo, zero)));
+		__m128 r1 = _alpha_over_lane(_mm_cvtepi32_ps(_mm_unpackhi_epi16(s16lo, zero)), _mm_cvtepi32_ps(_mm_unpackhi_epi16(d16lo, zero)));
+		__m128 r2 = _alpha_over_lane(_mm_cvtepi32_ps(_mm_unpacklo_epi16(s16hi, zero)), _mm_cvtepi32_ps(_mm_unpacklo_epi16(d16hi, zero)));
+		__m128 r3 = _alpha_over_lane(_mm_cvtepi32_ps(_mm_unpackhi_epi16(s16hi, zero)), _mm_cvtepi32_ps(_mm_unpackhi_epi16(d16hi, zero)));
+
+		// Truncating conversion, the rounding bias was added in _alpha_over_lane().
+		__m128i lo = _mm_packs_epi32(_mm_cvttps_epi32(r0), _mm_cvttps_epi32(r1));
+		__m128i hi = _mm_packs_epi32(_mm_cvttps_epi32(r2), _mm_cvttps_epi32(r3));
+		_mm_storeu_si128((__m128i*)&dst[i * 4], _mm_packus_epi16(lo, hi));
+	}
+
+	for (; i < count; ++i)
+		_alpha_over_pixel((unsigned char*)&dst[i * 4], (const unsigned char*)&src[i * 4]);
+}
+#endif
+
+static void _alpha_over(char* dst, const char* src, unsigned int count)
+{
+#ifdef BMFM_USE_SSE2
+	_alpha_over_sse2(dst, src, count);
+#else
+	for (unsigned int i = 0; i < count; ++i)
+		_alpha_over_pixel((unsigned char*)&dst[i * 4], (const unsigned char*)&src[i * 4]);
+#endif
+}
+
+static void _max(char* dst, const char* src, unsigned int count)
+{
+	unsigned char* d = (unsigned char*)dst;
+	const unsigned char* s = (const unsigned char*)src;
+	size_t len = (size_t)count * 4;
+	size_t i = 0;
+#ifdef BMFM_USE_SSE2
+	for (; i + 16 <= len; i += 16)
+	{
+		__m128i a = _mm_loadu_si128((const __m128i*)&s[i]);
+		__m128i b = _mm_loadu_si128((__m128i*)&d[i]);
+		_mm_storeu_si128((__m128i*)&d[i], _mm_max_epu8(a, b));
+	}
+#endif
+	for (; i < len; ++i)
+		if (s[i] > d[i])
+			d[i] = s[i];
+}
+
+static void _masked(char* dst, const char* src, unsigned int count)
+{
+	unsigned int i = 0;
+#ifdef BMFM_USE_SSE2
+	const __m128i alphaMask = _mm_set1_epi32((int)0xFF000000);
+	for (; i + 4 <= count; i += 4)
+	{
+		__m128i s = _mm_loadu_si128((const __m128i*)&src[i * 4]);
+		__m128i d = _mm_loadu_si128((__m128i*)&dst[i * 4]);
+		__m128i transparent = _mm_cmpeq_epi32(_mm_and_si128(s, alphaMask), _mm_setzero_si128());
+		_mm_storeu_si128((__m128i*)&dst[i * 4],
+			_mm_or_si128(_mm_and_si128(transparent, d), _mm_andnot_si128(transparent, s)));
+	}
+#endif
+	for (; i < count; ++i)
+		if (src[i * 4 + 3] != 0)
+			::memcpy(&dst[i * 4], &src[i * 4], 4);
+}
+
+void bmfm::BlendSpan(BlendMode mode, char* dst, const char* src, unsigned int count)
+{
+	switch (mode)
+	{
+	case BlendMode::Copy: ::memmove(dst, src, (size_t)count * 4); break;
+	case BlendMode::AlphaOver: _alpha_over(dst, src, count); break;
+	case BlendMode::Max: _max(dst, src, count); break;
+	case BlendMode::Masked: _masked(dst, src, count); break;
+	}
+}
+
+void bmfm::FillSpan(char* dst, const Color& c, unsigned int count)
+{
+	unsigned char px[4] = { c.R, c.G, c.B, c.A };
+	unsigned int i = 0;
+#ifdef BMFM_USE_SSE2
+	int v;
+	::memcpy(&v, px, 4);
+	__m128i p = _mm_set1_epi32(v);
+	for (; i + 4 <= count; i += 4)
+		_mm_storeu_si128((__m128i*)&dst[i * 4], p);
+#endif
+	for (; i < count; ++i)
+		::memcpy(&dst[i * 4], px, 4);
+}
+
+void bmfm::CopyChannelSpan(char* dst, const char* src, unsigned int dstChannel, unsigned int srcChannel, unsigned int count)
+{
+	unsigned int i = 0;
+#ifdef BMFM_USE_SSE2
+	// Pixels are little endian 32-bit words here, channel n is bits [8n, 8n+8).
+	const __m128i byteMask = _mm_set1_epi32(0xFF);
+	const __m128i keepMask = _mm_set1_epi32(~(0xFF << (dstChannel * 8)));
+	const __m128i srcShift = _mm_cvtsi32_si128(srcChannel * 8);
+	const __m128i dstShift = _mm_cvtsi32_si128(dstChannel * 8);
+	for (; i + 4 <= count; i += 4)
+	{
+		__m128i s = _mm_loadu_si128((const __m128i*)&src[i * 4]);
+		__m128i d = _mm_loadu_si128((__m128i*)&dst[i * 4]);
+		__m128i v = _mm_sll_epi32(_mm_and_si128(_mm_srl_epi32(s, srcShift), byteMask), dstShift);
+		_mm_storeu_si128((__m128i*)&dst[i * 4], _mm_or_si128(_mm_and_si128(d, keepMask), v));
+	}
+#endif
+	for (; i < count; ++i)
+		dst[i * 4 + dstChannel] = src[i * 4 + srcChannel];
+}
@@ -0,0 +1,20 @@
+#pragma once
+#include "atlas.h"
+
+#if defined(__SSE2__) || defined(_M_X64) || (defined(_M_IX86_FP) && _M_IX86_FP >= 2)
+#  define BMFM_USE_SSE2 1
+#endif
+
+namespace bmfm
+{
+
+/*
+   Span kernels behind the Atlas compositor API. Each one works on
+   count contiguous RGBA pixels. They use SSE2 when the target has
+   it and fall back to plain C++ otherwise; both give identical results.
+*/
+void BlendSpan(BlendMode mode, char* dst, const char* src, unsigned int count);
+void FillSpan(char* dst, const Color& c, unsigned int count);
+void CopyChannelSpan(char* dst, const char* src, unsigned int dstChannel, unsigned int srcChannel, unsigned int count);
+
+}; // namespace bmfm
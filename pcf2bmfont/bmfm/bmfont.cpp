@@ -14,6 +14,22 @@ BMFontDocument::BMFontDocument()
 {
 }
 
+std::string BMFontDocument::PagePath(const std::string& xml_path, const std::string& file)
+{
+	size_t slash = xml_path.find_last_of("/\\");
+	bool absolute = file.empty() || file[0] == '/' || file[0] == '\\' || (file.size() > 1 && file[1] == ':');
+	if (slash == std::string::npos || absolute)
+		return file;
+
+	std::string resolved = xml_path.substr(0, slash + 1) + file;
+	FILE* f = ::fopen(resolved.c_str(), "rb");
+	if (!f && (f = ::fopen(file.c_str(), "rb")) != nullptr)
+		resolved = file;
+	if (f)
+		::fclose(f);
+	return resolved;
+}
+
 BMFontDocument BMFontDocument::LoadFromXML(std::string path)
 {
 	// Try open the file at given path. mmap the content.
@@ -284,8 +300,7 @@ BMFontDocument BMFontDocument::LoadFromXML(std::string path)
 						}
 					}
 
-					Atlas a = Atlas::LoadFromPNG(pd.filename);
-					ret.AltasMap.insert(std::make_pair(pd.id, a));
+					ret.AltasMap.AddLazy(pd.id, PagePath(path, pd.filename));
 					ret.PageMap.insert(std::make_pair(pd.id, pd));
 				}
 			}
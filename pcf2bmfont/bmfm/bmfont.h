@@ -3,7 +3,7 @@
 #include <string>
 #include <map>
 #include "bmftags.h"
-#include "atlas.h"
+#include "atlasmap.h"
 
 namespace bmfm
 {
@@ -22,11 +22,18 @@ public:
 	static BMFontDocument LoadFromXML(std::string path);
 	bool SaveToXML(std::string path);
 
+	// Where the image of a page whose file attribute is file lives, for
+	// the document at xml_path. Relative files are taken relative to the
+	// directory of xml_path, as BMFont does. Documents written with their
+	// images named relative to the working directory instead still load,
+	// as long as the file is only found there.
+	static std::string PagePath(const std::string& xml_path, const std::string& file);
+
 public:
 	BMFInfoData InfoData;
 	BMFCommonData CommonData;
 	std::map<unsigned int, BMFPageData> PageMap;
-	std::map<unsigned int, Atlas> AltasMap;
+	AtlasMap AltasMap; // Pages are decoded on first access, see AtlasMap.
 	std::map<unsigned int, BMFCharData> CharMap;
 	std::map<unsigned long long, BMFKerningData> KerningMap;
 
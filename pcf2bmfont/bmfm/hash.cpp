@@ -0,0 +1,142 @@
+#ifdef USE_VLD
+#  include <vld.h>
+#endif
+
+#include "hash.h"
+#include <string.h>
+
+using namespace bmfm;
+
+static const unsigned long long P1 = 11400714785074694791ULL;
+static const unsigned long long P2 = 14029467366897019727ULL;
+static const unsigned long long P3 = 1609587929392839161ULL;
+static const unsigned long long P4 = 9650029242287828579ULL;
+static const unsigned long long P5 = 2870177450012600261ULL;
+
+static unsigned long long _rotl(unsigned long long x, int r)
+{
+	return (x << r) | (x >> (64 - r));
+}
+
+static unsigned long long _read64(const unsigned char* p)
+{
+	unsigned long long v = 0;
+	for (int i = 7; i >= 0; --i)
+		v = (v << 8) | p[i];
+	return v;
+}
+
+static unsigned long long _read32(const unsigned char* p)
+{
+	return (unsigned long long)p[0] | ((unsigned long long)p[1] << 8)
+		| ((unsigned long long)p[2] << 16) | ((unsigned long long)p[3] << 24);
+}
+
+static unsigned long long _round(unsigned long long acc, unsigned long long input)
+{
+	acc += input * P2;
+	acc = _rotl(acc, 31);
+	return acc * P1;
+}
+
+static unsigned long long _merge_round(unsigned long long acc, unsigned long long lane)
+{
+	acc ^= _round(0, lane);
+	return acc * P1 + P4;
+}
+
+// Feeds whole 32 byte stripes of p to the lanes, returns the bytes consumed.
+static size_t _stripes(unsigned long long lanes[4], const unsigned char* p, size_t len)
+{
+	unsigned long long v0 = lanes[0], v1 = lanes[1], v2 = lanes[2], v3 = lanes[3];
+	size_t done = 0;
+	for (; done + 32 <= len; done += 32, p += 32)
+	{
+		v0 = _round(v0, _read64(p));
+		v1 = _round(v1, _read64(p + 8));
+		v2 = _round(v2, _read64(p + 16));
+		v3 = _round(v3, _read64(p + 24));
+	}
+	lanes[0] = v0;
+	lanes[1] = v1;
+	lanes[2] = v2;
+	lanes[3] = v3;
+	return done;
+}
+
+Hash64::Hash64(unsigned long long seed)
+	: mSeed(seed)
+	, mTotal(0)
+	, mPendingLen(0)
+{
+	mLanes[0] = seed + P1 + P2;
+	mLanes[1] = seed + P2;
+	mLanes[2] = seed;
+	mLanes[3] = seed - P1;
+}
+
+void Hash64::Update(const void* data, size_t len)
+{
+	const unsigned char* p = (const unsigned char*)data;
+	mTotal += len;
+
+	if (mPendingLen > 0)
+	{
+		size_t take = 32 - mPendingLen;
+		if (take > len)
+			take = len;
+		::memcpy(mPending + mPendingLen, p, take);
+		mPendingLen += take;
+		p += take;
+		len -= take;
+		if (mPendingLen < 32)
+			return;
+		_stripes(mLanes, mPending, 32);
+		mPendingLen = 0;
+	}
+
+	size_t done = _stripes(mLanes, p, len);
+	::memcpy(mPending, p + done, len - done);
+	mPendingLen = len - done;
+}
+
+unsigned long long Hash64::Digest() const
+{
+	unsigned long long h;
+	if (mTotal >= 32)
+	{
+		h = _rotl(mLanes[0], 1) + _rotl(mLanes[1], 7) + _rotl(mLanes[2], 12) + _rotl(mLanes[3], 18);
+		for (int i = 0; i < 4; ++i)
+			h = _merge_round(h, mLanes[i]);
+	}
+	else
+		h = mSeed + P5;
+	h += mTotal;
+
+	const unsigned char* p = mPending;
+	size_t len = mPendingLen;
+	for (; len >= 8; len -= 8, p += 8)
+	{
+		h ^= _round(0, _read64(p));
+		h = _rotl(h, 27) * P1 + P4;
+	}
+	if (len >= 4)
+	{
+		h ^= _read32(p) * P1;
+		h = _rotl(h, 23) * P2 + P3;
+		len -= 4;
+		p += 4;
+	}
+	for (; len > 0; --len, ++p)
+	{
+		h ^= *p * P5;
+		h = _rotl(h, 11) * P1;
+	}
+
+	h ^= h >> 33;
+	h *= P2;
+	h ^= h >> 29;
+	h *= P3;
+	h ^= h >> 32;
+	return h;
+}
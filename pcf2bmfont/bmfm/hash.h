@@ -0,0 +1,29 @@
+#pragma once
+#include <stddef.h>
+
+namespace bmfm
+{
+
+/*
+   Streaming 64-bit XXH64 hash. Input is consumed 32 bytes at a time
+   by four independent lanes, which keeps the multipliers of a core
+   busy; the result is the same however the input is split into
+   Update() calls.
+*/
+class Hash64
+{
+public:
+	explicit Hash64(unsigned long long seed = 0);
+
+	void Update(const void* data, size_t len);
+	unsigned long long Digest() const;
+
+private:
+	unsigned long long mLanes[4];
+	unsigned long long mSeed;
+	unsigned long long mTotal;
+	unsigned char mPending[32];
+	size_t mPendingLen;
+};
+
+}; // namespace bmfm
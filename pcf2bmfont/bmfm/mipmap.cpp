@@ -0,0 +1,385 @@
+#ifdef USE_VLD
+#  include <vld.h>
+#endif
+
+#include "mipmap.h"
+#include <math.h>
+#include <algorithm>
+
+#if defined(__SSE2__) || defined(_M_X64) || (defined(_M_IX86_FP) && _M_IX86_FP >= 2)
+#  define BMFM_USE_SSE2 1
+#endif
+
+#ifdef BMFM_USE_SSE2
+#  include <emmintrin.h>
+#endif
+
+using namespace bmfm;
+
+// Glyph of each texel of a level, 1 + its index in the rects, 0 for none.
+typedef std::vector<unsigned int> _Labels;
+
+// The source texels and weights of each texel of a smaller level, along one axis.
+struct _Taps
+{
+	unsigned int count; // Taps per texel.
+	std::vector<unsigned int> index; // Clamped to the source, count per texel.
+	std::vector<float> weight;       // Summing up to 1, count per texel.
+};
+
+static const float _pi = 3.14159265358979f;
+
+static float _bessel_i0(float x)
+{
+	float sum = 1.0f;
+	float term = 1.0f;
+	for (int k = 1; k < 20; ++k)
+	{
+		term *= (x * 0.5f) / k;
+		sum += term * term;
+	}
+	return sum;
+}
+
+// Kaiser windowed sinc, t in texels of the smaller level.
+static float _kaiser(float t)
+{
+	const float radius = 1.5f;
+	const float alpha = 4.0f;
+	if (fabsf(t) >= radius)
+		return 0.0f;
+
+	float sinc = (t == 0.0f) ? 1.0f : sinf(_pi * t) / (_pi * t);
+	float r = t / radius;
+	return sinc * _bessel_i0(alpha * sqrtf(1.0f - r * r)) / _bessel_i0(alpha);
+}
+
+static void _make_taps(MipFilter filter, unsigned int src, unsigned int dst, _Taps& taps)
+{
+	if (filter == MipFilter::Box)
+	{
+		taps.count = 2;
+		taps.index.resize((size_t)dst * 2);
+		taps.weight.assign((size_t)dst * 2, 0.5f);
+		for (unsigned int x = 0; x < dst; ++x)
+		{
+			taps.index[x * 2] = std::min(2 * x, src - 1);
+			taps.index[x * 2 + 1] = std::min(2 * x + 1, src - 1);
+		}
+		return;
+	}
+
+	// Texel centers of the source, t apart from the center of x in texels
+	// of the smaller level, get the weight _kaiser(t).
+	const float scale = (float)src / (float)dst;
+	const int reach = (int)ceilf(1.5f * scale);
+	taps.count = (unsigned int)(2 * reach);
+	taps.index.resize((size_t)dst * taps.count);
+	taps.weight.resize((size_t)dst * taps.count);
+	for (unsigned int x = 0; x < dst; ++x)
+	{
+		float center = (x + 0.5f) * scale;
+		int first = (int)floorf(center) - reach;
+		float sum = 0.0f;
+		for (unsigned int k = 0; k < taps.count; ++k)
+		{
+			int i = first + (int)k;
+			float w = _kaiser((i + 0.5f - center) / scale);
+			taps.index[x * taps.count + k] = (unsigned int)std::min(std::max(i, 0), (int)src - 1);
+			taps.weight[x * taps.count + k] = w;
+			sum += w;
+		}
+		for (unsigned int k = 0; k < taps.count; ++k)
+			taps.weight[x * taps.count + k] /= sum;
+	}
+}
+
+static unsigned char _to_byte(float v)
+{
+	if (v <= 0.0f)
+		return 0;
+	if (v >= 255.0f)
+		return 255;
+	return (unsigned char)(v + 0.5f);
+}
+
+// Averages 2x2 texels of rows r0 and r1 into dst texels. Both rows are at
+// least 2 * dst texels long.
+static void _box_row(const unsigned char* r0, const unsigned char* r1, unsigned char* out, unsigned int dst)
+{
+	unsigned int x = 0;
+#ifdef BMFM_USE_SSE2
+	const __m128i low = _mm_set1_epi16(0x00FF);
+	const __m128i two = _mm_set1_epi16(2);
+	for (; x + 16 <= dst; x += 16)
+	{
+		__m128i a0 = _mm_loadu_si128((const __m128i*)&r0[2 * x]);
+		__m128i a1 = _mm_loadu_si128((const __m128i*)&r0[2 * x + 16]);
+		__m128i b0 = _mm_loadu_si128((const __m128i*)&r1[2 * x]);
+		__m128i b1 = _mm_loadu_si128((const __m128i*)&r1[2 * x + 16]);
+		__m128i s0 = _mm_add_epi16(_mm_add_epi16(_mm_and_si128(a0, low), _mm_srli_epi16(a0, 8)),
+			_mm_add_epi16(_mm_and_si128(b0, low), _mm_srli_epi16(b0, 8)));
+		__m128i s1 = _mm_add_epi16(_mm_add_epi16(_mm_and_si128(a1, low), _mm_srli_epi16(a1, 8)),
+			_mm_add_epi16(_mm_and_si128(b1, low), _mm_srli_epi16(b1, 8)));
+		s0 = _mm_srli_epi16(_mm_add_epi16(s0, two), 2);
+		s1 = _mm_srli_epi16(_mm_add_epi16(s1, two), 2);
+		_mm_storeu_si128((__m128i*)&out[x], _mm_packus_epi16(s0, s1));
+	}
+#endif
+	for (; x < dst; ++x)
+		out[x] = (unsigned char)((r0[2 * x] + r0[2 * x + 1] + r1[2 * x] + r1[2 * x + 1] + 2) >> 2);
+}
+
+// Filters level src into dst ignoring glyphs, the separable way.
+static void _filter_unmasked(MipFilter filter, const TextureLevel& src, TextureLevel& dst,
+	const _Taps& tx, const _Taps& ty)
+{
+	if (filter == MipFilter::Box && src.width >= 2 && src.height >= 2)
+	{
+		for (unsigned int y = 0; y < dst.height; ++y)
+			_box_row(&src.plane[(size_t)(2 * y) * src.width], &src.plane[(size_t)(2 * y + 1) * src.width],
+				&dst.plane[(size_t)y * dst.width], dst.width);
+		return;
+	}
+
+	// Rows first, then columns; the column pass runs along contiguous
+	// floats and vectorizes.
+	std::vector<float> rows((size_t)src.height * dst.width);
+	for (unsigned int y = 0; y < src.height; ++y)
+	{
+		const unsigned char* in = &src.plane[(size_t)y * src.width];
+		float* out = &rows[(size_t)y * dst.width];
+		for (unsigned int x = 0; x < dst.width; ++x)
+		{
+			float v = 0.0f;
+			for (unsigned int k = 0; k < tx.count; ++k)
+				v += tx.weight[x * tx.count + k] * in[tx.index[x * tx.count + k]];
+			out[x] = v;
+		}
+	}
+
+	std::vector<float> acc(dst.width);
+	for (unsigned int y = 0; y < dst.height; ++y)
+	{
+		std::fill(acc.begin(), acc.end(), 0.0f);
+		for (unsigned int k = 0; k < ty.count; ++k)
+		{
+			const float w = ty.weight[y * ty.count + k];
+			const float* in = &rows[(size_t)ty.index[y * ty.count + k] * dst.width];
+			for (unsigned int x = 0; x < dst.width; ++x)
+				acc[x] += w * in[x];
+		}
+		unsigned char* out = &dst.plane[(size_t)y * dst.width];
+		for (unsigned int x = 0; x < dst.width; ++x)
+			out[x] = _to_byte(acc[x]);
+	}
+}
+
+// Labels of the smaller level: the glyph covering most of each 2x2
+// footprint, the first one in row order on ties.
+static void _next_labels(const _Labels& src, unsigned int sw, unsigned int sh,
+	_Labels& dst, unsigned int dw, unsigned int dh)
+{
+	dst.resize((size_t)dw * dh);
+	for (unsigned int y = 0; y < dh; ++y)
+	{
+		unsigned int y0 = std::min(2 * y, sh - 1);
+		unsigned int y1 = std::min(2 * y + 1, sh - 1);
+		for (unsigned int x = 0; x < dw; ++x)
+		{
+			unsigned int x0 = std::min(2 * x, sw - 1);
+			unsigned int x1 = std::min(2 * x + 1, sw - 1);
+			const unsigned int cand[4] = {
+				src[(size_t)y0 * sw + x0], src[(size_t)y0 * sw + x1],
+				src[(size_t)y1 * sw + x0], src[(size_t)y1 * sw + x1] };
+
+			unsigned int best = 0;
+			int bestCount = 0;
+			for (int i = 0; i < 4; ++i)
+			{
+				int n = 0;
+				for (int j = 0; j < 4; ++j)
+					n += (cand[i] != 0 && cand[j] == cand[i]) ? 1 : 0;
+				if (n > bestCount)
+				{
+					best = cand[i];
+					bestCount = n;
+				}
+			}
+			dst[(size_t)y * dw + x] = best;
+		}
+	}
+}
+
+// Filters the texels of dst whose taps reach texels of another glyph again,
+// from the texels of their own glyph only.
+static void _filter_masked(const TextureLevel& src, const _Labels& srcLabels,
+	TextureLevel& dst, const _Labels& dstLabels, const _Taps& tx, const _Taps& ty)
+{
+	const unsigned int sw = src.width;
+	std::vector<unsigned int> edgeH(sw + 1), edgeV(sw + 1);
+	for (unsigned int y = 0; y < dst.height; ++y)
+	{
+		const unsigned int* iy = &ty.index[y * ty.count];
+		unsigned int ylo = *std::min_element(iy, iy + ty.count);
+		unsigned int yhi = *std::max_element(iy, iy + ty.count);
+
+		// Prefix counts, per source column, of label changes to the right
+		// in any tap row, and below within the tap rows.
+		edgeH[0] = edgeV[0] = 0;
+		for (unsigned int x = 0; x < sw; ++x)
+		{
+			bool h = false;
+			bool v = false;
+			for (unsigned int r = ylo; r <= yhi; ++r)
+			{
+				const unsigned int* row = &srcLabels[(size_t)r * sw];
+				h = h || (x + 1 < sw && row[x] != row[x + 1]);
+				v = v || (r < yhi && row[x] != row[x + sw]);
+			}
+			edgeH[x + 1] = edgeH[x] + (h ? 1 : 0);
+			edgeV[x + 1] = edgeV[x] + (v ? 1 : 0);
+		}
+
+		for (unsigned int x = 0; x < dst.width; ++x)
+		{
+			const unsigned int* ix = &tx.index[x * tx.count];
+			unsigned int xlo = *std::min_element(ix, ix + tx.count);
+			unsigned int xhi = *std::max_element(ix, ix + tx.count);
+			if (edgeH[xhi] == edgeH[xlo] && edgeV[xhi + 1] == edgeV[xlo])
+				continue;
+
+			const unsigned int label = dstLabels[(size_t)y * dst.width + x];
+			float acc = 0.0f;
+			float sum = 0.0f;
+			for (unsigned int ky = 0; ky < ty.count; ++ky)
+			{
+				size_t row = (size_t)iy[ky] * sw;
+				float wy = ty.weight[y * ty.count + ky];
+				for (unsigned int kx = 0; kx < tx.count; ++kx)
+				{
+					if (srcLabels[row + ix[kx]] != label)
+						continue;
+					float w = wy * tx.weight[x * tx.count + kx];
+					acc += w * src.plane[row + ix[kx]];
+					sum += w;
+				}
+			}
+
+			// Kaiser taps of a glyph sliver can cancel out, box them instead.
+			if (sum < 0.2f)
+			{
+				acc = 0.0f;
+				sum = 0.0f;
+				for (unsigned int ky = 0; ky < 2; ++ky)
+				{
+					unsigned int sy = std::min(2 * y + ky, src.height - 1);
+					for (unsigned int kx = 0; kx < 2; ++kx)
+					{
+						size_t i = (size_t)sy * sw + std::min(2 * x + kx, sw - 1);
+						if (srcLabels[i] == label)
+						{
+							acc += src.plane[i];
+							sum += 1.0f;
+						}
+					}
+				}
+			}
+			dst.plane[(size_t)y * dst.width + x] = _to_byte(acc / sum);
+		}
+	}
+}
+
+// Copies glyph texels over the gutter around them, one ring per step.
+static void _extrude(TextureLevel& level, const _Labels& labels, unsigned int steps)
+{
+	const int w = (int)level.width;
+	const int h = (int)level.height;
+	const int dx[8] = { -1, 1, 0, 0, -1, 1, -1, 1 };
+	const int dy[8] = { 0, 0, -1, 1, -1, -1, 1, 1 };
+
+	// Step at which each texel got its value, 0 for glyph texels.
+	std::vector<unsigned int> step(labels.size());
+	for (size_t i = 0; i < labels.size(); ++i)
+		step[i] = labels[i] ? 0 : ~0u;
+
+	for (unsigned int s = 1; s <= steps; ++s)
+	{
+		bool grown = false;
+		for (int y = 0; y < h; ++y)
+		{
+			for (int x = 0; x < w; ++x)
+			{
+				size_t i = (size_t)y * w + x;
+				if (step[i] < s)
+					continue;
+				for (int n = 0; n < 8; ++n)
+				{
+					int nx = x + dx[n];
+					int ny = y + dy[n];
+					if (nx < 0 || ny < 0 || nx >= w || ny >= h)
+						continue;
+					size_t j = (size_t)ny * w + nx;
+					if (step[j] < s)
+					{
+						level.plane[i] = level.plane[j];
+						step[i] = s;
+						grown = true;
+						break;
+					}
+				}
+			}
+		}
+		if (!grown)
+			break;
+	}
+}
+
+void bmfm::BuildMipChain(std::vector<TextureLevel>& levels, const MipSettings& settings)
+{
+	if (levels.empty() || levels[0].width == 0 || levels[0].height == 0)
+		return;
+	levels.resize(1);
+
+	std::vector<_Labels> labels(1);
+	labels[0].assign((size_t)levels[0].width * levels[0].height, 0);
+	for (size_t r = settings.rects.size(); r-- > 0; )
+	{
+		// Rects are laid down last to first, so the first wins where they overlap.
+		const MipRect& rc = settings.rects[r];
+		unsigned int x1 = std::min(rc.x + rc.width, levels[0].width);
+		unsigned int y1 = std::min(rc.y + rc.height, levels[0].height);
+		for (unsigned int y = rc.y; y < y1; ++y)
+			for (unsigned int x = rc.x; x < x1; ++x)
+				labels[0][(size_t)y * levels[0].width + x] = (unsigned int)r + 1;
+	}
+
+	while (levels.back().width > 1 || levels.back().height > 1)
+	{
+		const unsigned int sw = levels.back().width;
+		const unsigned int sh = levels.back().height;
+		TextureLevel next;
+		next.width = std::max(sw / 2, 1u);
+		next.height = std::max(sh / 2, 1u);
+		next.plane.resize((size_t)next.width * next.height);
+
+		_Taps tx, ty;
+		_make_taps(settings.filter, sw, next.width, tx);
+		_make_taps(settings.filter, sh, next.height, ty);
+
+		_Labels nextLabels;
+		_next_labels(labels.back(), sw, sh, nextLabels, next.width, next.height);
+		_filter_unmasked(settings.filter, levels.back(), next, tx, ty);
+		_filter_masked(levels.back(), labels.back(), next, nextLabels, tx, ty);
+
+		levels.push_back(std::move(next));
+		labels.push_back(std::move(nextLabels));
+	}
+
+	// After the whole chain is built, so extruded texels are not filtered down.
+	if (settings.extrude > 0)
+	{
+		for (size_t i = 0; i < levels.size(); ++i)
+			_extrude(levels[i], labels[i], settings.extrude);
+	}
+}
@@ -0,0 +1,48 @@
+#pragma once
+#include <vector>
+#include "texture.h"
+
+namespace bmfm
+{
+
+enum class MipFilter
+{
+	Box = 0, // Average of the 2x2 texels under each smaller texel.
+	Kaiser,  // Kaiser windowed sinc over 6x6 texels, sharper than Box. Results are clamped.
+};
+
+// A glyph of a page, in level 0 texels.
+struct MipRect
+{
+	unsigned int x;
+	unsigned int y;
+	unsigned int width;
+	unsigned int height;
+};
+
+// How a mip chain is built, see BuildMipChain().
+struct MipSettings
+{
+	MipFilter filter;
+	unsigned int extrude; // Texels of gutter to extrude glyph edges over, on every level.
+	std::vector<MipRect> rects;
+};
+
+/*
+   Builds the mip chain of levels[0], a one channel plane, appending
+   the levels below it down to 1x1. Each level is half the size of the
+   one above, rounded down.
+
+   Filtering respects glyph rects: every texel of a smaller level
+   belongs to the glyph covering most of its 2x2 footprint, or to none,
+   and is filtered from texels of that same glyph only. Glyphs packed
+   next to each other therefore do not bleed into each other. Texels
+   of no glyph are filtered among themselves.
+
+   With extrude, the edge texels of each glyph are then copied over up
+   to that many texels of the gutter around it, on every level including
+   level 0, so bilinear sampling at glyph edges does not pull the gutter in.
+*/
+void BuildMipChain(std::vector<TextureLevel>& levels, const MipSettings& settings);
+
+}; // namespace bmfm
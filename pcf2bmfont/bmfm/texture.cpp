@@ -0,0 +1,345 @@
+#ifdef USE_VLD
+#  include <vld.h>
+#endif
+
+#include "texture.h"
+#include "utils.h"
+#include <atomic>
+#include <thread>
+#include <stdio.h>
+#include <string.h>
+
+using namespace bmfm;
+
+// Palette of a BC4 block, as decoders rebuild it from its two endpoints.
+static void _bc4_palette(unsigned char r0, unsigned char r1, int pal[8])
+{
+	pal[0] = r0;
+	pal[1] = r1;
+	if (r0 > r1)
+	{
+		for (int i = 2; i < 8; ++i)
+			pal[i] = ((8 - i) * r0 + (i - 1) * r1 + 3) / 7;
+	}
+	else
+	{
+		for (int i = 2; i < 6; ++i)
+			pal[i] = ((6 - i) * r0 + (i - 1) * r1 + 2) / 5;
+		pal[6] = 0;
+		pal[7] = 255;
+	}
+}
+
+// Picks the nearest palette entry of each pixel. Returns the squared error.
+static int _bc4_indices(const unsigned char px[16], const int pal[8], unsigned char idx[16])
+{
+	int total = 0;
+	for (int i = 0; i < 16; ++i)
+	{
+		int best = 0;
+		int bestErr = 0x7FFFFFFF;
+		for (int j = 0; j < 8; ++j)
+		{
+			int d = (int)px[i] - pal[j];
+			if (d * d < bestErr)
+			{
+				bestErr = d * d;
+				best = j;
+			}
+		}
+		idx[i] = (unsigned char)best;
+		total += bestErr;
+	}
+	return total;
+}
+
+static void _bc4_encode_block(const unsigned char px[16], unsigned char* out)
+{
+	unsigned char mn = 255, mx = 0;
+	unsigned char inMn = 255, inMx = 0; // Ignoring 0 and 255, which the 6 value mode has for free.
+	for (int i = 0; i < 16; ++i)
+	{
+		if (px[i] < mn) mn = px[i];
+		if (px[i] > mx) mx = px[i];
+		if (px[i] != 0 && px[i] != 255)
+		{
+			if (px[i] < inMn) inMn = px[i];
+			if (px[i] > inMx) inMx = px[i];
+		}
+	}
+
+	unsigned char r0 = mx, r1 = mn;
+	unsigned char idx[16];
+	::memset(idx, 0, sizeof(idx));
+	if (mn != mx)
+	{
+		int pal[8];
+		_bc4_palette(mx, mn, pal);
+		int err = _bc4_indices(px, pal, idx);
+
+		if (err != 0)
+		{
+			if (inMn > inMx)
+				inMn = inMx = 0;
+
+			unsigned char idx6[16];
+			_bc4_palette(inMn, inMx, pal);
+			if (_bc4_indices(px, pal, idx6) < err)
+			{
+				r0 = inMn;
+				r1 = inMx;
+				::memcpy(idx, idx6, sizeof(idx));
+			}
+		}
+	}
+
+	unsigned long long bits = 0;
+	for (int i = 0; i < 16; ++i)
+		bits |= (unsigned long long)idx[i] << (3 * i);
+
+	out[0] = r0;
+	out[1] = r1;
+	for (int i = 0; i < 6; ++i)
+		out[2 + i] = (unsigned char)(bits >> (8 * i));
+}
+
+void bmfm::EncodeBC4(const unsigned char* plane, unsigned int w, unsigned int h,
+	std::vector<unsigned char>& blocks, unsigned int threads)
+{
+	unsigned int bw = (w + 3) / 4;
+	unsigned int bh = (h + 3) / 4;
+	blocks.assign((size_t)bw * bh * 8, 0);
+	if (bw == 0 || bh == 0)
+		return;
+
+	if (threads == 0)
+		threads = std::thread::hardware_concurrency();
+	if (threads == 0)
+		threads = 1;
+	if (threads > bh)
+		threads = bh;
+
+	// Workers take block rows one at a time. Partial blocks at the right
+	// and bottom edges repeat the last column and row of the plane.
+	std::atomic<unsigned int> nextRow(0);
+	auto worker = [&]() {
+		unsigned char px[16];
+		for (unsigned int by = nextRow++; by < bh; by = nextRow++)
+		{
+			unsigned char* out = &blocks[(size_t)by * bw * 8];
+			for (unsigned int bx = 0; bx < bw; ++bx, out += 8)
+			{
+				for (unsigned int y = 0; y < 4; ++y)
+				{
+					unsigned int sy = by * 4 + y;
+					if (sy >= h)
+						sy = h - 1;
+					for (unsigned int x = 0; x < 4; ++x)
+					{
+						unsigned int sx = bx * 4 + x;
+						if (sx >= w)
+							sx = w - 1;
+						px[y * 4 + x] = plane[(size_t)sy * w + sx];
+					}
+				}
+				_bc4_encode_block(px, out);
+			}
+		}
+	};
+
+	std::vector<std::thread> pool;
+	for (unsigned int i = 1; i < threads; ++i)
+		pool.emplace_back(worker);
+	worker();
+	for (auto& t : pool)
+		t.join();
+}
+
+static void _put16(std::vector<unsigned char>& buf, unsigned int v)
+{
+	buf.push_back((unsigned char)v);
+	buf.push_back((unsigned char)(v >> 8));
+}
+
+static void _put32(std::vector<unsigned char>& buf, unsigned int v)
+{
+	_put16(buf, v & 0xFFFF);
+	_put16(buf, v >> 16);
+}
+
+static void _put64(std::vector<unsigned char>& buf, unsigned long long v)
+{
+	_put32(buf, (unsigned int)v);
+	_put32(buf, (unsigned int)(v >> 32));
+}
+
+// Encodes every level, data gets them all one after the other, largest
+// first, and offsets where each one starts.
+static bool _encode(const char* caller, const std::vector<TextureLevel>& levels,
+	TextureFormat format, unsigned int threads, std::vector<unsigned char>& data, std::vector<size_t>& offsets)
+{
+	if (levels.empty() || levels[0].width == 0 || levels[0].height == 0 || levels[0].plane.empty())
+	{
+		logerrfmt("Error: %s: Unable to save an empty texture.", caller);
+		return false;
+	}
+
+	data.clear();
+	offsets.clear();
+	std::vector<unsigned char> blocks;
+	for (const TextureLevel& level : levels)
+	{
+		offsets.push_back(data.size());
+		if (format == TextureFormat::BC4)
+		{
+			EncodeBC4(&level.plane[0], level.width, level.height, blocks, threads);
+			data.insert(data.end(), blocks.begin(), blocks.end());
+		}
+		else
+			data.insert(data.end(), level.plane.begin(), level.plane.end());
+	}
+	offsets.push_back(data.size());
+	return true;
+}
+
+static bool _write_file(const char* caller, const std::string& path,
+	const std::vector<unsigned char>& header, const std::vector<unsigned char>& data)
+{
+	FILE* f = ::fopen(path.c_str(), "wb");
+	if (!f)
+	{
+		logerrfmt("Error: %s: Unable to open file: %s for writing.", caller, path.c_str());
+		return false;
+	}
+
+	bool ok = ::fwrite(&header[0], 1, header.size(), f) == header.size()
+		&& ::fwrite(&data[0], 1, data.size(), f) == data.size();
+	ok = (::fclose(f) == 0) && ok;
+	if (!ok)
+		logerrfmt("Error: %s: Failed on writing file: %s", caller, path.c_str());
+	return ok;
+}
+
+bool bmfm::WriteKTX2(const std::string& path, const std::vector<TextureLevel>& levels, TextureFormat format,
+	unsigned int threads)
+{
+	std::vector<unsigned char> data;
+	std::vector<size_t> offsets;
+	if (!_encode("WriteKTX2()", levels, format, threads, data, offsets))
+		return false;
+
+	const bool bc4 = (format == TextureFormat::BC4);
+	const unsigned int levelCount = (unsigned int)levels.size();
+	const unsigned char identifier[12] = { 0xAB, 'K', 'T', 'X', ' ', '2', '0', 0xBB, '\r', '\n', 0x1A, '\n' };
+	const unsigned int dfdOffset = 80 + 24 * levelCount; // Header and level index.
+	const unsigned int dfdLength = 4 + 24 + 16; // Basic descriptor block with one sample.
+	const size_t levelAlign = bc4 ? 8 : 4;
+
+	// KTX2 stores the levels smallest first, each one aligned.
+	std::vector<size_t> fileOffsets(levelCount);
+	size_t end = dfdOffset + dfdLength;
+	for (unsigned int i = levelCount; i-- > 0; )
+	{
+		fileOffsets[i] = (end + levelAlign - 1) / levelAlign * levelAlign;
+		end = fileOffsets[i] + (offsets[i + 1] - offsets[i]);
+	}
+
+	std::vector<unsigned char> header(identifier, identifier + sizeof(identifier));
+	_put32(header, bc4 ? 139 : 9); // vkFormat: VK_FORMAT_BC4_UNORM_BLOCK or VK_FORMAT_R8_UNORM
+	_put32(header, 1); // typeSize
+	_put32(header, levels[0].width);
+	_put32(header, levels[0].height);
+	_put32(header, 0); // pixelDepth
+	_put32(header, 0); // layerCount
+	_put32(header, 1); // faceCount
+	_put32(header, levelCount);
+	_put32(header, 0); // supercompressionScheme
+
+	_put32(header, dfdOffset);
+	_put32(header, dfdLength);
+	_put32(header, 0); // kvdByteOffset
+	_put32(header, 0); // kvdByteLength
+	_put64(header, 0); // sgdByteOffset
+	_put64(header, 0); // sgdByteLength
+
+	for (unsigned int i = 0; i < levelCount; ++i)
+	{
+		_put64(header, fileOffsets[i]);
+		_put64(header, offsets[i + 1] - offsets[i]);
+		_put64(header, offsets[i + 1] - offsets[i]); // uncompressedByteLength
+	}
+
+	// Data format descriptor (Khronos Data Format 1.3, basic block).
+	_put32(header, dfdLength);
+	_put32(header, 0); // vendorId, descriptorType
+	_put16(header, 2); // versionNumber
+	_put16(header, 24 + 16); // descriptorBlockSize
+	header.push_back(bc4 ? 131 : 1); // colorModel: KHR_DF_MODEL_BC4 or KHR_DF_MODEL_RGBSDA
+	header.push_back(1); // colorPrimaries: BT709
+	header.push_back(1); // transferFunction: linear, glyph coverage is not a color
+	header.push_back(0); // flags: straight alpha
+	header.push_back(bc4 ? 3 : 0); // texelBlockDimension, minus one each
+	header.push_back(bc4 ? 3 : 0);
+	header.push_back(0);
+	header.push_back(0);
+	header.push_back(bc4 ? 8 : 1); // bytesPlane0
+	header.insert(header.end(), 7, 0);
+
+	_put16(header, 0); // bitOffset
+	header.push_back(bc4 ? 63 : 7); // bitLength, minus one
+	header.push_back(0); // channelType: red / data
+	_put32(header, 0); // samplePosition
+	_put32(header, 0); // sampleLower
+	_put32(header, bc4 ? 0xFFFFFFFF : 255); // sampleUpper
+
+	// Lay the levels out after the header, smallest first.
+	std::vector<unsigned char> body;
+	for (unsigned int i = levelCount; i-- > 0; )
+	{
+		body.resize(fileOffsets[i] - header.size(), 0);
+		body.insert(body.end(), data.begin() + offsets[i], data.begin() + offsets[i + 1]);
+	}
+	return _write_file("WriteKTX2()", path, header, body);
+}
+
+bool bmfm::WriteDDS(const std::string& path, const std::vector<TextureLevel>& levels, TextureFormat format,
+	unsigned int threads)
+{
+	std::vector<unsigned char> data;
+	std::vector<size_t> offsets;
+	if (!_encode("WriteDDS()", levels, format, threads, data, offsets))
+		return false;
+
+	const bool bc4 = (format == TextureFormat::BC4);
+	const bool mips = levels.size() > 1;
+	std::vector<unsigned char> header = { 'D', 'D', 'S', ' ' };
+
+	// DDS_HEADER
+	_put32(header, 124); // dwSize
+	_put32(header, 0x1 | 0x2 | 0x4 | 0x1000 | (bc4 ? 0x80000 : 0x8)
+		| (mips ? 0x20000 : 0)); // CAPS|HEIGHT|WIDTH|PIXELFORMAT, LINEARSIZE or PITCH, MIPMAPCOUNT
+	_put32(header, levels[0].height);
+	_put32(header, levels[0].width);
+	_put32(header, bc4 ? (unsigned int)offsets[1] : levels[0].width); // dwPitchOrLinearSize, of level 0
+	_put32(header, 0); // dwDepth
+	_put32(header, mips ? (unsigned int)levels.size() : 0); // dwMipMapCount
+	header.insert(header.end(), 11 * 4, 0); // dwReserved1
+
+	// DDS_PIXELFORMAT, the actual format is in the DX10 header below.
+	_put32(header, 32); // dwSize
+	_put32(header, 0x4); // DDPF_FOURCC
+	header.insert(header.end(), { 'D', 'X', '1', '0' });
+	header.insert(header.end(), 5 * 4, 0); // dwRGBBitCount and masks
+
+	_put32(header, 0x1000 | (mips ? 0x8 | 0x400000 : 0)); // dwCaps: DDSCAPS_TEXTURE, COMPLEX and MIPMAP
+	header.insert(header.end(), 4 * 4, 0); // dwCaps2..4, dwReserved2
+
+	// DDS_HEADER_DXT10
+	_put32(header, bc4 ? 80 : 61); // DXGI_FORMAT_BC4_UNORM or DXGI_FORMAT_R8_UNORM
+	_put32(header, 3); // D3D10_RESOURCE_DIMENSION_TEXTURE2D
+	_put32(header, 0); // miscFlag
+	_put32(header, 1); // arraySize
+	_put32(header, 0); // miscFlags2
+
+	return _write_file("WriteDDS()", path, header, data);
+}
@@ -0,0 +1,39 @@
+#pragma once
+#include <string>
+#include <vector>
+
+namespace bmfm
+{
+
+enum class TextureFormat
+{
+	R8 = 0, // One byte per pixel, uncompressed.
+	BC4,    // 4x4 blocks of 8 bytes, one channel. (a.k.a. ATI1, RGTC1)
+};
+
+// One mip level of a texture, a tightly packed width x height plane of bytes.
+struct TextureLevel
+{
+	unsigned int width;
+	unsigned int height;
+	std::vector<unsigned char> plane;
+};
+
+/*
+   Writers of GPU ready 2D textures. They take one channel of an atlas
+   as its mip levels, largest first (or just level 0), and write them
+   with no further processing needed before upload.
+*/
+
+// Encodes plane into BC4 blocks, row by row of blocks, using up to
+// threads worker threads (0 means one per hardware thread).
+void EncodeBC4(const unsigned char* plane, unsigned int w, unsigned int h,
+	std::vector<unsigned char>& blocks, unsigned int threads = 0);
+
+// BC4 levels are encoded with up to threads worker threads, as EncodeBC4().
+bool WriteKTX2(const std::string& path, const std::vector<TextureLevel>& levels, TextureFormat format,
+	unsigned int threads = 0);
+bool WriteDDS(const std::string& path, const std::vector<TextureLevel>& levels, TextureFormat format,
+	unsigned int threads = 0);
+
+}; // namespace bmfm
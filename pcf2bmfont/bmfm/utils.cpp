@@ -5,8 +5,15 @@
 #include "utils.h"
 #include <stdio.h>
 #include <stdarg.h>
-
-static char _log_buf[4096];
+#include <string>
+#include <stdlib.h>
+#ifdef _WIN32
+#  include <windows.h>
+#else
+#  include <fcntl.h>
+#  include <unistd.h>
+#  include <sys/mman.h>
+#endif
 
 char* bmfm::mmap(const char* path)
 {
@@ -56,6 +63,131 @@ char* bmfm::mmap(const char* path)
 	return buf;
 }
 
+bool bmfm::savefile(const char* path, const void* data, size_t len)
+{
+	std::string tmp = std::string(path) + ".tmp";
+	FILE* f = ::fopen(tmp.c_str(), "wb");
+	if (!f)
+	{
+		logerrfmt("savefile(): Failed on opening file: %s", tmp.c_str());
+		return false;
+	}
+
+	bool ok = ::fwrite(data, 1, len, f) == len;
+	ok = (::fclose(f) == 0) && ok;
+	if (!ok)
+	{
+		logerrfmt("savefile(): I/O error on writing file: %s", tmp.c_str());
+		::remove(tmp.c_str());
+		return false;
+	}
+
+#ifdef _WIN32
+	ok = ::MoveFileExA(tmp.c_str(), path, MOVEFILE_REPLACE_EXISTING | MOVEFILE_WRITE_THROUGH) != 0;
+#else
+	ok = ::rename(tmp.c_str(), path) == 0;
+#endif
+	if (!ok)
+	{
+		logerrfmt("savefile(): Failed on replacing file: %s", path);
+		::remove(tmp.c_str());
+	}
+	return ok;
+}
+
+#ifdef _WIN32
+
+char* bmfm::mapscratch(size_t len)
+{
+	char dir[MAX_PATH + 1];
+	char path[MAX_PATH + 1];
+	if (len == 0 || !::GetTempPathA(sizeof(dir), dir) || !::GetTempFileNameA(dir, "bmf", 0, path))
+	{
+		logerr("mapscratch(): Unable to create a temporary file name.");
+		return nullptr;
+	}
+
+	HANDLE file = ::CreateFileA(path, GENERIC_READ | GENERIC_WRITE, 0, nullptr, CREATE_ALWAYS,
+		FILE_ATTRIBUTE_TEMPORARY | FILE_FLAG_DELETE_ON_CLOSE, nullptr);
+	if (file == INVALID_HANDLE_VALUE)
+	{
+		logerrfmt("mapscratch(): Failed on creating file: %s", path);
+		return nullptr;
+	}
+
+	// Best effort, without it the file takes its whole size on disk.
+	DWORD unused = 0;
+	::DeviceIoControl(file, FSCTL_SET_SPARSE, nullptr, 0, nullptr, 0, &unused, nullptr);
+
+	char* p = nullptr;
+	HANDLE mapping = ::CreateFileMappingA(file, nullptr, PAGE_READWRITE,
+		(DWORD)((unsigned long long)len >> 32), (DWORD)len, nullptr);
+	if (mapping)
+	{
+		p = (char*)::MapViewOfFile(mapping, FILE_MAP_ALL_ACCESS, 0, 0, len);
+		::CloseHandle(mapping);
+	}
+	// The view keeps the file open, it is deleted when the view goes.
+	::CloseHandle(file);
+	if (!p)
+		logerrfmt("mapscratch(): Failed on mapping %zu bytes of file: %s", len, path);
+	return p;
+}
+
+void bmfm::unmapscratch(char* p, size_t len)
+{
+	(void)len;
+	if (p)
+		::UnmapViewOfFile(p);
+}
+
+void bmfm::mapadvise(char* p, size_t len, bool sequential)
+{
+	(void)p;
+	(void)len;
+	(void)sequential;
+}
+
+#else
+
+char* bmfm::mapscratch(size_t len)
+{
+	const char* dir = ::getenv("TMPDIR");
+	std::string path = std::string((dir && *dir) ? dir : "/tmp") + "/bmfm-XXXXXX";
+	int fd = len ? ::mkstemp(&path[0]) : -1;
+	if (fd < 0)
+	{
+		logerrfmt("mapscratch(): Failed on creating a file like: %s", path.c_str());
+		return nullptr;
+	}
+
+	// Unlinked right away, the mapping keeps the file until it is unmapped.
+	::unlink(path.c_str());
+	void* p = MAP_FAILED;
+	if (::ftruncate(fd, (off_t)len) == 0)
+		p = ::mmap(nullptr, len, PROT_READ | PROT_WRITE, MAP_SHARED, fd, 0);
+	::close(fd);
+	if (p == MAP_FAILED)
+	{
+		logerrfmt("mapscratch(): Failed on mapping %zu bytes of file: %s", len, path.c_str());
+		return nullptr;
+	}
+	return (char*)p;
+}
+
+void bmfm::unmapscratch(char* p, size_t len)
+{
+	if (p)
+		::munmap(p, len);
+}
+
+void bmfm::mapadvise(char* p, size_t len, bool sequential)
+{
+	::madvise(p, len, sequential ? MADV_SEQUENTIAL : MADV_NORMAL);
+}
+
+#endif
+
 void bmfm::log(const char* msg)
 {
 	if (msg)
@@ -64,11 +196,13 @@ void bmfm::log(const char* msg)
 
 void bmfm::logfmt(const char* fmt, ...)
 {
+	// Local, as pages are saved and logged from several threads at once.
+	char buf[4096];
 	va_list valist;
 	va_start(valist, fmt);
-	int len = vsnprintf(_log_buf, 4096, fmt, valist);
+	int len = vsnprintf(buf, sizeof(buf), fmt, valist);
 	if (len>0)
-		printf("%s\n", _log_buf);
+		printf("%s\n", buf);
 	va_end(valist);
 }
 
@@ -80,11 +214,12 @@ void bmfm::logerr(const char* msg)
 
 void bmfm::logerrfmt(const char* fmt, ...)
 {
+	char buf[4096];
 	va_list valist;
 	va_start(valist, fmt);
-	int len = vsnprintf(_log_buf, 4096, fmt, valist);
+	int len = vsnprintf(buf, sizeof(buf), fmt, valist);
 	if (len>0)
-		fprintf(stderr, "%s\n", _log_buf);
+		fprintf(stderr, "%s\n", buf);
 	va_end(valist);
 }
 
@@ -1,4 +1,5 @@
 #pragma once
+#include <stddef.h>
 
 namespace bmfm
 {
@@ -10,6 +11,25 @@ namespace bmfm
 */
 char* mmap(const char* path);
 
+/*
+   Write len bytes of data as the file at path. They go to a
+   temporary file next to it first, which then replaces path, so
+   readers of path see either the old file or the complete new one.
+*/
+bool savefile(const char* path, const void* data, size_t len);
+
+/*
+   Map len bytes of a new scratch file, zero filled. The file is sparse,
+   lives in the temp directory (TMPDIR, or TEMP on Windows) and is gone
+   once unmapped, it only gives the kernel a place to page the memory
+   out to. Returns nullptr on failure. Unmap with unmapscratch().
+*/
+char* mapscratch(size_t len);
+void unmapscratch(char* p, size_t len);
+
+// Hint that mapped memory is about to be read front to back, or not anymore.
+void mapadvise(char* p, size_t len, bool sequential);
+
 void log(const char* msg);
 void logfmt(const char* fmt, ...);
 void logerr(const char* msg);
@@ -0,0 +1,227 @@
+/* filter_avx2_intrinsics.c - AVX2 optimized filter functions
+ *
+ * This code is released under the libpng license.
+ * For conditions of distribution and use, see the disclaimer
+ * and license in png.h
+ *
+ * These are only called once png_intel_avx2_supported() said so.  The
+ * SSE2 versions in filter_sse2_intrinsics.c explain how they work; these
+ * do 32 bytes at a time instead of 16.
+ */
+
+#include "pngpriv.h"
+
+#if PNG_INTEL_SSE_IMPLEMENTATION > 0
+
+#include <immintrin.h>
+
+/* gcc and clang only allow AVX2 intrinsics in functions built for AVX2. */
+#if defined(__GNUC__) || defined(__clang__)
+#  define PNG_AVX2_TARGET __attribute__((target("avx2")))
+#else
+#  define PNG_AVX2_TARGET
+#endif
+
+#ifdef PNG_READ_SUPPORTED
+PNG_AVX2_TARGET
+void png_read_filter_row_up_avx2(png_row_infop row_info, png_bytep row,
+    png_const_bytep prev)
+{
+   size_t n = row_info->rowbytes;
+   size_t i = 0;
+
+   png_debug(1, "in png_read_filter_row_up_avx2");
+
+   for (; i + 32 <= n; i += 32)
+   {
+      __m256i x = _mm256_loadu_si256((const __m256i*)(row + i));
+      __m256i b = _mm256_loadu_si256((const __m256i*)(prev + i));
+      _mm256_storeu_si256((__m256i*)(row + i), _mm256_add_epi8(x, b));
+   }
+
+   for (; i < n; i++)
+      row[i] = (png_byte)(row[i] + prev[i]);
+}
+#endif /* READ */
+
+#ifdef PNG_WRITE_FILTER_SUPPORTED
+PNG_AVX2_TARGET
+static __m256i
+avg_floor(__m256i a, __m256i b)
+{
+   __m256i odd = _mm256_and_si256(_mm256_xor_si256(a, b),
+       _mm256_set1_epi8(1));
+   return _mm256_sub_epi8(_mm256_avg_epu8(a, b), odd);
+}
+
+PNG_AVX2_TARGET
+static __m256i
+if_then_else(__m256i c, __m256i t, __m256i e)
+{
+   return _mm256_blendv_epi8(e, t, c);
+}
+
+PNG_AVX2_TARGET
+static __m256i
+paeth_i16(__m256i a, __m256i b, __m256i c)
+{
+   __m256i pa = _mm256_sub_epi16(b, c);
+   __m256i pb = _mm256_sub_epi16(a, c);
+   __m256i pc = _mm256_abs_epi16(_mm256_add_epi16(pa, pb));
+   __m256i smallest;
+   __m256i nearest;
+
+   pa = _mm256_abs_epi16(pa);
+   pb = _mm256_abs_epi16(pb);
+   smallest = _mm256_min_epi16(pc, _mm256_min_epi16(pa, pb));
+
+   nearest = if_then_else(_mm256_cmpeq_epi16(pb, smallest), b, c);
+   return if_then_else(_mm256_cmpeq_epi16(pa, smallest), a, nearest);
+}
+
+/* Paeth predictors of the 16 bytes at a, b and c. */
+PNG_AVX2_TARGET
+static __m128i
+paeth16(png_const_bytep a, png_const_bytep b, png_const_bytep c)
+{
+   __m256i p = paeth_i16(
+       _mm256_cvtepu8_epi16(_mm_loadu_si128((const __m128i*)a)),
+       _mm256_cvtepu8_epi16(_mm_loadu_si128((const __m128i*)b)),
+       _mm256_cvtepu8_epi16(_mm_loadu_si128((const __m128i*)c)));
+   return _mm_packus_epi16(_mm256_castsi256_si128(p),
+       _mm256_extracti128_si256(p, 1));
+}
+
+PNG_AVX2_TARGET
+static __m256i
+score_avx2(__m256i v)
+{
+   __m256i zero = _mm256_setzero_si256();
+   return _mm256_sad_epu8(_mm256_min_epu8(v, _mm256_sub_epi8(zero, v)), zero);
+}
+
+PNG_AVX2_TARGET
+static size_t
+hsum_avx2(__m256i acc)
+{
+   __m128i sum = _mm_add_epi64(_mm256_castsi256_si128(acc),
+       _mm256_extracti128_si256(acc, 1));
+   sum = _mm_add_epi64(sum, _mm_srli_si128(sum, 8));
+#if defined(_M_X64) || defined(__x86_64__)
+   return (size_t)_mm_cvtsi128_si64(sum);
+#else
+   return (size_t)(png_uint_32)_mm_cvtsi128_si32(sum);
+#endif
+}
+
+PNG_AVX2_TARGET
+size_t png_write_filter_row_none_avx2(png_bytep out, png_const_bytep row,
+    png_const_bytep prev, size_t row_bytes, unsigned int bpp)
+{
+   __m256i acc = _mm256_setzero_si256();
+   size_t i = 0;
+
+   PNG_UNUSED(out)
+   PNG_UNUSED(prev)
+
+   for (; i + 32 <= row_bytes; i += 32)
+      acc = _mm256_add_epi64(acc,
+          score_avx2(_mm256_loadu_si256((const __m256i*)(row + i))));
+
+   return hsum_avx2(acc) + png_write_filter_bytes(PNG_FILTER_VALUE_NONE,
+       NULL, row, NULL, i, row_bytes, bpp);
+}
+
+PNG_AVX2_TARGET
+size_t png_write_filter_row_sub_avx2(png_bytep out, png_const_bytep row,
+    png_const_bytep prev, size_t row_bytes, unsigned int bpp)
+{
+   __m256i acc = _mm256_setzero_si256();
+   size_t i = bpp < row_bytes ? bpp : row_bytes;
+   size_t sum = png_write_filter_bytes(PNG_FILTER_VALUE_SUB, out, row, prev,
+       0, i, bpp);
+
+   for (; i + 32 <= row_bytes; i += 32)
+   {
+      __m256i x = _mm256_loadu_si256((const __m256i*)(row + i));
+      __m256i a = _mm256_loadu_si256((const __m256i*)(row + i - bpp));
+      __m256i d = _mm256_sub_epi8(x, a);
+      _mm256_storeu_si256((__m256i*)(out + i), d);
+      acc = _mm256_add_epi64(acc, score_avx2(d));
+   }
+
+   return sum + hsum_avx2(acc) + png_write_filter_bytes(PNG_FILTER_VALUE_SUB,
+       out, row, prev, i, row_bytes, bpp);
+}
+
+PNG_AVX2_TARGET
+size_t png_write_filter_row_up_avx2(png_bytep out, png_const_bytep row,
+    png_const_bytep prev, size_t row_bytes, unsigned int bpp)
+{
+   __m256i acc = _mm256_setzero_si256();
+   size_t i = 0;
+
+   for (; i + 32 <= row_bytes; i += 32)
+   {
+      __m256i x = _mm256_loadu_si256((const __m256i*)(row + i));
+      __m256i b = _mm256_loadu_si256((const __m256i*)(prev + i));
+      __m256i d = _mm256_sub_epi8(x, b);
+      _mm256_storeu_si256((__m256i*)(out + i), d);
+      acc = _mm256_add_epi64(acc, score_avx2(d));
+   }
+
+   return hsum_avx2(acc) + png_write_filter_bytes(PNG_FILTER_VALUE_UP,
+       out, row, prev, i, row_bytes, bpp);
+}
+
+PNG_AVX2_TARGET
+size_t png_write_filter_row_avg_avx2(png_bytep out, png_const_bytep row,
+    png_const_bytep prev, size_t row_bytes, unsigned int bpp)
+{
+   __m256i acc = _mm256_setzero_si256();
+   size_t i = bpp < row_bytes ? bpp : row_bytes;
+   size_t sum = png_write_filter_bytes(PNG_FILTER_VALUE_AVG, out, row, prev,
+       0, i, bpp);
+
+   for (; i + 32 <= row_bytes; i += 32)
+   {
+      __m256i x = _mm256_loadu_si256((const __m256i*)(row + i));
+      __m256i a = _mm256_loadu_si256((const __m256i*)(row + i - bpp));
+      __m256i b = _mm256_loadu_si256((const __m256i*)(prev + i));
+      __m256i d = _mm256_sub_epi8(x, avg_floor(a, b));
+      _mm256_storeu_si256((__m256i*)(out + i), d);
+      acc = _mm256_add_epi64(acc, score_avx2(d));
+   }
+
+   return sum + hsum_avx2(acc) + png_write_filter_bytes(PNG_FILTER_VALUE_AVG,
+       out, row, prev, i, row_bytes, bpp);
+}
+
+PNG_AVX2_TARGET
+size_t png_write_filter_row_paeth_avx2(png_bytep out, png_const_bytep row,
+    png_const_bytep prev, size_t row_bytes, unsigned int bpp)
+{
+   __m256i acc = _mm256_setzero_si256();
+   size_t i = bpp < row_bytes ? bpp : row_bytes;
+   size_t sum = png_write_filter_bytes(PNG_FILTER_VALUE_PAETH, out, row, prev,
+       0, i, bpp);
+
+   for (; i + 32 <= row_bytes; i += 32)
+   {
+      __m128i lo = paeth16(row + i - bpp, prev + i, prev + i - bpp);
+      __m128i hi = paeth16(row + i + 16 - bpp, prev + i + 16,
+          prev + i + 16 - bpp);
+      __m256i x = _mm256_loadu_si256((const __m256i*)(row + i));
+      __m256i d = _mm256_sub_epi8(x,
+          _mm256_inserti128_si256(_mm256_castsi128_si256(lo), hi, 1));
+      _mm256_storeu_si256((__m256i*)(out + i), d);
+      acc = _mm256_add_epi64(acc, score_avx2(d));
+   }
+
+   return sum + hsum_avx2(acc) +
+       png_write_filter_bytes(PNG_FILTER_VALUE_PAETH, out, row, prev, i,
+       row_bytes, bpp);
+}
+#endif /* WRITE_FILTER */
+
+#endif /* PNG_INTEL_SSE_IMPLEMENTATION > 0 */
@@ -0,0 +1,514 @@
+/* filter_sse2_intrinsics.c - SSE2 optimized filter functions
+ *
+ * This code is released under the libpng license.
+ * For conditions of distribution and use, see the disclaimer
+ * and license in png.h
+ */
+
+#include "pngpriv.h"
+
+#if PNG_INTEL_SSE_IMPLEMENTATION > 0
+
+#include <emmintrin.h>
+#include <string.h>
+
+/* Pixels of 3 and 4 bytes are moved in and out of the low 32 bits of a
+ * register with memcpy, which makes no alignment assumption and compiles
+ * to a plain load or store.  load3 never reads past the pixel, so the last
+ * pixel of a row can be read safely.
+ */
+static __m128i
+load4(const void *p)
+{
+   int tmp;
+   memcpy(&tmp, p, sizeof(tmp));
+   return _mm_cvtsi32_si128(tmp);
+}
+
+static void
+store4(void *p, __m128i v)
+{
+   int tmp = _mm_cvtsi128_si32(v);
+   memcpy(p, &tmp, sizeof(tmp));
+}
+
+static __m128i
+load3(const void *p)
+{
+   png_uint_32 tmp = 0;
+   memcpy(&tmp, p, 3);
+   return _mm_cvtsi32_si128((int)tmp);
+}
+
+static void
+store3(void *p, __m128i v)
+{
+   int tmp = _mm_cvtsi128_si32(v);
+   memcpy(p, &tmp, 3);
+}
+
+/* Floor of (a + b) / 2 of each unsigned byte; _mm_avg_epu8 rounds up. */
+static __m128i
+avg_floor(__m128i a, __m128i b)
+{
+   __m128i odd = _mm_and_si128(_mm_xor_si128(a, b), _mm_set1_epi8(1));
+   return _mm_sub_epi8(_mm_avg_epu8(a, b), odd);
+}
+
+static __m128i
+if_then_else(__m128i c, __m128i t, __m128i e)
+{
+   return _mm_or_si128(_mm_and_si128(c, t), _mm_andnot_si128(c, e));
+}
+
+static __m128i
+abs_i16(__m128i x)
+{
+   return _mm_max_epi16(x, _mm_sub_epi16(_mm_setzero_si128(), x));
+}
+
+/* The Paeth predictor of 16 bit lanes holding bytes a (left), b (above)
+ * and c (above left), the same choice as png_read_filter_row_paeth_*.
+ */
+static __m128i
+paeth_i16(__m128i a, __m128i b, __m128i c)
+{
+   __m128i pa = _mm_sub_epi16(b, c);
+   __m128i pb = _mm_sub_epi16(a, c);
+   __m128i pc = abs_i16(_mm_add_epi16(pa, pb));
+   __m128i smallest;
+   __m128i nearest;
+
+   pa = abs_i16(pa);
+   pb = abs_i16(pb);
+   smallest = _mm_min_epi16(pc, _mm_min_epi16(pa, pb));
+
+   nearest = if_then_else(_mm_cmpeq_epi16(pb, smallest), b, c);
+   return if_then_else(_mm_cmpeq_epi16(pa, smallest), a, nearest);
+}
+
+#ifdef PNG_READ_SUPPORTED
+void png_read_filter_row_up_sse2(png_row_infop row_info, png_bytep row,
+    png_const_bytep prev)
+{
+   size_t n = row_info->rowbytes;
+   size_t i = 0;
+
+   png_debug(1, "in png_read_filter_row_up_sse2");
+
+   for (; i + 16 <= n; i += 16)
+   {
+      __m128i x = _mm_loadu_si128((const __m128i*)(row + i));
+      __m128i b = _mm_loadu_si128((const __m128i*)(prev + i));
+      _mm_storeu_si128((__m128i*)(row + i), _mm_add_epi8(x, b));
+   }
+
+   for (; i < n; i++)
+      row[i] = (png_byte)(row[i] + prev[i]);
+}
+
+void png_read_filter_row_sub3_sse2(png_row_infop row_info, png_bytep row,
+    png_const_bytep prev)
+{
+   /* The byte past each pixel is garbage in a, it only ever meets other
+    * garbage and is never stored.
+    */
+   size_t rb = row_info->rowbytes;
+   __m128i a = _mm_setzero_si128();
+
+   png_debug(1, "in png_read_filter_row_sub3_sse2");
+
+   PNG_UNUSED(prev)
+
+   while (rb >= 4)
+   {
+      a = _mm_add_epi8(a, load4(row));
+      store3(row, a);
+      row += 3;
+      rb -= 3;
+   }
+
+   if (rb > 0)
+   {
+      a = _mm_add_epi8(a, load3(row));
+      store3(row, a);
+   }
+}
+
+void png_read_filter_row_sub4_sse2(png_row_infop row_info, png_bytep row,
+    png_const_bytep prev)
+{
+   /* Four pixels at a time: a prefix sum of the pixels in the register,
+    * plus the last pixel of the previous four in every lane.
+    */
+   size_t rb = row_info->rowbytes;
+   __m128i a = _mm_setzero_si128();
+
+   png_debug(1, "in png_read_filter_row_sub4_sse2");
+
+   PNG_UNUSED(prev)
+
+   while (rb >= 16)
+   {
+      __m128i x = _mm_loadu_si128((const __m128i*)row);
+      x = _mm_add_epi8(x, _mm_slli_si128(x, 4));
+      x = _mm_add_epi8(x, _mm_slli_si128(x, 8));
+      x = _mm_add_epi8(x, a);
+      _mm_storeu_si128((__m128i*)row, x);
+      a = _mm_shuffle_epi32(x, _MM_SHUFFLE(3, 3, 3, 3));
+      row += 16;
+      rb -= 16;
+   }
+
+   while (rb > 0)
+   {
+      a = _mm_add_epi8(a, load4(row));
+      store4(row, a);
+      row += 4;
+      rb -= 4;
+   }
+}
+
+void png_read_filter_row_avg3_sse2(png_row_infop row_info, png_bytep row,
+    png_const_bytep prev)
+{
+   size_t rb = row_info->rowbytes;
+   __m128i a = _mm_setzero_si128();
+
+   png_debug(1, "in png_read_filter_row_avg3_sse2");
+
+   while (rb >= 4)
+   {
+      __m128i b = load4(prev);
+      a = _mm_add_epi8(load4(row), avg_floor(a, b));
+      store3(row, a);
+      row += 3;
+      prev += 3;
+      rb -= 3;
+   }
+
+   if (rb > 0)
+   {
+      __m128i b = load3(prev);
+      a = _mm_add_epi8(load3(row), avg_floor(a, b));
+      store3(row, a);
+   }
+}
+
+void png_read_filter_row_avg4_sse2(png_row_infop row_info, png_bytep row,
+    png_const_bytep prev)
+{
+   size_t rb = row_info->rowbytes;
+   __m128i a = _mm_setzero_si128();
+
+   png_debug(1, "in png_read_filter_row_avg4_sse2");
+
+   while (rb > 0)
+   {
+      __m128i b = load4(prev);
+      a = _mm_add_epi8(load4(row), avg_floor(a, b));
+      store4(row, a);
+      row += 4;
+      prev += 4;
+      rb -= 4;
+   }
+}
+
+void png_read_filter_row_paeth3_sse2(png_row_infop row_info, png_bytep row,
+    png_const_bytep prev)
+{
+   /* a, b and c hold one pixel, widened to 16 bit lanes. */
+   size_t rb = row_info->rowbytes;
+   const __m128i zero = _mm_setzero_si128();
+   __m128i a = zero;
+   __m128i c = zero;
+
+   png_debug(1, "in png_read_filter_row_paeth3_sse2");
+
+   while (rb >= 4)
+   {
+      __m128i b = _mm_unpacklo_epi8(load4(prev), zero);
+      __m128i x = _mm_add_epi8(load4(row),
+          _mm_packus_epi16(paeth_i16(a, b, c), zero));
+      store3(row, x);
+      a = _mm_unpacklo_epi8(x, zero);
+      c = b;
+      row += 3;
+      prev += 3;
+      rb -= 3;
+   }
+
+   if (rb > 0)
+   {
+      __m128i b = _mm_unpacklo_epi8(load3(prev), zero);
+      __m128i x = _mm_add_epi8(load3(row),
+          _mm_packus_epi16(paeth_i16(a, b, c), zero));
+      store3(row, x);
+   }
+}
+
+/* One pixel of Paeth, with a, b and c in the low 32 bits. Returns the new
+ * left pixel.
+ */
+static __m128i
+paeth4_pixel(png_bytep row, __m128i a, __m128i b, __m128i c)
+{
+   const __m128i zero = _mm_setzero_si128();
+   __m128i p = paeth_i16(_mm_unpacklo_epi8(a, zero),
+       _mm_unpacklo_epi8(b, zero), _mm_unpacklo_epi8(c, zero));
+   __m128i x = _mm_add_epi8(load4(row), _mm_packus_epi16(p, zero));
+   store4(row, x);
+   return x;
+}
+
+void png_read_filter_row_paeth4_sse2(png_row_infop row_info, png_bytep row,
+    png_const_bytep prev)
+{
+   /* Where the previous row repeats its pixels, b equals c, so the Paeth
+    * predictor is a and four pixels at once are done the way Sub does them.
+    * Empty areas of the image look like that and are where most pixels of
+    * glyph atlases are.
+    */
+   size_t rb = row_info->rowbytes;
+   __m128i a = _mm_setzero_si128();
+   __m128i c = _mm_setzero_si128();
+
+   png_debug(1, "in png_read_filter_row_paeth4_sse2");
+
+   while (rb >= 16)
+   {
+      __m128i b4 = _mm_loadu_si128((const __m128i*)prev);
+      __m128i c4 = _mm_or_si128(_mm_slli_si128(b4, 4), c);
+
+      if (_mm_movemask_epi8(_mm_cmpeq_epi8(b4, c4)) == 0xFFFF)
+      {
+         __m128i x = _mm_loadu_si128((const __m128i*)row);
+         x = _mm_add_epi8(x, _mm_slli_si128(x, 4));
+         x = _mm_add_epi8(x, _mm_slli_si128(x, 8));
+         x = _mm_add_epi8(x, _mm_shuffle_epi32(a, _MM_SHUFFLE(0, 0, 0, 0)));
+         _mm_storeu_si128((__m128i*)row, x);
+         a = _mm_srli_si128(x, 12);
+      }
+      else
+      {
+         a = paeth4_pixel(row, a, b4, c);
+         a = paeth4_pixel(row + 4, a, _mm_srli_si128(b4, 4), b4);
+         a = paeth4_pixel(row + 8, a, _mm_srli_si128(b4, 8),
+             _mm_srli_si128(b4, 4));
+         a = paeth4_pixel(row + 12, a, _mm_srli_si128(b4, 12),
+             _mm_srli_si128(b4, 8));
+      }
+
+      c = _mm_srli_si128(b4, 12);
+      row += 16;
+      prev += 16;
+      rb -= 16;
+   }
+
+   while (rb > 0)
+   {
+      __m128i b = load4(prev);
+      a = paeth4_pixel(row, a, b, c);
+      c = b;
+      row += 4;
+      prev += 4;
+      rb -= 4;
+   }
+}
+#endif /* READ */
+
+#ifdef PNG_WRITE_FILTER_SUPPORTED
+/* Writing: out[i] = row[i] - predictor, where the predictor only depends on
+ * the unfiltered rows, so any number of bytes are done at once.  The first
+ * bpp bytes have no left neighbours and, as the tail of the row, are done
+ * byte by byte.  The score is the sum of the filtered bytes taken as signed
+ * absolute values, v or 256 - v, the same as png_write_find_filter() sums.
+ */
+static size_t
+score_byte(unsigned int v)
+{
+   return (v < 128) ? v : 256 - v;
+}
+
+static int
+paeth_byte(int a, int b, int c)
+{
+   int pa = b - c;
+   int pb = a - c;
+   int pc = pa + pb;
+
+   pa = pa < 0 ? -pa : pa;
+   pb = pb < 0 ? -pb : pb;
+   pc = pc < 0 ? -pc : pc;
+   return (pa <= pb && pa <= pc) ? a : (pb <= pc) ? b : c;
+}
+
+/* Predictor of byte i, for the scalar head and tail. */
+static png_byte
+predict_byte(int filter, png_const_bytep row, png_const_bytep prev,
+    size_t i, unsigned int bpp)
+{
+   int a = i >= bpp ? row[i - bpp] : 0;
+   int b = prev != NULL ? prev[i] : 0;
+   int c = (prev != NULL && i >= bpp) ? prev[i - bpp] : 0;
+
+   switch (filter)
+   {
+      case PNG_FILTER_VALUE_SUB:
+         return (png_byte)a;
+      case PNG_FILTER_VALUE_UP:
+         return (png_byte)b;
+      case PNG_FILTER_VALUE_AVG:
+         return (png_byte)((a + b) >> 1);
+      case PNG_FILTER_VALUE_PAETH:
+         return (png_byte)paeth_byte(a, b, c);
+      default:
+         return 0;
+   }
+}
+
+size_t /* PRIVATE */
+png_write_filter_bytes(int filter, png_bytep out, png_const_bytep row,
+    png_const_bytep prev, size_t from, size_t to, unsigned int bpp)
+{
+   size_t sum = 0;
+   size_t i;
+
+   for (i = from; i < to; i++)
+   {
+      png_byte v = (png_byte)(row[i] - predict_byte(filter, row, prev, i, bpp));
+      if (out != NULL)
+         out[i] = v;
+      sum += score_byte(v);
+   }
+   return sum;
+}
+
+static __m128i
+score_sse2(__m128i v)
+{
+   __m128i zero = _mm_setzero_si128();
+   return _mm_sad_epu8(_mm_min_epu8(v, _mm_sub_epi8(zero, v)), zero);
+}
+
+static size_t
+hsum_sse2(__m128i acc)
+{
+   acc = _mm_add_epi64(acc, _mm_srli_si128(acc, 8));
+#if defined(_M_X64) || defined(__x86_64__)
+   return (size_t)_mm_cvtsi128_si64(acc);
+#else
+   return (size_t)(png_uint_32)_mm_cvtsi128_si32(acc);
+#endif
+}
+
+size_t png_write_filter_row_none_sse2(png_bytep out, png_const_bytep row,
+    png_const_bytep prev, size_t row_bytes, unsigned int bpp)
+{
+   __m128i acc = _mm_setzero_si128();
+   size_t i = 0;
+
+   PNG_UNUSED(out)
+   PNG_UNUSED(prev)
+
+   for (; i + 16 <= row_bytes; i += 16)
+      acc = _mm_add_epi64(acc,
+          score_sse2(_mm_loadu_si128((const __m128i*)(row + i))));
+
+   return hsum_sse2(acc) + png_write_filter_bytes(PNG_FILTER_VALUE_NONE,
+       NULL, row, NULL, i, row_bytes, bpp);
+}
+
+size_t png_write_filter_row_sub_sse2(png_bytep out, png_const_bytep row,
+    png_const_bytep prev, size_t row_bytes, unsigned int bpp)
+{
+   __m128i acc = _mm_setzero_si128();
+   size_t i = bpp < row_bytes ? bpp : row_bytes;
+   size_t sum = png_write_filter_bytes(PNG_FILTER_VALUE_SUB, out, row, prev,
+       0, i, bpp);
+
+   for (; i + 16 <= row_bytes; i += 16)
+   {
+      __m128i x = _mm_loadu_si128((const __m128i*)(row + i));
+      __m128i a = _mm_loadu_si128((const __m128i*)(row + i - bpp));
+      __m128i d = _mm_sub_epi8(x, a);
+      _mm_storeu_si128((__m128i*)(out + i), d);
+      acc = _mm_add_epi64(acc, score_sse2(d));
+   }
+
+   return sum + hsum_sse2(acc) + png_write_filter_bytes(PNG_FILTER_VALUE_SUB,
+       out, row, prev, i, row_bytes, bpp);
+}
+
+size_t png_write_filter_row_up_sse2(png_bytep out, png_const_bytep row,
+    png_const_bytep prev, size_t row_bytes, unsigned int bpp)
+{
+   __m128i acc = _mm_setzero_si128();
+   size_t i = 0;
+
+   for (; i + 16 <= row_bytes; i += 16)
+   {
+      __m128i x = _mm_loadu_si128((const __m128i*)(row + i));
+      __m128i b = _mm_loadu_si128((const __m128i*)(prev + i));
+      __m128i d = _mm_sub_epi8(x, b);
+      _mm_storeu_si128((__m128i*)(out + i), d);
+      acc = _mm_add_epi64(acc, score_sse2(d));
+   }
+
+   return hsum_sse2(acc) + png_write_filter_bytes(PNG_FILTER_VALUE_UP,
+       out, row, prev, i, row_bytes, bpp);
+}
+
+size_t png_write_filter_row_avg_sse2(png_bytep out, png_const_bytep row,
+    png_const_bytep prev, size_t row_bytes, unsigned int bpp)
+{
+   __m128i acc = _mm_setzero_si128();
+   size_t i = bpp < row_bytes ? bpp : row_bytes;
+   size_t sum = png_write_filter_bytes(PNG_FILTER_VALUE_AVG, out, row, prev,
+       0, i, bpp);
+
+   for (; i + 16 <= row_bytes; i += 16)
+   {
+      __m128i x = _mm_loadu_si128((const __m128i*)(row + i));
+      __m128i a = _mm_loadu_si128((const __m128i*)(row + i - bpp));
+      __m128i b = _mm_loadu_si128((const __m128i*)(prev + i));
+      __m128i d = _mm_sub_epi8(x, avg_floor(a, b));
+      _mm_storeu_si128((__m128i*)(out + i), d);
+      acc = _mm_add_epi64(acc, score_sse2(d));
+   }
+
+   return sum + hsum_sse2(acc) + png_write_filter_bytes(PNG_FILTER_VALUE_AVG,
+       out, row, prev, i, row_bytes, bpp);
+}
+
+size_t png_write_filter_row_paeth_sse2(png_bytep out, png_const_bytep row,
+    png_const_bytep prev, size_t row_bytes, unsigned int bpp)
+{
+   const __m128i zero = _mm_setzero_si128();
+   __m128i acc = zero;
+   size_t i = bpp < row_bytes ? bpp : row_bytes;
+   size_t sum = png_write_filter_bytes(PNG_FILTER_VALUE_PAETH, out, row, prev,
+       0, i, bpp);
+
+   for (; i + 16 <= row_bytes; i += 16)
+   {
+      __m128i a = _mm_loadu_si128((const __m128i*)(row + i - bpp));
+      __m128i b = _mm_loadu_si128((const __m128i*)(prev + i));
+      __m128i c = _mm_loadu_si128((const __m128i*)(prev + i - bpp));
+      __m128i lo = paeth_i16(_mm_unpacklo_epi8(a, zero),
+          _mm_unpacklo_epi8(b, zero), _mm_unpacklo_epi8(c, zero));
+      __m128i hi = paeth_i16(_mm_unpackhi_epi8(a, zero),
+          _mm_unpackhi_epi8(b, zero), _mm_unpackhi_epi8(c, zero));
+      __m128i x = _mm_loadu_si128((const __m128i*)(row + i));
+      __m128i d = _mm_sub_epi8(x, _mm_packus_epi16(lo, hi));
+      _mm_storeu_si128((__m128i*)(out + i), d);
+      acc = _mm_add_epi64(acc, score_sse2(d));
+   }
+
+   return sum + hsum_sse2(acc) +
+       png_write_filter_bytes(PNG_FILTER_VALUE_PAETH, out, row, prev, i,
+       row_bytes, bpp);
+}
+#endif /* WRITE_FILTER */
+
+#endif /* PNG_INTEL_SSE_IMPLEMENTATION > 0 */
@@ -0,0 +1,138 @@
+/* intel_init.c - run time selection of the x86 SIMD filter functions
+ *
+ * This code is released under the libpng license.
+ * For conditions of distribution and use, see the disclaimer
+ * and license in png.h
+ */
+
+#include "pngpriv.h"
+
+#if PNG_INTEL_SSE_IMPLEMENTATION > 0
+
+#if defined(_MSC_VER)
+#  include <intrin.h>
+#  include <immintrin.h>
+#else
+#  include <cpuid.h>
+#endif
+
+static void
+png_cpuid(unsigned int leaf, unsigned int sub, unsigned int regs[4])
+{
+#if defined(_MSC_VER)
+   int r[4];
+   __cpuidex(r, (int)leaf, (int)sub);
+   regs[0] = (unsigned int)r[0];
+   regs[1] = (unsigned int)r[1];
+   regs[2] = (unsigned int)r[2];
+   regs[3] = (unsigned int)r[3];
+#else
+   __cpuid_count(leaf, sub, regs[0], regs[1], regs[2], regs[3]);
+#endif
+}
+
+/* Whether the OS saves the YMM registers on context switches. */
+static int
+png_os_saves_ymm(void)
+{
+#if defined(_MSC_VER)
+   return (_xgetbv(0) & 6) == 6;
+#else
+   unsigned int lo, hi;
+   __asm__ __volatile__ ("xgetbv" : "=a"(lo), "=d"(hi) : "c"(0));
+   return (lo & 6) == 6;
+#endif
+}
+
+/* The result is not mutex protected.  Racing threads compute and store the
+ * very same value; one seeing it not computed yet just computes it again.
+ */
+static volatile int png_avx2_state = -1;
+
+int /* PRIVATE */
+png_intel_avx2_supported(void)
+{
+   if (png_avx2_state < 0)
+   {
+      unsigned int regs[4];
+      int avx2 = 0;
+
+      png_cpuid(0, 0, regs);
+      if (regs[0] >= 7)
+      {
+         png_cpuid(1, 0, regs);
+         if ((regs[2] & (1U << 27)) != 0 && /* OSXSAVE */
+             (regs[2] & (1U << 28)) != 0 && /* AVX */
+             png_os_saves_ymm() != 0)
+         {
+            png_cpuid(7, 0, regs);
+            avx2 = (regs[1] & (1U << 5)) != 0;
+         }
+      }
+
+      png_avx2_state = avx2;
+   }
+
+   return png_avx2_state;
+}
+
+#ifdef PNG_READ_SUPPORTED
+void
+png_init_filter_functions_sse2(png_structp pp, unsigned int bpp)
+{
+   /* The Sub, Avg and Paeth filters chain each pixel to the one before it,
+    * which leaves only the bytes of one pixel to process in parallel; they
+    * are optimized for the common 3 and 4 byte pixels, and SSE2 is as good
+    * as it gets for those.  Up has no such chain.
+    */
+   if (png_intel_avx2_supported() != 0)
+      pp->read_filter[PNG_FILTER_VALUE_UP-1] = png_read_filter_row_up_avx2;
+   else
+      pp->read_filter[PNG_FILTER_VALUE_UP-1] = png_read_filter_row_up_sse2;
+
+   if (bpp == 3)
+   {
+      pp->read_filter[PNG_FILTER_VALUE_SUB-1] = png_read_filter_row_sub3_sse2;
+      pp->read_filter[PNG_FILTER_VALUE_AVG-1] = png_read_filter_row_avg3_sse2;
+      pp->read_filter[PNG_FILTER_VALUE_PAETH-1] =
+         png_read_filter_row_paeth3_sse2;
+   }
+   else if (bpp == 4)
+   {
+      pp->read_filter[PNG_FILTER_VALUE_SUB-1] = png_read_filter_row_sub4_sse2;
+      pp->read_filter[PNG_FILTER_VALUE_AVG-1] = png_read_filter_row_avg4_sse2;
+      pp->read_filter[PNG_FILTER_VALUE_PAETH-1] =
+         png_read_filter_row_paeth4_sse2;
+   }
+}
+#endif /* READ */
+
+#ifdef PNG_WRITE_FILTER_SUPPORTED
+void
+png_init_write_filter_functions_sse2(png_structp pp)
+{
+   /* Filtering for writing has no chain, every filter works on whole rows
+    * whatever the pixel size.
+    */
+   if (png_intel_avx2_supported() != 0)
+   {
+      pp->write_filter[PNG_FILTER_VALUE_NONE] = png_write_filter_row_none_avx2;
+      pp->write_filter[PNG_FILTER_VALUE_SUB] = png_write_filter_row_sub_avx2;
+      pp->write_filter[PNG_FILTER_VALUE_UP] = png_write_filter_row_up_avx2;
+      pp->write_filter[PNG_FILTER_VALUE_AVG] = png_write_filter_row_avg_avx2;
+      pp->write_filter[PNG_FILTER_VALUE_PAETH] =
+         png_write_filter_row_paeth_avx2;
+   }
+   else
+   {
+      pp->write_filter[PNG_FILTER_VALUE_NONE] = png_write_filter_row_none_sse2;
+      pp->write_filter[PNG_FILTER_VALUE_SUB] = png_write_filter_row_sub_sse2;
+      pp->write_filter[PNG_FILTER_VALUE_UP] = png_write_filter_row_up_sse2;
+      pp->write_filter[PNG_FILTER_VALUE_AVG] = png_write_filter_row_avg_sse2;
+      pp->write_filter[PNG_FILTER_VALUE_PAETH] =
+         png_write_filter_row_paeth_sse2;
+   }
+}
+#endif /* WRITE_FILTER */
+
+#endif /* PNG_INTEL_SSE_IMPLEMENTATION > 0 */
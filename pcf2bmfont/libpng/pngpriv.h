@@ -204,10 +204,11 @@
 #endif
 
 #ifndef PNG_INTEL_SSE_OPT
-#   ifdef PNG_INTEL_SSE
-      /* Only check for SSE if the build configuration has been modified to
-       * enable SSE optimizations.  This means that these optimizations will
-       * be off by default.  See contrib/intel for more details.
+#   if defined(PNG_INTEL_SSE) || !defined(PNG_NO_INTEL_SSE)
+      /* Unlike upstream libpng, this copy checks for SSE by default: x86
+       * builds get SSE2 filter functions for both reading and writing,
+       * plus AVX2 ones selected at run time.  Define PNG_NO_INTEL_SSE to
+       * use the generic C code only.
        */
 #     if defined(__SSE4_1__) || defined(__AVX__) || defined(__SSSE3__) || \
        defined(__SSE2__) || defined(_M_X64) || defined(_M_AMD64) || \
@@ -240,6 +241,7 @@
 
 #   if PNG_INTEL_SSE_IMPLEMENTATION > 0
 #      define PNG_FILTER_OPTIMIZATIONS png_init_filter_functions_sse2
+#      define PNG_WRITE_FILTER_OPTIMIZATIONS png_init_write_filter_functions_sse2
 #   endif
 #else
 #   define PNG_INTEL_SSE_IMPLEMENTATION 0
@@ -1350,6 +1352,10 @@ PNG_INTERNAL_FUNCTION(void,png_read_filter_row_paeth4_vsx,(png_row_infop
 #endif
 
 #if PNG_INTEL_SSE_IMPLEMENTATION > 0
+PNG_INTERNAL_FUNCTION(void,png_read_filter_row_up_sse2,(png_row_infop row_info,
+    png_bytep row, png_const_bytep prev_row),PNG_EMPTY);
+PNG_INTERNAL_FUNCTION(void,png_read_filter_row_up_avx2,(png_row_infop row_info,
+    png_bytep row, png_const_bytep prev_row),PNG_EMPTY);
 PNG_INTERNAL_FUNCTION(void,png_read_filter_row_sub3_sse2,(png_row_infop
     row_info, png_bytep row, png_const_bytep prev_row),PNG_EMPTY);
 PNG_INTERNAL_FUNCTION(void,png_read_filter_row_sub4_sse2,(png_row_infop
@@ -1364,6 +1370,37 @@ PNG_INTERNAL_FUNCTION(void,png_read_filter_row_paeth4_sse2,(png_row_infop
     row_info, png_bytep row, png_const_bytep prev_row),PNG_EMPTY);
 #endif
 
+#if PNG_INTEL_SSE_IMPLEMENTATION > 0 && defined(PNG_WRITE_FILTER_SUPPORTED)
+/* Write filters, see png_struct::write_filter.  Each one filters row_bytes
+ * bytes of row against prev_row into out and returns the sum of the
+ * absolute values of the filtered bytes.  The 'none' ones only score row.
+ */
+#define PNG_WRITE_FILTER_PROTO(name) \
+PNG_INTERNAL_FUNCTION(size_t,name,(png_bytep out, png_const_bytep row,\
+    png_const_bytep prev_row, size_t row_bytes, unsigned int bpp),PNG_EMPTY)
+PNG_WRITE_FILTER_PROTO(png_write_filter_row_none_sse2);
+PNG_WRITE_FILTER_PROTO(png_write_filter_row_sub_sse2);
+PNG_WRITE_FILTER_PROTO(png_write_filter_row_up_sse2);
+PNG_WRITE_FILTER_PROTO(png_write_filter_row_avg_sse2);
+PNG_WRITE_FILTER_PROTO(png_write_filter_row_paeth_sse2);
+PNG_WRITE_FILTER_PROTO(png_write_filter_row_none_avx2);
+PNG_WRITE_FILTER_PROTO(png_write_filter_row_sub_avx2);
+PNG_WRITE_FILTER_PROTO(png_write_filter_row_up_avx2);
+PNG_WRITE_FILTER_PROTO(png_write_filter_row_avg_avx2);
+PNG_WRITE_FILTER_PROTO(png_write_filter_row_paeth_avx2);
+#undef PNG_WRITE_FILTER_PROTO
+
+/* The byte by byte version, for bytes from to to - 1 of the row.  out may be
+ * NULL to only score them.
+ */
+PNG_INTERNAL_FUNCTION(size_t,png_write_filter_bytes,(int filter, png_bytep out,
+    png_const_bytep row, png_const_bytep prev_row, size_t from, size_t to,
+    unsigned int bpp),PNG_EMPTY);
+
+/* Whether the CPU and the OS support AVX2, checked once. */
+PNG_INTERNAL_FUNCTION(int,png_intel_avx2_supported,(void),PNG_EMPTY);
+#endif
+
 /* Choose the best filter to use and filter the row data */
 PNG_INTERNAL_FUNCTION(void,png_write_find_filter,(png_structrp png_ptr,
     png_row_infop row_info),PNG_EMPTY);
@@ -2114,6 +2151,11 @@ PNG_INTERNAL_FUNCTION(void, png_init_filter_functions_sse2,
 #  endif
 #endif
 
+#ifdef PNG_WRITE_FILTER_OPTIMIZATIONS
+PNG_INTERNAL_FUNCTION(void, PNG_WRITE_FILTER_OPTIMIZATIONS,
+   (png_structp png_ptr), PNG_EMPTY);
+#endif
+
 PNG_INTERNAL_FUNCTION(png_uint_32, png_check_keyword, (png_structrp png_ptr,
    png_const_charp key, png_bytep new_key), PNG_EMPTY);
 
@@ -478,6 +478,17 @@ struct png_struct_def
    void (*read_filter[PNG_FILTER_VALUE_LAST-1])(png_row_infop row_info,
       png_bytep row, png_const_bytep prev_row);
 
+#ifdef PNG_WRITE_FILTER_SUPPORTED
+/* Not in upstream libpng: hardware specific write filters, indexed by
+ * filter value and set up by PNG_WRITE_FILTER_OPTIMIZATIONS.  NULL entries
+ * use the generic code.  They filter the whole row and return its score,
+ * the entry for PNG_FILTER_VALUE_NONE only scores the row (out is NULL).
+ */
+   size_t (*write_filter[PNG_FILTER_VALUE_LAST])(png_bytep out,
+      png_const_bytep row, png_const_bytep prev_row, size_t row_bytes,
+      unsigned int bpp);
+#endif
+
 #ifdef PNG_READ_SUPPORTED
 #if defined(PNG_COLORSPACE_SUPPORTED) || defined(PNG_GAMMA_SUPPORTED)
    png_colorspace   colorspace;
@@ -1970,6 +1970,13 @@ png_write_start_row(png_structrp png_ptr)
    if ((filters & (PNG_FILTER_AVG | PNG_FILTER_UP | PNG_FILTER_PAETH)) != 0)
       png_ptr->prev_row = png_voidcast(png_bytep,
           png_calloc(png_ptr, buf_size));
+
+#ifdef PNG_WRITE_FILTER_OPTIMIZATIONS
+   /* Like PNG_FILTER_OPTIMIZATIONS for reading, this installs hardware
+    * specific replacements of the filters below in png_ptr->write_filter[].
+    */
+   PNG_WRITE_FILTER_OPTIMIZATIONS(png_ptr);
+#endif
 #endif /* WRITE_FILTER */
 
 #ifdef PNG_WRITE_INTERLACING_SUPPORTED
@@ -2275,6 +2282,24 @@ png_write_filtered_row(png_structrp png_ptr, png_bytep filtered_row,
     size_t row_bytes);
 
 #ifdef PNG_WRITE_FILTER_SUPPORTED
+#ifdef PNG_WRITE_FILTER_OPTIMIZATIONS
+/* Runs png_ptr->write_filter[filter] into try_row.  It scores the whole row,
+ * where the generic code stops once the row can no longer be the best one;
+ * the chosen filter is the same.
+ */
+static size_t /* PRIVATE */
+png_setup_row_optimized(png_structrp png_ptr, int filter, png_uint_32 bpp,
+    size_t row_bytes)
+{
+   png_ptr->try_row[0] = (png_byte)filter;
+
+   return png_ptr->write_filter[filter](png_ptr->try_row + 1,
+       png_ptr->row_buf + 1,
+       png_ptr->prev_row != NULL ? png_ptr->prev_row + 1 : NULL,
+       row_bytes, bpp);
+}
+#endif
+
 static size_t /* PRIVATE */
 png_setup_sub_row(png_structrp png_ptr, png_uint_32 bpp,
     size_t row_bytes, size_t lmins)
@@ -2284,6 +2309,12 @@ png_setup_sub_row(png_structrp png_ptr, png_uint_32 bpp,
    size_t sum = 0;
    unsigned int v;
 
+#ifdef PNG_WRITE_FILTER_OPTIMIZATIONS
+   if (png_ptr->write_filter[PNG_FILTER_VALUE_SUB] != NULL)
+      return png_setup_row_optimized(png_ptr, PNG_FILTER_VALUE_SUB, bpp,
+          row_bytes);
+#endif
+
    png_ptr->try_row[0] = PNG_FILTER_VALUE_SUB;
 
    for (i = 0, rp = png_ptr->row_buf + 1, dp = png_ptr->try_row + 1; i < bpp;
@@ -2321,6 +2352,14 @@ png_setup_sub_row_only(png_structrp png_ptr, png_uint_32 bpp,
    png_bytep rp, dp, lp;
    size_t i;
 
+#ifdef PNG_WRITE_FILTER_OPTIMIZATIONS
+   if (png_ptr->write_filter[PNG_FILTER_VALUE_SUB] != NULL)
+   {
+      png_setup_row_optimized(png_ptr, PNG_FILTER_VALUE_SUB, bpp, row_bytes);
+      return;
+   }
+#endif
+
    png_ptr->try_row[0] = PNG_FILTER_VALUE_SUB;
 
    for (i = 0, rp = png_ptr->row_buf + 1, dp = png_ptr->try_row + 1; i < bpp;
@@ -2344,6 +2383,12 @@ png_setup_up_row(png_structrp png_ptr, size_t row_bytes, size_t lmins)
    size_t sum = 0;
    unsigned int v;
 
+#ifdef PNG_WRITE_FILTER_OPTIMIZATIONS
+   if (png_ptr->write_filter[PNG_FILTER_VALUE_UP] != NULL)
+      return png_setup_row_optimized(png_ptr, PNG_FILTER_VALUE_UP, 1,
+          row_bytes);
+#endif
+
    png_ptr->try_row[0] = PNG_FILTER_VALUE_UP;
 
    for (i = 0, rp = png_ptr->row_buf + 1, dp = png_ptr->try_row + 1,
@@ -2369,6 +2414,14 @@ png_setup_up_row_only(png_structrp png_ptr, size_t row_bytes)
    png_bytep rp, dp, pp;
    size_t i;
 
+#ifdef PNG_WRITE_FILTER_OPTIMIZATIONS
+   if (png_ptr->write_filter[PNG_FILTER_VALUE_UP] != NULL)
+   {
+      png_setup_row_optimized(png_ptr, PNG_FILTER_VALUE_UP, 1, row_bytes);
+      return;
+   }
+#endif
+
    png_ptr->try_row[0] = PNG_FILTER_VALUE_UP;
 
    for (i = 0, rp = png_ptr->row_buf + 1, dp = png_ptr->try_row + 1,
@@ -2388,6 +2441,12 @@ png_setup_avg_row(png_structrp png_ptr, png_uint_32 bpp,
    size_t sum = 0;
    unsigned int v;
 
+#ifdef PNG_WRITE_FILTER_OPTIMIZATIONS
+   if (png_ptr->write_filter[PNG_FILTER_VALUE_AVG] != NULL)
+      return png_setup_row_optimized(png_ptr, PNG_FILTER_VALUE_AVG, bpp,
+          row_bytes);
+#endif
+
    png_ptr->try_row[0] = PNG_FILTER_VALUE_AVG;
 
    for (i = 0, rp = png_ptr->row_buf + 1, dp = png_ptr->try_row + 1,
@@ -2426,6 +2485,14 @@ png_setup_avg_row_only(png_structrp png_ptr, png_uint_32 bpp,
    png_bytep rp, dp, pp, lp;
    png_uint_32 i;
 
+#ifdef PNG_WRITE_FILTER_OPTIMIZATIONS
+   if (png_ptr->write_filter[PNG_FILTER_VALUE_AVG] != NULL)
+   {
+      png_setup_row_optimized(png_ptr, PNG_FILTER_VALUE_AVG, bpp, row_bytes);
+      return;
+   }
+#endif
+
    png_ptr->try_row[0] = PNG_FILTER_VALUE_AVG;
 
    for (i = 0, rp = png_ptr->row_buf + 1, dp = png_ptr->try_row + 1,
@@ -2450,6 +2517,12 @@ png_setup_paeth_row(png_structrp png_ptr, png_uint_32 bpp,
    size_t sum = 0;
    unsigned int v;
 
+#ifdef PNG_WRITE_FILTER_OPTIMIZATIONS
+   if (png_ptr->write_filter[PNG_FILTER_VALUE_PAETH] != NULL)
+      return png_setup_row_optimized(png_ptr, PNG_FILTER_VALUE_PAETH, bpp,
+          row_bytes);
+#endif
+
    png_ptr->try_row[0] = PNG_FILTER_VALUE_PAETH;
 
    for (i = 0, rp = png_ptr->row_buf + 1, dp = png_ptr->try_row + 1,
@@ -2509,6 +2582,14 @@ png_setup_paeth_row_only(png_structrp png_ptr, png_uint_32 bpp,
    png_bytep rp, dp, pp, cp, lp;
    size_t i;
 
+#ifdef PNG_WRITE_FILTER_OPTIMIZATIONS
+   if (png_ptr->write_filter[PNG_FILTER_VALUE_PAETH] != NULL)
+   {
+      png_setup_row_optimized(png_ptr, PNG_FILTER_VALUE_PAETH, bpp, row_bytes);
+      return;
+   }
+#endif
+
    png_ptr->try_row[0] = PNG_FILTER_VALUE_PAETH;
 
    for (i = 0, rp = png_ptr->row_buf + 1, dp = png_ptr->try_row + 1,
@@ -2616,6 +2697,13 @@ png_write_find_filter(png_structrp png_ptr, png_row_infop row_info)
       size_t i;
       unsigned int v;
 
+#ifdef PNG_WRITE_FILTER_OPTIMIZATIONS
+      if (png_ptr->write_filter[PNG_FILTER_VALUE_NONE] != NULL)
+         sum = png_ptr->write_filter[PNG_FILTER_VALUE_NONE](NULL, row_buf + 1,
+             NULL, row_bytes, bpp);
+
+      else
+#endif
       {
          for (i = 0, rp = row_buf + 1; i < row_bytes; i++, rp++)
          {
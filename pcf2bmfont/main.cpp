@@ -4,6 +4,9 @@
 
 #include <set>
 #include <map>
+#include <algorithm>
+#include <atomic>
+#include <thread>
 
 #ifdef _WIN32
 #  include <Windows.h>
@@ -13,10 +16,16 @@
 #endif
 
 #include <atlas.h>
+#include <bandwriter.h>
 #include <bmfont.h>
+#include <GridBinPack.h>
 #include <MaxRectsBinPack.h>
 #include <xgetopt.h>
 
+#include "merge.h"
+#include "packstate.h"
+#include "pages.h"
+
 bool read_utf8_tailing(char* p, unsigned int& value)
 {
 	unsigned int ch = (unsigned int)(*(unsigned char*)p);
@@ -160,16 +169,273 @@ bool collect_codepoints(const std::string& path, std::set<unsigned int>& codepoi
 	return ret;
 }
 
+struct GlyphPlacement
+{
+	unsigned int glyph_index;
+	rbp::Rect rect;
+};
+
+// Rows of the glyph bitmap, which can run past the cell it is placed in.
+unsigned int glyph_rows(const pcf::PCFFont& f, unsigned int glyph_index)
+{
+	const pcf::MetricsData& md = f.GetMetricsTable().GetMetricsData(glyph_index);
+	return (unsigned short)(md.CharacterAscent + md.CharacterDescent);
+}
+
+// Draws rows [row_begin, row_end) (in page coordinates) of the glyph onto
+// target, which is either an Atlas or an AtlasBandWriter.
+template<typename T>
+void draw_glyph_rows(T& target, const pcf::PCFFont& f, const GlyphPlacement& pl,
+	unsigned int row_begin, unsigned int row_end)
+{
+	const char* glyph_bitmap = f.GetBitmapTable().GetGlyphBuffer(pl.glyph_index);
+	const pcf::MetricsData& md = f.GetMetricsTable().GetMetricsData(pl.glyph_index);
+	unsigned int gw = (unsigned short)md.CharacterWidth;
+	unsigned int gh = glyph_rows(f, pl.glyph_index);
+
+	unsigned int gy_begin = (row_begin > (unsigned int)pl.rect.y) ? (row_begin - pl.rect.y) : 0;
+	unsigned int gy_end = (row_end > (unsigned int)pl.rect.y) ? (row_end - pl.rect.y) : 0;
+	if (gy_end > gh)
+		gy_end = gh;
+
+	bmfm::Color pixelColor{255, 255, 255, 255}; // white
+	for (unsigned int gy = gy_begin; gy < gy_end; ++gy)
+	{
+		for (unsigned int gx = 0; gx < gw; ++gx)
+		{
+			unsigned char b = (unsigned char)glyph_bitmap[gy*4 + (gx/8)];
+			unsigned int gi = gx % 8;
+			unsigned char bm = 0x1 << (7-gi);
+			if (b & bm)
+			{
+				target.SetPixel(
+					pl.rect.x + gx,
+					pl.rect.y + gy,
+					pixelColor);
+			}
+		}
+	}
+}
+
+// Rasterizes the page band by band in y order, handing each completed band
+// to libpng right away. Memory use is bounded by the band size instead of
+// the page size.
+bool write_atlas_banded(const pcf::PCFFont& f, std::vector<GlyphPlacement> placements,
+	const std::string& path, unsigned int w, unsigned int h, unsigned int band_rows,
+	bmfm::PNGWriteProfile profile)
+{
+	std::sort(placements.begin(), placements.end(),
+		[](const GlyphPlacement& a, const GlyphPlacement& b) { return a.rect.y < b.rect.y; });
+
+	bmfm::AtlasBandWriter writer;
+	if (!writer.Open(path, w, h, band_rows, profile))
+		return false;
+
+	size_t next = 0;
+	std::vector<GlyphPlacement> active;
+	while (writer.GetBandTop() < h)
+	{
+		unsigned int top = writer.GetBandTop();
+		unsigned int bottom = writer.GetBandBottom();
+
+		while (next < placements.size() && (unsigned int)placements[next].rect.y < bottom)
+			active.push_back(placements[next++]);
+
+		for (const auto& pl : active)
+			draw_glyph_rows(writer, f, pl, top, bottom);
+
+		// Retire glyphs whose bitmap ends inside this band.
+		active.erase(std::remove_if(active.begin(), active.end(),
+			[&f, bottom](const GlyphPlacement& pl) { return pl.rect.y + glyph_rows(f, pl.glyph_index) <= bottom; }),
+			active.end());
+
+		if (!writer.NextBand())
+			return false;
+	}
+
+	return writer.Close();
+}
+
+// Lays out count glyph cells of size x size over as many w x h pages as
+// needed, opening a new page once the current one is full. out[k] is the
+// cell of the k-th glyph. Returns false if a cell does not fit even an
+// empty page, or if more than max_pages pages would be needed (0 is no limit).
+// Without a grid, the cells are packed by the given packers, if any, on up
+// to threads threads, and the index of the one kept goes to picked.
+bool pack_glyph_cells(size_t count, int size, int w, int h, bool grid_layout,
+	rbp::GridBinPack::CellOrder cell_order, const std::vector<PackerConfig>& packers,
+	std::vector<PagedRect>& out, unsigned int& page_count, unsigned int max_pages = 0, size_t* picked = nullptr,
+	unsigned int threads = 0)
+{
+	out.clear();
+	out.reserve(count);
+	page_count = 0;
+	if (size > w || size > h)
+		return false;
+
+	if (!grid_layout && !packers.empty())
+	{
+		std::vector<rbp::RectSize> sizes(count, rbp::RectSize{ size, size });
+		return pack_pages_portfolio(sizes, w, h, packers, out, page_count, max_pages, picked, threads);
+	}
+
+	do
+	{
+		if (max_pages != 0 && page_count >= max_pages)
+			return false;
+
+		std::vector<rbp::RectSize> sizes;
+		std::vector<rbp::Rect> rects;
+		if (grid_layout)
+		{
+			rbp::GridBinPack gbp(w, h, size, size, cell_order);
+			sizes.assign(std::min(count - out.size(), (size_t)gbp.Capacity()), rbp::RectSize{ size, size });
+			gbp.Insert(sizes, rects);
+		}
+		else
+		{
+			// Glyphs have always taken the rects from the last placed one on,
+			// keep it that way so atlases do not change.
+			sizes.assign(count - out.size(), rbp::RectSize{ size, size });
+			rbp::MaxRectsBinPack mbp(w, h, false);
+			mbp.Insert(sizes, rects, rbp::MaxRectsBinPack::RectBestShortSideFit);
+			std::reverse(rects.begin(), rects.end());
+		}
+
+		for (const auto& rect : rects)
+			out.push_back(PagedRect{ page_count, rect });
+		++page_count;
+	} while (out.size() < count);
+
+	return true;
+}
+
+// Adds the glyphs of codepoints the font at xml_path lacks into the free
+// space of its pages, as recorded in its packer state, opening new pages
+// if needed. Glyphs already there stay where they are, and only the pages
+// which got new glyphs are written.
+bool append_glyphs(const pcf::PCFFont& f, const std::map<unsigned int, unsigned int>& valid_codepoints, int cell_size,
+	const std::string& xml_path, const std::string& atlas_name, const PageOptions& options, bmfm::AtlasStorage storage)
+{
+	FILE* probe = ::fopen(xml_path.c_str(), "rb");
+	if (!probe)
+	{
+		std::cerr << "Error: Nothing to append to, unable to open " << xml_path << std::endl;
+		return false;
+	}
+	::fclose(probe);
+
+	bmfm::BMFontDocument font = bmfm::BMFontDocument::LoadFromXML(xml_path);
+	const int w = font.CommonData.scaleW;
+	const int h = font.CommonData.scaleH;
+	const size_t old_pages = font.PageMap.size();
+	if (font.CommonData.lineHeight + 1 != cell_size)
+		std::cerr << "Warning: " << xml_path << " was built from glyphs of another size." << std::endl;
+
+	std::vector<rbp::MaxRectsBinPack> bins;
+	const std::string state_path = pack_state_path(xml_path);
+	if (!load_pack_state(state_path, font, bins))
+	{
+		std::cout << "Info: No packer state of " << xml_path << ", rebuilding it from its chars." << std::endl;
+		rebuild_pack_state(font, 1, bins);
+	}
+
+	std::vector<std::vector<GlyphPlacement>> placements(bins.size());
+	size_t appended = 0;
+	for (const auto& pair : valid_codepoints)
+	{
+		if (font.CharMap.count(pair.first))
+			continue;
+
+		rbp::Rect rect = rbp::Rect{ 0, 0, 0, 0 };
+		size_t p = 0;
+		for (; p < bins.size() && rect.height == 0; ++p)
+			rect = bins[p].Insert(cell_size, cell_size, rbp::MaxRectsBinPack::RectBestShortSideFit);
+		if (rect.height == 0)
+		{
+			bins.emplace_back(w, h, false);
+			placements.emplace_back();
+			rect = bins.back().Insert(cell_size, cell_size, rbp::MaxRectsBinPack::RectBestShortSideFit);
+			p = bins.size();
+			if (rect.height == 0)
+			{
+				std::cerr << "Error: Glyphs of " << cell_size - 1 << " pixels do not fit a " << w << "x" << h << " page." << std::endl;
+				return false;
+			}
+		}
+		--p;
+
+		const pcf::MetricsData& md = f.GetMetricsTable().GetMetricsData(pair.second);
+		unsigned int gw = (unsigned short)md.CharacterWidth;
+		unsigned int gh = (unsigned short)(md.CharacterAscent + md.CharacterDescent);
+		placements[p].push_back(GlyphPlacement{ pair.second, rect });
+		font.CharMap.insert(std::make_pair(pair.first,
+			bmfm::BMFCharData{pair.first, (unsigned short)rect.x, (unsigned short)rect.y, (unsigned short)gw, (unsigned short)gh, 0, 0, (short)gw, (unsigned char)p, 15}));
+		++appended;
+	}
+
+	if (appended == 0)
+	{
+		std::cout << "Info: No new glyphs to append to " << xml_path << "." << std::endl;
+		return true;
+	}
+
+	const unsigned int page_count = (unsigned int)bins.size();
+	font.CommonData.pages = (unsigned short)page_count;
+	for (unsigned int p = (unsigned int)old_pages; p < page_count; ++p)
+		font.PageMap.insert(std::make_pair(p, bmfm::BMFPageData{ p, page_filename(atlas_name, p, page_count) }));
+
+	unsigned int written = 0;
+	bool ret = true;
+	for (unsigned int p = 0; p < page_count; ++p)
+	{
+		if (placements[p].empty())
+			continue;
+		if (p >= old_pages)
+			font.AltasMap.insert(std::make_pair(p, bmfm::Atlas((unsigned int)w, (unsigned int)h, storage)));
+
+		// Loaded pages go back where they were read from, new ones next to
+		// the atlas_name of the build.
+		bmfm::Atlas& a = font.AltasMap.at(p);
+		for (const auto& pl : placements[p])
+			draw_glyph_rows(a, f, pl, 0, (unsigned int)h);
+		const std::string& file = font.PageMap[p].filename;
+		ret = save_page(a, p < old_pages ? bmfm::BMFontDocument::PagePath(xml_path, file) : file, options) && ret;
+		++written;
+	}
+
+	std::cout << "Info: " << appended << " glyphs appended, " << written << " of " << page_count << " page(s) written." << std::endl;
+	return ret && font.SaveToXML(xml_path) && save_pack_state(state_path, font, bins);
+}
+
 void show_help()
 {
 	::printf(
-		"Usage: \n\tpcf2bmfont [-W width] [-H height] [-n image_filename] [-x xml_filename] [-C] -i char_select_file PCF_font_path\n\tpcf2bmfont -h\n\n"
+		"Usage: \n\tpcf2bmfont [-W width] [-H height] [-n image_filename] [-x xml_filename] [-C] [-B band_rows] [-T texture_format] [-P png_profile] [-u] [-m] [-G mip_filter] [-E texels] [-O glyph_order] [-A size_step] [-S packers] [-a] -i char_select_file PCF_font_path\n\tpcf2bmfont [-W width] [-H height] [-A size_step] [-S packers] [-n image_filename] [-x xml_filename] [-T texture_format] [-P png_profile] [-u] [-m] [-G mip_filter] [-E texels] -M BMFont_path...\n\tpcf2bmfont -h\n\n"
 		"pcf2bmfont generates a BMFont file from given PCF font.\n"
 		"\'-W\' and \'-H\' control the output atlas image dimensions (default is 1024).\n"
+		"     Glyphs which do not fit one image go to further images, named with a \'_<page>\' suffix.\n"
 		"\'-n\' specifies the file name of the output atlas image.\n"
 		"\'-x\' specifies the file name of the output BMFont file (in XML format).\n"
 		"\'-C\' translate unicode to multi-bytes based on the Active Code Page of current OS.\n"
+		"\'-B\' streams the atlas image out in bands of the given rows instead of building the whole page in memory.\n"
+		"\'-T\' writes atlas images as GPU textures of the glyph coverage, either \'r8\' (uncompressed) or \'bc4\'.\n"
+		"     The texture is a DDS file if the image file name ends with \'.dds\', a KTX2 file otherwise.\n"
+		"\'-P\' selects how PNG atlas images are compressed: \'default\', or \'fast\' for quicker writes of somewhat larger files,\n"
+		"     or \'smallest\' to encode each image several ways in parallel and keep the smallest file.\n"
+		"\'-u\' skips writing atlas images whose pixels did not change since the last run, as recorded in a \'.hash\' file next to them.\n"
+		"\'-m\' keeps atlas images in memory mapped scratch files (in TMPDIR) the system can page out, for images larger than memory.\n"
+		"\'-G\' adds the mip chain to textures, filtered with \'box\' or \'kaiser\' without bleeding between glyphs.\n"
+		"\'-E\' extrudes glyph edges over that many texels of spacing on every mip level (with \'-G\').\n"
+		"\'-O\' lays out glyphs of the same size on a grid in codepoint order, \'rows\' (default) or \'columns\',\n"
+		"     or packs them with MaxRects as older versions did (\'maxrects\').\n"
+		"\'-A\' picks the smallest image size that fits every glyph on one image, up to \'-W\' x \'-H\',\n"
+		"     either a power of two (\'pow2\') or a multiple of the given number, and crops it to what is used.\n"
+		"\'-S\' packs glyphs not laid out on a grid with each of the given packers concurrently and keeps the best result.\n"
+		"     A comma separated list of \'maxrects\', \'skyline\', \'guillotine\', \'all\' or single variants like \'maxrects-bl\'.\n"
+		"\'-a\' appends the glyphs the \'-x\' BMFont file lacks into the free space of its PNG images, leaving the others in place.\n"
 		"\'-i\' a text file in UTF-8 listing all needed chars. [Required]\n"
+		"\'-M\' merges the given BMFont files (in XML format) into one, re-packing their atlas images.\n"
 		"\'-h\' shows this message.\n");
 }
 
@@ -179,11 +445,22 @@ int main(int argc, char *argv[])
 	int atlasW = 1024;
 	int atlasH = 1024;
 	bool transcode = false;
+	unsigned int band_rows = 0;
+	bool merge = false;
+	PageOptions page_options;
+	bmfm::AtlasStorage page_storage = bmfm::AtlasStorage::Sparse;
+	bool grid_layout = true;
+	rbp::GridBinPack::CellOrder cell_order = rbp::GridBinPack::CellRowMajor;
+	bool order_given = false;
+	PageSizeSearch size_search;
+	std::vector<PackerConfig> packers;
+	bool append = false;
 	std::string output_atlas_name = "output.png";
+	bool atlas_name_given = false;
 	std::string output_xml_name = "output.fnt";
 	std::string char_select_file;
 
-	while ((opt = xgetopt(argc, argv, "W:H:hn:x:Ci:")) != -1)
+	while ((opt = xgetopt(argc, argv, "W:H:hn:x:Ci:B:MT:P:umG:E:O:A:S:a")) != -1)
 	{
 		switch (opt)
 		{
@@ -206,6 +483,7 @@ int main(int argc, char *argv[])
 			break;;
 		case 'n':
 			output_atlas_name = xoptarg;
+			atlas_name_given = true;
 			break;
 		case 'i':
 			char_select_file = xoptarg;
@@ -213,6 +491,97 @@ int main(int argc, char *argv[])
 		case 'C':
 			transcode = true;
 			break;
+		case 'B':
+			if (0 >= ::sscanf(xoptarg, "%u", &band_rows) || band_rows == 0)
+			{
+				fprintf(stderr, "Error: \'%s\' is not a valid band height.", xoptarg);
+				return 1;
+			}
+			break;
+		case 'M':
+			merge = true;
+			break;
+		case 'T':
+			if (0 == ::strcmp(xoptarg, "r8"))
+				page_options.format = PageFormat::R8;
+			else if (0 == ::strcmp(xoptarg, "bc4"))
+				page_options.format = PageFormat::BC4;
+			else
+			{
+				fprintf(stderr, "Error: Unknown texture format \'%s\'.", xoptarg);
+				return 1;
+			}
+			break;
+		case 'P':
+			if (0 == ::strcmp(xoptarg, "default"))
+				page_options.profile = bmfm::PNGWriteProfile::Default;
+			else if (0 == ::strcmp(xoptarg, "fast"))
+				page_options.profile = bmfm::PNGWriteProfile::Fast;
+			else if (0 == ::strcmp(xoptarg, "smallest"))
+				page_options.profile = bmfm::PNGWriteProfile::Smallest;
+			else
+			{
+				fprintf(stderr, "Error: Unknown PNG profile \'%s\'.", xoptarg);
+				return 1;
+			}
+			break;
+		case 'u':
+			page_options.skip_unchanged = true;
+			break;
+		case 'm':
+			page_storage = bmfm::AtlasStorage::Mapped;
+			break;
+		case 'G':
+			page_options.mips = true;
+			if (0 == ::strcmp(xoptarg, "box"))
+				page_options.mip_filter = bmfm::MipFilter::Box;
+			else if (0 == ::strcmp(xoptarg, "kaiser"))
+				page_options.mip_filter = bmfm::MipFilter::Kaiser;
+			else
+			{
+				fprintf(stderr, "Error: Unknown mip filter '%s'.", xoptarg);
+				return 1;
+			}
+			break;
+		case 'E':
+			if (0 >= ::sscanf(xoptarg, "%u", &page_options.mip_extrude))
+			{
+				fprintf(stderr, "Error: '%s' is not a number.", xoptarg);
+				return 1;
+			}
+			break;
+		case 'O':
+			order_given = true;
+			grid_layout = true;
+			if (0 == ::strcmp(xoptarg, "rows"))
+				cell_order = rbp::GridBinPack::CellRowMajor;
+			else if (0 == ::strcmp(xoptarg, "columns"))
+				cell_order = rbp::GridBinPack::CellColumnMajor;
+			else if (0 == ::strcmp(xoptarg, "maxrects"))
+				grid_layout = false;
+			else
+			{
+				fprintf(stderr, "Error: Unknown glyph order '%s'.", xoptarg);
+				return 1;
+			}
+			break;
+		case 'A':
+			size_search.enabled = true;
+			size_search.step = 0;
+			if (0 != ::strcmp(xoptarg, "pow2") && (0 >= ::sscanf(xoptarg, "%u", &size_search.step) || size_search.step == 0))
+			{
+				fprintf(stderr, "Error: \'%s\' is not a valid size step.", xoptarg);
+				return 1;
+			}
+			break;
+		case 'a':
+			append = true;
+			break;
+		case 'S':
+			packers.clear();
+			if (!parse_packers(xoptarg, packers))
+				return 1;
+			break;
 		default:
 		case 'h':
 			show_help();
@@ -220,6 +589,48 @@ int main(int argc, char *argv[])
 		}
 	}
 
+	if (page_options.mips && page_options.format == PageFormat::PNG)
+	{
+		fprintf(stderr, "Error: '-G' only applies to textures, see '-T'.\n");
+		return 1;
+	}
+
+	if (page_options.format != PageFormat::PNG)
+	{
+		if (band_rows > 0)
+		{
+			fprintf(stderr, "Error: \'-B\' only writes PNG images.\n");
+			return 1;
+		}
+		if (!atlas_name_given)
+			output_atlas_name = "output.ktx2";
+	}
+
+	if (append && (merge || band_rows > 0 || page_options.format != PageFormat::PNG || size_search.enabled))
+	{
+		fprintf(stderr, "Error: \'-a\' only appends to PNG images of the PCF path, see \'-h\'.\n");
+		return 1;
+	}
+
+	if (merge && (band_rows > 0 || transcode || order_given || !char_select_file.empty()))
+	{
+		fprintf(stderr, "Error: \'-B\', \'-C\', \'-O\' and \'-i\' only apply to the PCF path, not to \'-M\', see \'-h\'.\n");
+		return 1;
+	}
+
+	if (merge)
+	{
+		if (xoptind >= argc)
+		{
+			fprintf(stderr, "Error: Missing BMFont files to merge.\n");
+			show_help();
+			return 1;
+		}
+
+		std::vector<std::string> inputs(argv + xoptind, argv + argc);
+		return merge_documents(inputs, atlasW, atlasH, size_search, packers, output_xml_name, output_atlas_name, page_options, page_storage) ? 0 : 1;
+	}
+
 	if (char_select_file.empty())
 	{
 		fprintf(stderr, "Error: Missing char selecting file.\n");
@@ -293,60 +704,131 @@ int main(int argc, char *argv[])
 		}
 	}
 
-	std::vector<rbp::RectSize> rectsizes;
-	rectsizes.reserve(valid_codepoints.size());
-	rectsizes.assign(valid_codepoints.size(), rbp::RectSize{ glyph_width+1, glyph_width+1 });
+	const int cell_size = glyph_width+1;
+	if (append)
+		return append_glyphs(f, valid_codepoints, cell_size, output_xml_name, output_atlas_name, page_options, page_storage) ? 0 : 1;
 
-	std::vector<rbp::Rect> rects;
-	rects.reserve(valid_codepoints.size());
-	rbp::MaxRectsBinPack mbp(atlasW, atlasH, false);
-	mbp.Insert(rectsizes, rects, rbp::MaxRectsBinPack::RectBestShortSideFit);
+	if (size_search.enabled)
+	{
+		auto fits = [&](int w, int h) {
+			std::vector<PagedRect> trial;
+			unsigned int trial_pages = 0;
+			return pack_glyph_cells(valid_codepoints.size(), cell_size, w, h, grid_layout, cell_order, packers, trial, trial_pages, 1, nullptr, 1);
+		};
+		if (!search_page_size(size_search, atlasW, atlasH, cell_size, cell_size,
+			(unsigned long long)cell_size * cell_size * valid_codepoints.size(), fits, atlasW, atlasH))
+			std::cout << "Info: Glyphs do not fit one " << atlasW << "x" << atlasH << " page, keeping that size." << std::endl;
+	}
+
+	std::vector<PagedRect> cells;
+	unsigned int page_count = 0;
+	size_t picked = packers.size();
+	if (!pack_glyph_cells(valid_codepoints.size(), cell_size, atlasW, atlasH,
+		grid_layout, cell_order, packers, cells, page_count, 0, &picked))
+	{
+		std::cerr << "Error: Glyphs of " << glyph_width << " pixels do not fit a " << atlasW << "x" << atlasH << " page." << std::endl;
+		return 1;
+	}
+	std::cout << "Info: " << valid_codepoints.size() << " glyphs packed into " << page_count << " page(s)." << std::endl;
+	if (picked < packers.size())
+		std::cout << "Info: Packed by " << packer_name(packers[picked]) << "." << std::endl;
+
+	if (size_search.enabled && page_count == 1)
+	{
+		int used_w = 0, used_h = 0;
+		for (const auto& cell : cells)
+		{
+			used_w = std::max(used_w, cell.rect.x + cell.rect.width);
+			used_h = std::max(used_h, cell.rect.y + cell.rect.height);
+		}
+		atlasW = crop_page_size(size_search, used_w, atlasW);
+		atlasH = crop_page_size(size_search, used_h, atlasH);
+		std::cout << "Info: Page cropped to " << atlasW << "x" << atlasH << "." << std::endl;
+	}
 
 	bmfm::BMFontDocument font;
 	font.InfoData = bmfm::BMFInfoData{ output_xml_name, -1* glyph_width, false, false, "", true, 100, false, false, {0,0,0,0}, {1,1}, 0};
 	font.CommonData = bmfm::BMFCommonData{ (unsigned short)glyph_width, (unsigned short)glyph_width,
 		(unsigned short)(unsigned int)atlasW, (unsigned short)(unsigned int)atlasH, 
-		1, false, bmfm::BMFChannelMode::Glyph, bmfm::BMFChannelMode::One, bmfm::BMFChannelMode::One, bmfm::BMFChannelMode::One };
-	font.PageMap.insert(std::make_pair(0, bmfm::BMFPageData{0, output_atlas_name }));
+		(unsigned short)page_count, false, bmfm::BMFChannelMode::Glyph, bmfm::BMFChannelMode::One, bmfm::BMFChannelMode::One, bmfm::BMFChannelMode::One };
+	for (unsigned int p = 0; p < page_count; ++p)
+		font.PageMap.insert(std::make_pair(p, bmfm::BMFPageData{ p, page_filename(output_atlas_name, p, page_count) }));
 
-	bmfm::Atlas a((unsigned int)atlasW, (unsigned int)atlasH);
+	std::vector<std::vector<GlyphPlacement>> placements(page_count);
+	std::vector<std::vector<bmfm::MipRect>> glyphs(page_count);
 	std::map<unsigned int, bmfm::BMFCharData>& cmap = font.CharMap;
+	size_t k = 0;
 	for (const auto& pair : valid_codepoints)
 	{
-		assert(rects.empty() == false);
-		const rbp::Rect& rect = rects.back();
+		const PagedRect& cell = cells[k++];
+		const rbp::Rect& rect = cell.rect;
 
-		const char* glyph_bitmap = f.GetBitmapTable().GetGlyphBuffer(pair.second);
 		const pcf::MetricsData& md = f.GetMetricsTable().GetMetricsData(pair.second);
 		unsigned int gw = (unsigned short)md.CharacterWidth;
 		unsigned int gh = (unsigned short)(md.CharacterAscent + md.CharacterDescent);
 
-		bmfm::Color pixelColor{255, 255, 255, 255}; // white
-		for (unsigned int gy = 0; gy < gh; ++gy)
+		placements[cell.page].push_back(GlyphPlacement{ pair.second, rect });
+		glyphs[cell.page].push_back(bmfm::MipRect{ (unsigned int)rect.x, (unsigned int)rect.y, gw, gh });
+		cmap.insert(std::make_pair(pair.first, 
+			bmfm::BMFCharData{pair.first, (unsigned short)rect.x, (unsigned short)rect.y, (unsigned short)gw, (unsigned short)gh, 0, 0, (short)gw, (unsigned char)cell.page, 15}));
+	}
+
+	font.SaveToXML(output_xml_name);
+
+	std::vector<rbp::MaxRectsBinPack> pack_state;
+	build_pack_state(atlasW, atlasH, cells, page_count, pack_state);
+	if (!save_pack_state(pack_state_path(output_xml_name), font, pack_state))
+		return 1;
+
+	if (band_rows > 0)
+	{
+		// Bands bound the memory used, one page at a time.
+		for (unsigned int p = 0; p < page_count; ++p)
 		{
-			for (unsigned int gx = 0; gx < gw; ++gx)
+			if (!write_atlas_banded(f, placements[p], font.PageMap[p].filename, (unsigned int)atlasW, (unsigned int)atlasH, band_rows, page_options.profile))
+				return 1;
+		}
+	}
+	else
+	{
+		// Pages are independent, rasterize and encode them concurrently.
+		std::vector<std::string> filenames;
+		for (const auto& pair : font.PageMap)
+			filenames.push_back(pair.second.filename);
+		unsigned int cores = std::thread::hardware_concurrency();
+		if (cores == 0)
+			cores = 1;
+		unsigned int threads = cores;
+		if (threads > page_count)
+			threads = page_count;
+
+		// Share the cores out between the pages being encoded at once,
+		// rather than have each of them start a thread per core.
+		PageOptions worker_options = page_options;
+		worker_options.threads = std::max(1u, cores / threads);
+
+		std::vector<char> saved(page_count, 0);
+		std::atomic<unsigned int> next(0);
+		auto worker = [&]() {
+			for (unsigned int p = next++; p < page_count; p = next++)
 			{
-				unsigned char b = (unsigned char)glyph_bitmap[gy*4 + (gx/8)];
-				unsigned int gi = gx % 8;
-				unsigned char bm = 0x1 << (7-gi);
-				if (b & bm)
-				{
-					a.SetPixel(
-						rect.x + gx,
-						rect.y + gy,
-						pixelColor);
-				}
+				bmfm::Atlas a((unsigned int)atlasW, (unsigned int)atlasH, page_storage);
+				for (const auto& pl : placements[p])
+					draw_glyph_rows(a, f, pl, 0, (unsigned int)atlasH);
+				saved[p] = save_page(a, filenames[p], worker_options, glyphs[p]) ? 1 : 0;
 			}
-		}
+		};
 
-		cmap.insert(std::make_pair(pair.first, 
-			bmfm::BMFCharData{pair.first, (unsigned short)rect.x, (unsigned short)rect.y, (unsigned short)gw, (unsigned short)gh, 0, 0, (short)gw, 0, 15}));
+		std::vector<std::thread> pool;
+		for (unsigned int i = 1; i < threads; ++i)
+			pool.emplace_back(worker);
+		worker();
+		for (auto& t : pool)
+			t.join();
 
-		rects.pop_back();
+		if (std::find(saved.begin(), saved.end(), 0) != saved.end())
+			return 1;
 	}
 
-	font.SaveToXML(output_xml_name);
-	a.SaveToPNG(output_atlas_name);
-
 	return 0;
 }
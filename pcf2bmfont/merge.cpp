@@ -0,0 +1,176 @@
+#include "merge.h"
+
+#include <algorithm>
+#include <iostream>
+#include <set>
+#include <map>
+
+#include <atlas.h>
+#include <bmfont.h>
+#include "packstate.h"
+
+struct MergeSource
+{
+	size_t doc;
+	unsigned int id;
+};
+
+bool merge_documents(const std::vector<std::string>& inputs, int atlasW, int atlasH, const PageSizeSearch& size_search,
+	const std::vector<PackerConfig>& packers,
+	const std::string& output_xml_name, const std::string& output_atlas_name, const PageOptions& options,
+	bmfm::AtlasStorage storage)
+{
+	std::vector<bmfm::BMFontDocument> docs;
+	docs.reserve(inputs.size());
+	for (const auto& path : inputs)
+	{
+		docs.push_back(bmfm::BMFontDocument::LoadFromXML(path));
+		std::cout << "Info: " << docs.back().CharMap.size() << " chars loaded from " << path << std::endl;
+	}
+
+	if (docs.empty())
+	{
+		std::cerr << "Error: No BMFont document to merge." << std::endl;
+		return false;
+	}
+
+	// Every page is needed, decode them all up front and concurrently.
+	std::vector<bmfm::AtlasMap*> maps;
+	for (auto& doc : docs)
+		maps.push_back(&doc.AltasMap);
+	bmfm::AtlasMap::Prefetch(maps);
+
+	// Gather every glyph. Keep 1 pixel spacing between glyphs, as main() does.
+	std::vector<MergeSource> sources;
+	std::vector<rbp::RectSize> sizes;
+	std::set<unsigned int> taken;
+	for (size_t d = 0; d < docs.size(); ++d)
+	{
+		const bmfm::BMFontDocument& doc = docs[d];
+		if (doc.CommonData.lineHeight != docs[0].CommonData.lineHeight || doc.CommonData.base != docs[0].CommonData.base)
+			std::cerr << "Warning: " << inputs[d] << " has different lineHeight/base than " << inputs[0] << std::endl;
+		if (doc.CommonData.packed)
+			std::cerr << "Warning: " << inputs[d] << " has channel packed glyphs, all channels are copied." << std::endl;
+
+		for (const auto& pair : doc.CharMap)
+		{
+			if (!taken.insert(pair.first).second)
+			{
+				std::cerr << "Warning: Codepoint 0x" << std::hex << pair.first << std::dec
+					<< " of " << inputs[d] << " is already taken, dropped." << std::endl;
+				continue;
+			}
+
+			sources.push_back(MergeSource{ d, pair.first });
+			sizes.push_back(rbp::RectSize{ pair.second.width + 1, pair.second.height + 1 });
+		}
+	}
+
+	if (size_search.enabled)
+	{
+		int min_w = 1, min_h = 1;
+		unsigned long long min_area = 0;
+		for (const auto& sz : sizes)
+		{
+			min_w = std::max(min_w, sz.width);
+			min_h = std::max(min_h, sz.height);
+			min_area += (unsigned long long)sz.width * sz.height;
+		}
+
+		auto fits = [&sizes, &packers](int w, int h) {
+			std::vector<PagedRect> trial;
+			unsigned int trial_pages = 0;
+			return pack_pages(sizes, w, h, trial, trial_pages, 1, packers, nullptr, 1);
+		};
+		if (!search_page_size(size_search, atlasW, atlasH, min_w, min_h, min_area, fits, atlasW, atlasH))
+			std::cout << "Info: Glyphs do not fit one " << atlasW << "x" << atlasH << " page, keeping that size." << std::endl;
+	}
+
+	std::vector<PagedRect> placements;
+	unsigned int page_count = 0;
+	size_t picked = packers.size();
+	if (!pack_pages(sizes, atlasW, atlasH, placements, page_count, 0, packers, &picked))
+	{
+		std::cerr << "Error: Some glyph does not fit a " << atlasW << "x" << atlasH << " page." << std::endl;
+		return false;
+	}
+	if (page_count == 0)
+		page_count = 1;
+	if (picked < packers.size())
+		std::cout << "Info: Packed by " << packer_name(packers[picked]) << "." << std::endl;
+
+	if (size_search.enabled && page_count == 1)
+	{
+		int used_w = 0, used_h = 0;
+		for (const auto& pr : placements)
+		{
+			used_w = std::max(used_w, pr.rect.x + pr.rect.width);
+			used_h = std::max(used_h, pr.rect.y + pr.rect.height);
+		}
+		atlasW = crop_page_size(size_search, used_w, atlasW);
+		atlasH = crop_page_size(size_search, used_h, atlasH);
+		std::cout << "Info: Page cropped to " << atlasW << "x" << atlasH << "." << std::endl;
+	}
+
+	bmfm::BMFontDocument merged;
+	merged.InfoData = docs[0].InfoData;
+	merged.CommonData = docs[0].CommonData;
+	merged.CommonData.scaleW = (unsigned short)(unsigned int)atlasW;
+	merged.CommonData.scaleH = (unsigned short)(unsigned int)atlasH;
+	merged.CommonData.pages = (unsigned short)page_count;
+
+	std::vector<bmfm::Atlas> pages;
+	std::vector<std::vector<bmfm::MipRect>> glyphs(page_count);
+	for (unsigned int p = 0; p < page_count; ++p)
+	{
+		pages.emplace_back((unsigned int)atlasW, (unsigned int)atlasH, storage);
+		merged.PageMap.insert(std::make_pair(p, bmfm::BMFPageData{ p, page_filename(output_atlas_name, p, page_count) }));
+	}
+
+	std::map<unsigned int, size_t> owner; // codepoint -> document
+	for (size_t i = 0; i < sources.size(); ++i)
+	{
+		const bmfm::BMFontDocument& doc = docs[sources[i].doc];
+		bmfm::BMFCharData cd = doc.CharMap.at(sources[i].id);
+		const PagedRect& pr = placements[i];
+
+		if (!doc.AltasMap.count(cd.page))
+			std::cerr << "Warning: Missing page " << (unsigned int)cd.page << " in " << inputs[sources[i].doc] << std::endl;
+		else if (!pages[pr.page].BitBlt(doc.AltasMap.at(cd.page), pr.rect.x, pr.rect.y, cd.x, cd.y, cd.width, cd.height))
+			std::cerr << "Warning: Glyph of codepoint 0x" << std::hex << cd.id << std::dec
+				<< " lies outside of its page in " << inputs[sources[i].doc] << std::endl;
+
+		glyphs[pr.page].push_back(bmfm::MipRect{ (unsigned int)pr.rect.x, (unsigned int)pr.rect.y, cd.width, cd.height });
+		cd.x = (unsigned short)pr.rect.x;
+		cd.y = (unsigned short)pr.rect.y;
+		cd.page = (unsigned char)pr.page;
+		merged.CharMap.insert(std::make_pair(cd.id, cd));
+		owner.insert(std::make_pair(cd.id, sources[i].doc));
+	}
+
+	// Keep kerning pairs whose glyphs both come from the same document.
+	for (size_t d = 0; d < docs.size(); ++d)
+	{
+		for (const auto& pair : docs[d].KerningMap)
+		{
+			auto first = owner.find(pair.second.first);
+			auto second = owner.find(pair.second.second);
+			if (first != owner.end() && second != owner.end() && first->second == d && second->second == d)
+				merged.KerningMap.insert(pair);
+		}
+	}
+
+	std::cout << "Info: " << merged.CharMap.size() << " chars merged into " << page_count << " page(s)." << std::endl;
+
+	// Replace any packer state left from an earlier build of output_xml_name,
+	// so that -a appends into the free space of the merged pages.
+	std::vector<rbp::MaxRectsBinPack> pack_state;
+	rebuild_pack_state(merged, 1, pack_state);
+	if (!merged.SaveToXML(output_xml_name) || !save_pack_state(pack_state_path(output_xml_name), merged, pack_state))
+		return false;
+
+	bool ret = true;
+	for (unsigned int p = 0; p < page_count; ++p)
+		ret = save_page(pages[p], merged.PageMap[p].filename, options, glyphs[p]) && ret;
+	return ret;
+}
@@ -0,0 +1,17 @@
+#pragma once
+
+#include <string>
+#include <vector>
+#include "pages.h"
+
+// Loads the given BMFont documents and re-packs all of their glyphs into
+// as few atlasW x atlasH pages as possible, writing one merged document.
+// With size_search, the smallest single page that fits them all is used
+// instead, cropped to its glyphs, if there is one. Glyphs are packed by
+// the given packers, see pack_pages().
+// Glyphs of codepoints already taken by an earlier document are dropped.
+// Pages are kept in the given storage and saved with save_page().
+bool merge_documents(const std::vector<std::string>& inputs, int atlasW, int atlasH, const PageSizeSearch& size_search,
+	const std::vector<PackerConfig>& packers,
+	const std::string& output_xml_name, const std::string& output_atlas_name, const PageOptions& options,
+	bmfm::AtlasStorage storage = bmfm::AtlasStorage::Sparse);
@@ -0,0 +1,139 @@
+#include "packstate.h"
+
+#include <stdio.h>
+#include <string.h>
+#include <hash.h>
+#include <utils.h>
+
+// A text file: a header line, then per page a line with its counts of
+// used and free rects followed by one line per rect.
+static const char* const _header = "pcf2bmfont-pack 2";
+
+// Identifies where the chars of doc are, so that a state left from another
+// build of the font is not taken for this one.
+static unsigned long long _placement_hash(const bmfm::BMFontDocument& doc)
+{
+	bmfm::Hash64 hash;
+	for (const auto& pair : doc.CharMap)
+	{
+		const bmfm::BMFCharData& cd = pair.second;
+		const unsigned int fields[6] = { cd.id, cd.x, cd.y, cd.width, cd.height, cd.page };
+		hash.Update(fields, sizeof(fields));
+	}
+	return hash.Digest();
+}
+
+std::string pack_state_path(const std::string& xml_path)
+{
+	return xml_path + ".pack";
+}
+
+void build_pack_state(int w, int h, const std::vector<PagedRect>& rects, unsigned int page_count,
+	std::vector<rbp::MaxRectsBinPack>& pages)
+{
+	pages.assign(page_count, rbp::MaxRectsBinPack(w, h, false));
+	for (const auto& pr : rects)
+	{
+		if (pr.page < page_count)
+			pages[pr.page].Occupy(pr.rect);
+	}
+}
+
+void rebuild_pack_state(const bmfm::BMFontDocument& doc, int spacing, std::vector<rbp::MaxRectsBinPack>& pages)
+{
+	std::vector<PagedRect> rects;
+	for (const auto& pair : doc.CharMap)
+	{
+		const bmfm::BMFCharData& cd = pair.second;
+		rects.push_back(PagedRect{ cd.page, rbp::Rect{ cd.x, cd.y, cd.width + spacing, cd.height + spacing } });
+	}
+	build_pack_state(doc.CommonData.scaleW, doc.CommonData.scaleH, rects, (unsigned int)doc.PageMap.size(), pages);
+}
+
+static void _append_rects(std::string& text, char kind, const std::vector<rbp::Rect>& rects)
+{
+	char line[64];
+	for (const auto& r : rects)
+	{
+		::snprintf(line, sizeof(line), "%c %d %d %d %d\n", kind, r.x, r.y, r.width, r.height);
+		text += line;
+	}
+}
+
+bool save_pack_state(const std::string& path, const bmfm::BMFontDocument& doc, const std::vector<rbp::MaxRectsBinPack>& pages)
+{
+	char line[96];
+	::snprintf(line, sizeof(line), "%s %d %d %u %016llx\n", _header, (int)doc.CommonData.scaleW, (int)doc.CommonData.scaleH,
+		(unsigned int)pages.size(), _placement_hash(doc));
+	std::string text = line;
+	for (const auto& page : pages)
+	{
+		::snprintf(line, sizeof(line), "page %u %u\n",
+			(unsigned int)page.GetUsedRectangles().size(), (unsigned int)page.GetFreeRectangles().size());
+		text += line;
+		_append_rects(text, 'u', page.GetUsedRectangles());
+		_append_rects(text, 'f', page.GetFreeRectangles());
+	}
+	return bmfm::savefile(path.c_str(), text.data(), text.size());
+}
+
+// Rects are read one by one rather than allocated up front, so a corrupt
+// count ends the read at the end of the file instead of exhausting memory.
+static bool _read_rects(FILE* f, char kind, unsigned int count, std::vector<rbp::Rect>& rects)
+{
+	rects.clear();
+	for (unsigned int i = 0; i < count; ++i)
+	{
+		char k = 0;
+		rbp::Rect r;
+		if (5 != ::fscanf(f, " %c %d %d %d %d", &k, &r.x, &r.y, &r.width, &r.height) || k != kind)
+			return false;
+		rects.push_back(r);
+	}
+	return true;
+}
+
+bool load_pack_state(const std::string& path, const bmfm::BMFontDocument& doc, std::vector<rbp::MaxRectsBinPack>& pages)
+{
+	FILE* f = ::fopen(path.c_str(), "rb");
+	if (!f)
+		return false;
+
+	bool ok = false;
+	do
+	{
+		char header[96] = { 0 };
+		if (!::fgets(header, sizeof(header), f))
+			break;
+
+		const int w = doc.CommonData.scaleW;
+		const int h = doc.CommonData.scaleH;
+		int fw = 0, fh = 0;
+		unsigned int count = 0;
+		unsigned long long hash = 0;
+		if (0 != ::strncmp(header, _header, ::strlen(_header)) ||
+			4 != ::sscanf(header + ::strlen(_header), "%d %d %u %llx", &fw, &fh, &count, &hash) ||
+			fw != w || fh != h || count != doc.PageMap.size() || hash != _placement_hash(doc))
+			break;
+
+		// Neither the used nor the free rects of a page can outnumber its pixels.
+		const unsigned long long max_rects = (unsigned long long)w * h;
+		pages.assign(count, rbp::MaxRectsBinPack());
+		std::vector<rbp::Rect> used, free;
+		unsigned int p = 0;
+		for (; p < count; ++p)
+		{
+			unsigned int used_count = 0, free_count = 0;
+			if (2 != ::fscanf(f, " page %u %u", &used_count, &free_count) || used_count > max_rects || free_count > max_rects ||
+				!_read_rects(f, 'u', used_count, used) || !_read_rects(f, 'f', free_count, free))
+				break;
+			pages[p].Restore(w, h, false, used, free);
+		}
+		ok = (p == count);
+	} while (false);
+
+	::fclose(f);
+	if (!ok)
+		bmfm::logerrfmt("Warning: Ignoring invalid packer state: %s", path.c_str());
+	return ok;
+}
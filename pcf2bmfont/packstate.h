@@ -0,0 +1,29 @@
+#pragma once
+
+#include <string>
+#include <vector>
+#include <MaxRectsBinPack.h>
+#include <bmfont.h>
+#include "pages.h"
+
+// The packer state of a font: one MaxRects bin per page, holding where
+// glyphs went and the free space left. It is kept next to the BMFont file
+// so glyphs can be appended later (-a) without moving the ones there.
+
+// Returns the path of the packer state of the BMFont file at xml_path.
+std::string pack_state_path(const std::string& xml_path);
+
+// Builds the bins of page_count w x h pages from where rects went.
+void build_pack_state(int w, int h, const std::vector<PagedRect>& rects, unsigned int page_count,
+	std::vector<rbp::MaxRectsBinPack>& pages);
+
+// Builds the bins from the chars of doc, each taking spacing more pixels
+// right of and below it. For fonts whose packer state is gone.
+void rebuild_pack_state(const bmfm::BMFontDocument& doc, int spacing, std::vector<rbp::MaxRectsBinPack>& pages);
+
+// Saves the bins of the pages of doc, along with a hash of where its chars are.
+bool save_pack_state(const std::string& path, const bmfm::BMFontDocument& doc, const std::vector<rbp::MaxRectsBinPack>& pages);
+
+// Returns false if there is no valid state at path, or it was saved for
+// other pages or char placements than those of doc.
+bool load_pack_state(const std::string& path, const bmfm::BMFontDocument& doc, std::vector<rbp::MaxRectsBinPack>& pages);
@@ -0,0 +1,534 @@
+#include "pages.h"
+
+#include <algorithm>
+#include <atomic>
+#include <mutex>
+#include <thread>
+#include <ctype.h>
+#include <stdio.h>
+#include <GridBinPack.h>
+#include <GuillotineBinPack.h>
+#include <MaxRectsBinPack.h>
+#include <SkylineBinPack.h>
+#include <utils.h>
+#include <hash.h>
+
+static const char* const _maxrects_names[] = { "bssf", "blsf", "baf", "bl", "cp" };
+static const char* const _skyline_names[] = { "bl", "mw" };
+static const char* const _guillotine_names[] = { "baf", "bssf", "blsf", "waf", "wssf", "wlsf" };
+static const char* const _split_names[] = { "slas", "llas", "minas", "maxas", "sas", "las" };
+
+#define _countof_names(a) ((int)(sizeof(a) / sizeof(a[0])))
+
+static void _add_family(const std::string& family, std::vector<PackerConfig>& packers)
+{
+	PackerConfig c;
+	if (family == "maxrects" || family == "all")
+	{
+		c.algorithm = PackerConfig::MaxRects;
+		for (c.heuristic = 0; c.heuristic < _countof_names(_maxrects_names); ++c.heuristic)
+			packers.push_back(c);
+	}
+	if (family == "skyline" || family == "all")
+	{
+		c.algorithm = PackerConfig::Skyline;
+		for (c.heuristic = 0; c.heuristic < _countof_names(_skyline_names); ++c.heuristic)
+			for (int wm = 0; wm < 2; ++wm)
+			{
+				c.option = (wm != 0);
+				packers.push_back(c);
+			}
+	}
+	if (family == "guillotine" || family == "all")
+	{
+		c.algorithm = PackerConfig::Guillotine;
+		c.option = true;
+		for (c.heuristic = 0; c.heuristic < _countof_names(_guillotine_names); ++c.heuristic)
+			for (c.split = 0; c.split < _countof_names(_split_names); ++c.split)
+				packers.push_back(c);
+	}
+}
+
+std::string packer_name(const PackerConfig& packer)
+{
+	switch (packer.algorithm)
+	{
+	case PackerConfig::MaxRects:
+		return std::string("maxrects-") + _maxrects_names[packer.heuristic];
+	case PackerConfig::Skyline:
+		return std::string("skyline-") + _skyline_names[packer.heuristic] + (packer.option ? "-wastemap" : "");
+	case PackerConfig::Guillotine:
+		return std::string("guillotine-") + _guillotine_names[packer.heuristic] + "-" + _split_names[packer.split]
+			+ (packer.option ? "-merge" : "");
+	}
+	return std::string();
+}
+
+bool parse_packers(const std::string& list, std::vector<PackerConfig>& packers)
+{
+	// Every name a packer can have, to look the given ones up in.
+	std::vector<PackerConfig> known;
+	_add_family("all", known);
+	for (int choice = 0; choice < _countof_names(_guillotine_names); ++choice)
+		for (int split = 0; split < _countof_names(_split_names); ++split)
+		{
+			PackerConfig c;
+			c.algorithm = PackerConfig::Guillotine;
+			c.heuristic = choice;
+			c.split = split;
+			known.push_back(c);
+		}
+
+	size_t begin = 0;
+	while (begin <= list.size())
+	{
+		size_t end = list.find(',', begin);
+		if (end == std::string::npos)
+			end = list.size();
+		std::string name = list.substr(begin, end - begin);
+		begin = end + 1;
+
+		if (name == "maxrects" || name == "skyline" || name == "guillotine" || name == "all")
+		{
+			_add_family(name, packers);
+			continue;
+		}
+
+		auto it = std::find_if(known.begin(), known.end(), [&name](const PackerConfig& c) { return packer_name(c) == name; });
+		if (it == known.end())
+		{
+			bmfm::logerrfmt("Error: Unknown packer '%s'.", name.c_str());
+			return false;
+		}
+		packers.push_back(*it);
+	}
+	return true;
+}
+
+// One page of a packer of the portfolio.
+class _PackerPage
+{
+public:
+	_PackerPage(const PackerConfig& config, int w, int h)
+		: _config(config)
+	{
+		switch (config.algorithm)
+		{
+		case PackerConfig::MaxRects: _maxrects.Init(w, h, false); break;
+		case PackerConfig::Skyline: _skyline.Init(w, h, config.option, false); break;
+		case PackerConfig::Guillotine: _guillotine.Init(w, h, false); break;
+		}
+	}
+
+	rbp::Rect Insert(int w, int h)
+	{
+		switch (_config.algorithm)
+		{
+		case PackerConfig::MaxRects:
+			return _maxrects.Insert(w, h, (rbp::MaxRectsBinPack::FreeRectChoiceHeuristic)_config.heuristic);
+		case PackerConfig::Skyline:
+			return _skyline.Insert(w, h, (rbp::SkylineBinPack::LevelChoiceHeuristic)_config.heuristic);
+		case PackerConfig::Guillotine:
+			return _guillotine.Insert(w, h, _config.option, (rbp::GuillotineBinPack::FreeRectChoiceHeuristic)_config.heuristic,
+				(rbp::GuillotineBinPack::GuillotineSplitHeuristic)_config.split);
+		}
+		return rbp::Rect{ 0, 0, 0, 0 };
+	}
+
+	float Occupancy() const
+	{
+		switch (_config.algorithm)
+		{
+		case PackerConfig::MaxRects: return _maxrects.Occupancy();
+		case PackerConfig::Skyline: return _skyline.Occupancy();
+		case PackerConfig::Guillotine: return _guillotine.Occupancy();
+		}
+		return 0.f;
+	}
+
+private:
+	PackerConfig _config;
+	rbp::MaxRectsBinPack _maxrects;
+	rbp::SkylineBinPack _skyline;
+	rbp::GuillotineBinPack _guillotine;
+};
+
+struct _PackResult
+{
+	bool ok = false;
+	std::vector<PagedRect> out;
+	std::vector<float> occupancy; // Of each page.
+};
+
+// Packs sizes, tall ones first, into the first page with room for them.
+static void _pack_with(const std::vector<rbp::RectSize>& sizes, const std::vector<size_t>& order,
+	int w, int h, const PackerConfig& config, unsigned int max_pages, _PackResult& result)
+{
+	result.out.assign(sizes.size(), PagedRect{ 0, rbp::Rect{ 0, 0, 0, 0 } });
+
+	std::vector<_PackerPage> bins;
+	for (size_t i : order)
+	{
+		const rbp::RectSize& sz = sizes[i];
+		if (sz.width > w || sz.height > h)
+			return;
+
+		// Nothing to place, the packers would report it as not fitting.
+		if (sz.width <= 0 || sz.height <= 0)
+			continue;
+
+		bool placed = false;
+		for (size_t p = 0; p < bins.size() && !placed; ++p)
+		{
+			rbp::Rect r = bins[p].Insert(sz.width, sz.height);
+			if (r.height != 0)
+			{
+				result.out[i] = PagedRect{ (unsigned int)p, r };
+				placed = true;
+			}
+		}
+
+		if (!placed)
+		{
+			if (max_pages != 0 && bins.size() >= max_pages)
+				return;
+			bins.emplace_back(config, w, h);
+			rbp::Rect r = bins.back().Insert(sz.width, sz.height);
+			if (r.height == 0)
+				return;
+			result.out[i] = PagedRect{ (unsigned int)(bins.size() - 1), r };
+		}
+	}
+
+	for (const auto& bin : bins)
+		result.occupancy.push_back(bin.Occupancy());
+	result.ok = true;
+}
+
+static bool _better(const _PackResult& a, const _PackResult& b)
+{
+	if (a.ok != b.ok)
+		return a.ok;
+	if (a.occupancy.size() != b.occupancy.size())
+		return a.occupancy.size() < b.occupancy.size();
+	for (size_t p = 0; p < a.occupancy.size(); ++p)
+		if (a.occupancy[p] != b.occupancy[p])
+			return a.occupancy[p] > b.occupancy[p];
+	return false;
+}
+
+bool pack_pages_portfolio(const std::vector<rbp::RectSize>& sizes, int w, int h,
+	const std::vector<PackerConfig>& packers,
+	std::vector<PagedRect>& out, unsigned int& page_count, unsigned int max_pages, size_t* picked, unsigned int threads)
+{
+	// Tall rects first, it gives the packers a better shot at filling each page.
+	std::vector<size_t> order(sizes.size());
+	for (size_t i = 0; i < order.size(); ++i)
+		order[i] = i;
+	std::stable_sort(order.begin(), order.end(), [&sizes](size_t a, size_t b) {
+		if (sizes[a].height != sizes[b].height)
+			return sizes[a].height > sizes[b].height;
+		return sizes[a].width > sizes[b].width;
+	});
+
+	const std::vector<PackerConfig> configs = packers.empty() ? std::vector<PackerConfig>(1) : packers;
+	const size_t count = configs.size();
+	std::vector<_PackResult> results(count);
+
+	if (threads == 0)
+		threads = std::thread::hardware_concurrency();
+	if (threads == 0)
+		threads = 1;
+	if (threads > count)
+		threads = (unsigned int)count;
+
+	std::atomic<size_t> next(0);
+	auto worker = [&]() {
+		for (size_t i = next++; i < count; i = next++)
+			_pack_with(sizes, order, w, h, configs[i], max_pages, results[i]);
+	};
+
+	std::vector<std::thread> pool;
+	for (unsigned int i = 1; i < threads; ++i)
+		pool.emplace_back(worker);
+	worker();
+	for (auto& t : pool)
+		t.join();
+
+	// Ties go to the earlier packer, so the output does not depend on timing.
+	size_t best = 0;
+	for (size_t i = 1; i < count; ++i)
+		if (_better(results[i], results[best]))
+			best = i;
+
+	if (picked)
+		*picked = best;
+	out.swap(results[best].out);
+	page_count = (unsigned int)results[best].occupancy.size();
+	return results[best].ok;
+}
+
+bool pack_pages(const std::vector<rbp::RectSize>& sizes, int w, int h,
+	std::vector<PagedRect>& out, unsigned int& page_count, unsigned int max_pages,
+	const std::vector<PackerConfig>& packers, size_t* picked, unsigned int threads)
+{
+	out.assign(sizes.size(), PagedRect{ 0, rbp::Rect{ 0, 0, 0, 0 } });
+	page_count = 0;
+
+	// Same sized rects fill a grid in their order, one page after another.
+	if (!sizes.empty() && rbp::GridBinPack::IsUniform(sizes) && sizes[0].width > 0 && sizes[0].height > 0)
+	{
+		if (sizes[0].width > w || sizes[0].height > h)
+			return false;
+
+		rbp::GridBinPack grid(w, h, sizes[0].width, sizes[0].height);
+		for (size_t i = 0; i < sizes.size(); ++i)
+		{
+			rbp::Rect r = grid.Insert(sizes[i].width, sizes[i].height);
+			if (r.height == 0)
+			{
+				if (max_pages != 0 && page_count + 1 >= max_pages)
+					return false;
+				grid.Init(w, h, sizes[0].width, sizes[0].height);
+				r = grid.Insert(sizes[i].width, sizes[i].height);
+				++page_count;
+			}
+			out[i] = PagedRect{ page_count, r };
+		}
+		++page_count;
+		return true;
+	}
+
+	return pack_pages_portfolio(sizes, w, h, packers, out, page_count, max_pages, picked, threads);
+}
+
+static std::vector<int> _candidate_sizes(const PageSizeSearch& search, int min_size, int max_size)
+{
+	std::vector<int> sizes;
+	if (search.step == 0)
+	{
+		for (long long s = 1; s <= max_size; s *= 2)
+			if (s >= min_size)
+				sizes.push_back((int)s);
+	}
+	else
+	{
+		for (long long s = search.step; s <= max_size; s += search.step)
+			if (s >= min_size)
+				sizes.push_back((int)s);
+	}
+	return sizes;
+}
+
+bool search_page_size(const PageSizeSearch& search, int max_w, int max_h,
+	int min_w, int min_h, unsigned long long min_area,
+	const std::function<bool(int, int)>& fits, int& w, int& h)
+{
+	const std::vector<int> widths = _candidate_sizes(search, min_w, max_w);
+	const std::vector<int> heights = _candidate_sizes(search, min_h, max_h);
+	if (widths.empty() || heights.empty())
+		return false;
+
+	// Whether candidate a x b comes before c x d: smaller area, then shorter
+	// longer side, then narrower.
+	auto before = [](int a, int b, int c, int d) {
+		unsigned long long area_ab = (unsigned long long)a * b;
+		unsigned long long area_cd = (unsigned long long)c * d;
+		if (area_ab != area_cd)
+			return area_ab < area_cd;
+		if (std::max(a, b) != std::max(c, d))
+			return std::max(a, b) < std::max(c, d);
+		return a < c;
+	};
+
+	// The first height of each width large enough for min_area.
+	auto lowest = [&](int cw) {
+		return (size_t)(std::partition_point(heights.begin(), heights.end(),
+			[&](int ch) { return (unsigned long long)cw * ch < min_area; }) - heights.begin());
+	};
+
+	// Widths whose lowest candidate comes first are searched first, so a
+	// small fitting candidate is found early and cuts the others short.
+	std::vector<int> order;
+	for (int cw : widths)
+		if (lowest(cw) < heights.size())
+			order.push_back(cw);
+	std::sort(order.begin(), order.end(), [&](int a, int b) {
+		return before(a, heights[lowest(a)], b, heights[lowest(b)]);
+	});
+
+	const size_t count = order.size();
+	if (count == 0)
+		return false;
+
+	unsigned int threads = std::thread::hardware_concurrency();
+	if (threads == 0)
+		threads = 1;
+	if (threads > count)
+		threads = (unsigned int)count;
+
+	std::mutex lock;
+	int best_w = 0, best_h = 0;
+	std::atomic<unsigned int> tried(0);
+
+	// Heights [lo, hi) of width cw which still come before the best fit.
+	auto limit = [&](int cw, size_t lo, size_t hi) {
+		std::lock_guard<std::mutex> guard(lock);
+		if (best_w == 0)
+			return hi;
+		return (size_t)(std::partition_point(heights.begin() + lo, heights.begin() + hi,
+			[&](int ch) { return before(cw, ch, best_w, best_h); }) - heights.begin());
+	};
+
+	// A page of the same width and more height fits whatever a lower one
+	// does, so each width only needs a bisection for its lowest fitting
+	// height, among the heights which come before the best fit so far.
+	std::atomic<size_t> next(0);
+	auto worker = [&]() {
+		for (size_t i = next++; i < count; i = next++)
+		{
+			const int cw = order[i];
+			size_t lo = lowest(cw);
+			size_t hi = limit(cw, lo, heights.size());
+			size_t found = heights.size();
+			while (lo < (hi = limit(cw, lo, hi)))
+			{
+				size_t mid = lo + (hi - lo) / 2;
+				++tried;
+				if (fits(cw, heights[mid]))
+					found = hi = mid;
+				else
+					lo = mid + 1;
+			}
+			if (found == heights.size())
+				continue;
+
+			std::lock_guard<std::mutex> guard(lock);
+			if (best_w == 0 || before(cw, heights[found], best_w, best_h))
+			{
+				best_w = cw;
+				best_h = heights[found];
+			}
+		}
+	};
+
+	std::vector<std::thread> pool;
+	for (unsigned int i = 1; i < threads; ++i)
+		pool.emplace_back(worker);
+	worker();
+	for (auto& t : pool)
+		t.join();
+
+	if (best_w == 0)
+		return false;
+
+	w = best_w;
+	h = best_h;
+	bmfm::logfmt("Info: Page size %dx%d picked after %u trial packs.", w, h, tried.load());
+	return true;
+}
+
+int crop_page_size(const PageSizeSearch& search, int used, int size)
+{
+	int cropped = 1;
+	if (search.step == 0)
+	{
+		while (cropped < used)
+			cropped *= 2;
+	}
+	else
+		cropped = (int)(((unsigned int)std::max(used, 1) + search.step - 1) / search.step * search.step);
+	return std::min(cropped, size);
+}
+
+std::string page_filename(const std::string& base, unsigned int page, unsigned int page_count)
+{
+	if (page_count <= 1)
+		return base;
+
+	std::string suffix = "_" + std::to_string(page);
+	size_t dot = base.find_last_of('.');
+	size_t sep = base.find_last_of("/\\");
+	if (dot == std::string::npos || (sep != std::string::npos && dot < sep))
+		return base + suffix;
+	return base.substr(0, dot) + suffix + base.substr(dot);
+}
+
+static bool _write_page(bmfm::Atlas& atlas, const std::string& path, const PageOptions& options,
+	const std::vector<bmfm::MipRect>& glyphs)
+{
+	if (options.format == PageFormat::PNG)
+		return atlas.SaveToPNG(path, options.profile, options.threads);
+
+	bmfm::MipSettings mips{ options.mip_filter, options.mip_extrude, glyphs };
+	const bmfm::MipSettings* chain = options.mips ? &mips : nullptr;
+	bmfm::TextureFormat tf = (options.format == PageFormat::BC4) ? bmfm::TextureFormat::BC4 : bmfm::TextureFormat::R8;
+	size_t dot = path.find_last_of('.');
+	std::string ext = (dot == std::string::npos) ? "" : path.substr(dot);
+	std::transform(ext.begin(), ext.end(), ext.begin(), [](char c) { return (char)::tolower((unsigned char)c); });
+	if (ext == ".dds")
+		return atlas.SaveToDDS(path, tf, 3, chain, options.threads);
+	return atlas.SaveToKTX2(path, tf, 3, chain, options.threads);
+}
+
+static bool _file_size(const std::string& path, long& size)
+{
+	FILE* f = ::fopen(path.c_str(), "rb");
+	if (!f)
+		return false;
+	bool ok = ::fseek(f, 0, SEEK_END) == 0 && (size = ::ftell(f)) >= 0;
+	::fclose(f);
+	return ok;
+}
+
+static std::string _read_line(const std::string& path)
+{
+	FILE* f = ::fopen(path.c_str(), "rb");
+	if (!f)
+		return std::string();
+	char buf[128];
+	std::string line = ::fgets(buf, sizeof(buf), f) ? buf : "";
+	::fclose(f);
+	return line;
+}
+
+bool save_page(bmfm::Atlas& atlas, const std::string& path, const PageOptions& options,
+	const std::vector<bmfm::MipRect>& glyphs)
+{
+	if (!options.skip_unchanged)
+		return _write_page(atlas, path, options, glyphs);
+
+	// The stamp: what the page was written from and the size of the file it became.
+	unsigned long long mipKey = 0;
+	if (options.mips && options.format != PageFormat::PNG)
+	{
+		bmfm::Hash64 hash;
+		if (!glyphs.empty())
+			hash.Update(&glyphs[0], glyphs.size() * sizeof(glyphs[0]));
+		mipKey = hash.Digest() ^ ((unsigned long long)options.mip_filter << 32) ^ options.mip_extrude;
+	}
+	char key[96];
+	::snprintf(key, sizeof(key), "%016llx %d %d %016llx ", atlas.GetContentHash(),
+		(int)options.format, (int)options.profile, mipKey);
+	std::string stamp_path = path + ".hash";
+	long size = 0;
+	if (_file_size(path, size) && _read_line(stamp_path) == key + std::to_string(size) + "\n")
+	{
+		bmfm::logfmt("Info: %s is unchanged, not rewritten.", path.c_str());
+		return true;
+	}
+
+	// No stamp while the page is being written, a failed write must not
+	// leave one behind that claims the page is up to date.
+	::remove(stamp_path.c_str());
+	if (!_write_page(atlas, path, options, glyphs))
+		return false;
+	if (!_file_size(path, size))
+	{
+		bmfm::logerrfmt("Error: save_page(): Unable to stat file: %s", path.c_str());
+		return false;
+	}
+
+	std::string stamp = key + std::to_string(size) + "\n";
+	return bmfm::savefile(stamp_path.c_str(), stamp.data(), stamp.size());
+}
@@ -0,0 +1,112 @@
+#pragma once
+
+#include <functional>
+#include <string>
+#include <vector>
+#include <Rect.h>
+#include <atlas.h>
+
+struct PagedRect
+{
+	unsigned int page;
+	rbp::Rect rect;
+};
+
+// A packer of the portfolio (-S) and the heuristics it runs with.
+struct PackerConfig
+{
+	enum Algorithm
+	{
+		MaxRects = 0,
+		Skyline,
+		Guillotine,
+	};
+
+	Algorithm algorithm = MaxRects;
+	int heuristic = 0; // The FreeRectChoiceHeuristic or LevelChoiceHeuristic of the packer.
+	int split = 0;     // Guillotine only, a GuillotineSplitHeuristic.
+	bool option = false; // Skyline: use the waste map. Guillotine: merge free rects.
+};
+
+// Parses a comma separated list of packer names (see packer_name()), or of
+// "maxrects", "skyline", "guillotine" and "all" for every variant of them.
+bool parse_packers(const std::string& list, std::vector<PackerConfig>& packers);
+
+// Returns the name of the packer, e.g. "maxrects-bssf", "skyline-bl-wastemap"
+// or "guillotine-baf-sas-merge".
+std::string packer_name(const PackerConfig& packer);
+
+// Packs sizes into as many w x h pages as needed. out[i] is the placement
+// of sizes[i]. Returns false if some size does not fit even an empty page,
+// or if more than max_pages pages would be needed (0 is no limit).
+// Same sized rects fill a grid. Others are packed by every given packer
+// (MaxRects BSSF if none) concurrently on up to threads threads (0 is one
+// per hardware thread), and the best result is kept; its index goes to
+// picked, if given.
+bool pack_pages(const std::vector<rbp::RectSize>& sizes, int w, int h,
+	std::vector<PagedRect>& out, unsigned int& page_count, unsigned int max_pages = 0,
+	const std::vector<PackerConfig>& packers = std::vector<PackerConfig>(), size_t* picked = nullptr,
+	unsigned int threads = 0);
+
+// As pack_pages(), but never lays sizes out on a grid. Results are ranked
+// by page count, then by the Occupancy() of each page in turn, so the last
+// page is left as empty as possible; ties go to the earlier packer.
+bool pack_pages_portfolio(const std::vector<rbp::RectSize>& sizes, int w, int h,
+	const std::vector<PackerConfig>& packers,
+	std::vector<PagedRect>& out, unsigned int& page_count, unsigned int max_pages = 0, size_t* picked = nullptr,
+	unsigned int threads = 0);
+
+// Page size search (-A). Candidate sizes are powers of two, or multiples
+// of step, no larger than the given -W x -H.
+struct PageSizeSearch
+{
+	bool enabled = false;
+	unsigned int step = 0; // 0 searches powers of two.
+};
+
+// Finds the smallest w x h candidate page, by area and then by its longer
+// side, for which fits(w, h) holds. Candidates narrower than min_w, lower
+// than min_h or smaller than min_area are not tried. fits is taken to hold
+// for every higher page of a width it holds for, so each width is only
+// bisected for its lowest fitting height, widths concurrently, and heights
+// no better than a candidate known to fit are dropped. The result does not
+// depend on timing. As the widths run on all cores, fits should not start
+// threads of its own. Returns false if no candidate fits.
+bool search_page_size(const PageSizeSearch& search, int max_w, int max_h,
+	int min_w, int min_h, unsigned long long min_area,
+	const std::function<bool(int, int)>& fits, int& w, int& h);
+
+// Rounds used up to a candidate size of the search (see PageSizeSearch),
+// at most size. For cropping a page to the extent of what is on it.
+int crop_page_size(const PageSizeSearch& search, int used, int size);
+
+// Returns base for single page fonts, "name_<page>.ext" otherwise.
+std::string page_filename(const std::string& base, unsigned int page, unsigned int page_count);
+
+enum class PageFormat
+{
+	PNG = 0,
+	R8,  // Alpha channel as an uncompressed R8 texture.
+	BC4, // Alpha channel as a BC4 compressed texture.
+};
+
+// How pages are written.
+struct PageOptions
+{
+	PageFormat format = PageFormat::PNG;
+	bmfm::PNGWriteProfile profile = bmfm::PNGWriteProfile::Default; // PNG pages only.
+	bool skip_unchanged = false;
+	bool mips = false; // Texture pages only, see bmfm::BuildMipChain().
+	bmfm::MipFilter mip_filter = bmfm::MipFilter::Box;
+	unsigned int mip_extrude = 0;
+	unsigned int threads = 0; // Threads encoding one page may use, 0 for one per hardware thread.
+};
+
+// Saves a page. Textures go to a DDS file if path ends with ".dds",
+// to a KTX2 file otherwise. Their mip chains keep glyphs, the rects
+// of the page's glyphs, apart.
+// With skip_unchanged, the content hash of the page is recorded in
+// path + ".hash", and the page is not encoded nor written again as long
+// as it, the options and the glyphs stay the same and the file is there.
+bool save_page(bmfm::Atlas& atlas, const std::string& path, const PageOptions& options,
+	const std::vector<bmfm::MipRect>& glyphs = std::vector<bmfm::MipRect>());
@@ -6,6 +6,7 @@
 /* @(#) $Id$ */
 
 #include "zutil.h"
+#include "adler32_simd.h"
 
 local uLong adler32_combine_ OF((uLong adler1, uLong adler2, z_off64_t len2));
 
@@ -87,6 +88,20 @@ uLong ZEXPORT adler32_z(adler, buf, len)
     if (buf == Z_NULL)
         return 1L;
 
+#if defined(ADLER32_SIMD_AVX2) || defined(ADLER32_SIMD_SSSE3)
+    if (len >= Z_ADLER32_SIMD_MINIMUM_LENGTH) {
+        cpu_check_features();
+#  ifdef ADLER32_SIMD_AVX2
+        if (x86_cpu_enable_avx2)
+            return adler32_avx2_simd_(adler | (sum2 << 16), buf, len);
+#  endif
+#  ifdef ADLER32_SIMD_SSSE3
+        if (x86_cpu_enable_ssse3)
+            return adler32_ssse3_simd_(adler | (sum2 << 16), buf, len);
+#  endif
+    }
+#endif
+
     /* in case short lengths are provided, keep it somewhat fast */
     if (len < 16) {
         while (len--) {
@@ -0,0 +1,166 @@
+/* adler32_simd.c -- Adler-32 with SSSE3 and AVX2
+ * For conditions of distribution and use, see copyright notice in zlib.h
+ *
+ * Per block of bytes b[0..n-1], s1 grows by the sum of the bytes and s2
+ * grows by n * s1 plus the sum of (n - i) * b[i]. The byte sums come from
+ * PSADBW, the weighted sums from PMADDUBSW against the weights n..1.
+ * Both sums are reduced modulo BASE before they can overflow 32 bits,
+ * the same way adler32.c does it every NMAX bytes.
+ */
+
+#include "adler32_simd.h"
+
+#if defined(ADLER32_SIMD_SSSE3) || defined(ADLER32_SIMD_AVX2)
+
+#include <immintrin.h>
+
+#define BASE 65521U     /* largest prime smaller than 65536 */
+#define NMAX 5552
+
+/* Adds the last len < block size bytes the scalar way. */
+local uLong adler32_tail(unsigned s1, unsigned s2, const Bytef *buf, z_size_t len)
+{
+    while (len--) {
+        s1 += *buf++;
+        s2 += s1;
+    }
+    s1 %= BASE;
+    s2 %= BASE;
+    return s1 | ((uLong)s2 << 16);
+}
+
+#ifdef ADLER32_SIMD_SSSE3
+
+Z_TARGET("ssse3")
+uLong ZLIB_INTERNAL adler32_ssse3_simd_(uLong adler, const Bytef *buf, z_size_t len)
+{
+    /* Blocks of 32 bytes, in two 16 byte halves. */
+    const unsigned block_size = 32;
+    unsigned s1 = (unsigned)(adler & 0xffff);
+    unsigned s2 = (unsigned)((adler >> 16) & 0xffff);
+    z_size_t blocks = len / block_size;
+    len -= blocks * block_size;
+
+    while (blocks) {
+        const __m128i tap1 = _mm_setr_epi8(32, 31, 30, 29, 28, 27, 26, 25,
+                                           24, 23, 22, 21, 20, 19, 18, 17);
+        const __m128i tap2 = _mm_setr_epi8(16, 15, 14, 13, 12, 11, 10, 9,
+                                           8, 7, 6, 5, 4, 3, 2, 1);
+        const __m128i zero = _mm_setzero_si128();
+        const __m128i ones = _mm_set1_epi16(1);
+        __m128i v_ps, v_s1, v_s2;
+        unsigned n = NMAX / block_size;
+        if (n > blocks)
+            n = (unsigned)blocks;
+        blocks -= n;
+
+        /* v_ps sums s1 as it was before each block; times block_size,
+           that is what s2 gains from s1. */
+        v_ps = _mm_set_epi32(0, 0, 0, (int)(s1 * n));
+        v_s2 = _mm_set_epi32(0, 0, 0, (int)s2);
+        v_s1 = _mm_setzero_si128();
+
+        do {
+            const __m128i bytes1 = _mm_loadu_si128((const __m128i *)buf);
+            const __m128i bytes2 = _mm_loadu_si128((const __m128i *)(buf + 16));
+
+            v_ps = _mm_add_epi32(v_ps, v_s1);
+
+            v_s1 = _mm_add_epi32(v_s1, _mm_sad_epu8(bytes1, zero));
+            v_s2 = _mm_add_epi32(v_s2, _mm_madd_epi16(_mm_maddubs_epi16(bytes1, tap1), ones));
+            v_s1 = _mm_add_epi32(v_s1, _mm_sad_epu8(bytes2, zero));
+            v_s2 = _mm_add_epi32(v_s2, _mm_madd_epi16(_mm_maddubs_epi16(bytes2, tap2), ones));
+
+            buf += block_size;
+        } while (--n);
+
+        v_s2 = _mm_add_epi32(v_s2, _mm_slli_epi32(v_ps, 5));
+
+        /* Horizontal sums. */
+        v_s1 = _mm_add_epi32(v_s1, _mm_shuffle_epi32(v_s1, _MM_SHUFFLE(2, 3, 0, 1)));
+        v_s1 = _mm_add_epi32(v_s1, _mm_shuffle_epi32(v_s1, _MM_SHUFFLE(1, 0, 3, 2)));
+        s1 += (unsigned)_mm_cvtsi128_si32(v_s1);
+        v_s2 = _mm_add_epi32(v_s2, _mm_shuffle_epi32(v_s2, _MM_SHUFFLE(2, 3, 0, 1)));
+        v_s2 = _mm_add_epi32(v_s2, _mm_shuffle_epi32(v_s2, _MM_SHUFFLE(1, 0, 3, 2)));
+        s2 = (unsigned)_mm_cvtsi128_si32(v_s2);
+
+        s1 %= BASE;
+        s2 %= BASE;
+    }
+
+    return adler32_tail(s1, s2, buf, len);
+}
+
+#endif /* ADLER32_SIMD_SSSE3 */
+
+#ifdef ADLER32_SIMD_AVX2
+
+Z_TARGET("avx2")
+uLong ZLIB_INTERNAL adler32_avx2_simd_(uLong adler, const Bytef *buf, z_size_t len)
+{
+    /* Blocks of 64 bytes, in two 32 byte halves. */
+    const unsigned block_size = 64;
+    unsigned s1 = (unsigned)(adler & 0xffff);
+    unsigned s2 = (unsigned)((adler >> 16) & 0xffff);
+    z_size_t blocks = len / block_size;
+    len -= blocks * block_size;
+
+    while (blocks) {
+        const __m256i tap1 = _mm256_setr_epi8(64, 63, 62, 61, 60, 59, 58, 57,
+                                              56, 55, 54, 53, 52, 51, 50, 49,
+                                              48, 47, 46, 45, 44, 43, 42, 41,
+                                              40, 39, 38, 37, 36, 35, 34, 33);
+        const __m256i tap2 = _mm256_setr_epi8(32, 31, 30, 29, 28, 27, 26, 25,
+                                              24, 23, 22, 21, 20, 19, 18, 17,
+                                              16, 15, 14, 13, 12, 11, 10, 9,
+                                              8, 7, 6, 5, 4, 3, 2, 1);
+        const __m256i zero = _mm256_setzero_si256();
+        const __m256i ones = _mm256_set1_epi16(1);
+        __m256i v_ps, v_s1, v_s2;
+        __m128i h_s1, h_s2;
+        unsigned n = NMAX / block_size;
+        if (n > blocks)
+            n = (unsigned)blocks;
+        blocks -= n;
+
+        v_ps = _mm256_setr_epi32((int)(s1 * n), 0, 0, 0, 0, 0, 0, 0);
+        v_s2 = _mm256_setr_epi32((int)s2, 0, 0, 0, 0, 0, 0, 0);
+        v_s1 = _mm256_setzero_si256();
+
+        do {
+            const __m256i bytes1 = _mm256_loadu_si256((const __m256i *)buf);
+            const __m256i bytes2 = _mm256_loadu_si256((const __m256i *)(buf + 32));
+
+            v_ps = _mm256_add_epi32(v_ps, v_s1);
+
+            /* 255 * (64 + 63) still fits the signed 16 bit pair sums. */
+            v_s1 = _mm256_add_epi32(v_s1, _mm256_sad_epu8(bytes1, zero));
+            v_s2 = _mm256_add_epi32(v_s2, _mm256_madd_epi16(_mm256_maddubs_epi16(bytes1, tap1), ones));
+            v_s1 = _mm256_add_epi32(v_s1, _mm256_sad_epu8(bytes2, zero));
+            v_s2 = _mm256_add_epi32(v_s2, _mm256_madd_epi16(_mm256_maddubs_epi16(bytes2, tap2), ones));
+
+            buf += block_size;
+        } while (--n);
+
+        v_s2 = _mm256_add_epi32(v_s2, _mm256_slli_epi32(v_ps, 6));
+
+        /* Horizontal sums. */
+        h_s1 = _mm_add_epi32(_mm256_castsi256_si128(v_s1), _mm256_extracti128_si256(v_s1, 1));
+        h_s1 = _mm_add_epi32(h_s1, _mm_shuffle_epi32(h_s1, _MM_SHUFFLE(2, 3, 0, 1)));
+        h_s1 = _mm_add_epi32(h_s1, _mm_shuffle_epi32(h_s1, _MM_SHUFFLE(1, 0, 3, 2)));
+        s1 += (unsigned)_mm_cvtsi128_si32(h_s1);
+        h_s2 = _mm_add_epi32(_mm256_castsi256_si128(v_s2), _mm256_extracti128_si256(v_s2, 1));
+        h_s2 = _mm_add_epi32(h_s2, _mm_shuffle_epi32(h_s2, _MM_SHUFFLE(2, 3, 0, 1)));
+        h_s2 = _mm_add_epi32(h_s2, _mm_shuffle_epi32(h_s2, _MM_SHUFFLE(1, 0, 3, 2)));
+        s2 = (unsigned)_mm_cvtsi128_si32(h_s2);
+
+        s1 %= BASE;
+        s2 %= BASE;
+    }
+
+    return adler32_tail(s1, s2, buf, len);
+}
+
+#endif /* ADLER32_SIMD_AVX2 */
+
+#endif
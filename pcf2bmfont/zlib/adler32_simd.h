@@ -0,0 +1,24 @@
+/* adler32_simd.h -- SIMD Adler-32
+ * For conditions of distribution and use, see copyright notice in zlib.h
+ */
+
+#ifndef ADLER32_SIMD_H
+#define ADLER32_SIMD_H
+
+#include "cpu_features.h"
+
+/* Both take and return the same values as adler32_z(), buf must not be
+   Z_NULL. They pay off from this many bytes on. */
+#define Z_ADLER32_SIMD_MINIMUM_LENGTH 64
+
+#ifdef ADLER32_SIMD_SSSE3
+uLong ZLIB_INTERNAL adler32_ssse3_simd_ OF((uLong adler,
+                                            const Bytef *buf, z_size_t len));
+#endif
+
+#ifdef ADLER32_SIMD_AVX2
+uLong ZLIB_INTERNAL adler32_avx2_simd_ OF((uLong adler,
+                                           const Bytef *buf, z_size_t len));
+#endif
+
+#endif /* ADLER32_SIMD_H */
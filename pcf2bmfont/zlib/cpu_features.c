@@ -0,0 +1,83 @@
+/* cpu_features.c -- runtime detection of x86 SIMD extensions
+ * For conditions of distribution and use, see copyright notice in zlib.h
+ */
+
+#include "cpu_features.h"
+
+int ZLIB_INTERNAL x86_cpu_enable_simd = 0;
+int ZLIB_INTERNAL x86_cpu_enable_ssse3 = 0;
+int ZLIB_INTERNAL x86_cpu_enable_avx2 = 0;
+
+#if defined(CRC32_SIMD_SSE42_PCLMUL) || defined(ADLER32_SIMD_SSSE3)
+
+#if defined(_MSC_VER)
+#  include <intrin.h>
+#  include <immintrin.h>
+#else
+#  include <cpuid.h>
+#endif
+
+/* Like the DYNAMIC_CRC_TABLE tables, the flags are not mutex protected.
+   Racing threads compute and store the very same values, and a thread
+   seeing a flag not set yet merely takes the portable code path, which
+   gives the same results. */
+local volatile int cpu_features_done = 0;
+
+local void cpuid(unsigned leaf, unsigned sub, unsigned regs[4])
+{
+#if defined(_MSC_VER)
+    int r[4];
+    __cpuidex(r, (int)leaf, (int)sub);
+    regs[0] = (unsigned)r[0];
+    regs[1] = (unsigned)r[1];
+    regs[2] = (unsigned)r[2];
+    regs[3] = (unsigned)r[3];
+#else
+    __cpuid_count(leaf, sub, regs[0], regs[1], regs[2], regs[3]);
+#endif
+}
+
+/* Whether the OS saves the YMM registers on context switches. */
+local int os_saves_ymm(void)
+{
+#if defined(_MSC_VER)
+    return (_xgetbv(0) & 6) == 6;
+#else
+    unsigned lo, hi;
+    __asm__ __volatile__ ("xgetbv" : "=a"(lo), "=d"(hi) : "c"(0));
+    return (lo & 6) == 6;
+#endif
+}
+
+void ZLIB_INTERNAL cpu_check_features(void)
+{
+    unsigned regs[4];
+    unsigned max_leaf;
+
+    if (cpu_features_done)
+        return;
+
+    cpuid(0, 0, regs);
+    max_leaf = regs[0];
+    if (max_leaf >= 1) {
+        cpuid(1, 0, regs);
+        x86_cpu_enable_ssse3 = (regs[2] & (1u << 9)) != 0;
+        x86_cpu_enable_simd = (regs[2] & (1u << 20)) != 0 &&   /* SSE4.2 */
+                              (regs[2] & (1u << 1)) != 0;      /* PCLMULQDQ */
+
+        if (max_leaf >= 7 && (regs[2] & (1u << 27)) != 0 &&     /* OSXSAVE */
+            (regs[2] & (1u << 28)) != 0 && os_saves_ymm()) {   /* AVX */
+            cpuid(7, 0, regs);
+            x86_cpu_enable_avx2 = (regs[1] & (1u << 5)) != 0;
+        }
+    }
+    cpu_features_done = 1;
+}
+
+#else
+
+void ZLIB_INTERNAL cpu_check_features(void)
+{
+}
+
+#endif
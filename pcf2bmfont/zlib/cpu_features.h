@@ -0,0 +1,35 @@
+/* cpu_features.h -- runtime detection of x86 SIMD extensions
+ * For conditions of distribution and use, see copyright notice in zlib.h
+ */
+
+#ifndef CPU_FEATURES_H
+#define CPU_FEATURES_H
+
+#include "zutil.h"
+
+/* The SIMD checksums are built on x86 and x64 only. They are compiled in
+   unconditionally and picked at run time, so the binary still runs on CPUs
+   without the extensions. Define NO_SIMD_CHECKSUMS to leave them out. */
+#if !defined(NO_SIMD_CHECKSUMS) && \
+    (defined(_M_X64) || defined(_M_IX86) || defined(__x86_64__) || defined(__i386__))
+#  define CRC32_SIMD_SSE42_PCLMUL
+#  define ADLER32_SIMD_SSSE3
+#  define ADLER32_SIMD_AVX2
+#endif
+
+/* MSVC accepts any intrinsic anywhere, gcc and clang need the target
+   extensions enabled on the functions using them. */
+#if defined(_MSC_VER)
+#  define Z_TARGET(x)
+#else
+#  define Z_TARGET(x) __attribute__((target(x)))
+#endif
+
+extern int ZLIB_INTERNAL x86_cpu_enable_simd;  /* SSE4.2 and PCLMULQDQ */
+extern int ZLIB_INTERNAL x86_cpu_enable_ssse3;
+extern int ZLIB_INTERNAL x86_cpu_enable_avx2;
+
+/* Fills in the flags above. Cheap after the first call. */
+void ZLIB_INTERNAL cpu_check_features OF((void));
+
+#endif /* CPU_FEATURES_H */
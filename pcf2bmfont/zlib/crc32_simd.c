@@ -0,0 +1,137 @@
+/* crc32_simd.c -- CRC-32 with PCLMULQDQ folding
+ * For conditions of distribution and use, see copyright notice in zlib.h
+ *
+ * The CRC is folded 512 bits at a time by carry-less multiplications with
+ * powers of x modulo the CRC polynomial, then reduced to 32 bits with a
+ * Barrett reduction, as described in Intel's paper "Fast CRC Computation
+ * for Generic Polynomials Using PCLMULQDQ Instruction" (Gopal et al.).
+ * The constants are for the bit-reflected polynomial 0xEDB88320.
+ */
+
+#include "crc32_simd.h"
+
+#ifdef CRC32_SIMD_SSE42_PCLMUL
+
+#include <emmintrin.h>
+#include <smmintrin.h>
+#include <wmmintrin.h>
+
+#if defined(_MSC_VER)
+#  define Z_ALIGN16(decl) __declspec(align(16)) decl
+#else
+#  define Z_ALIGN16(decl) decl __attribute__((aligned(16)))
+#endif
+
+Z_TARGET("sse4.2,pclmul")
+z_crc_t ZLIB_INTERNAL crc32_sse42_simd_(const unsigned char *buf, z_size_t len,
+                                         z_crc_t crc)
+{
+    /* x^(512+32) and x^(512+96), x^(128+32) and x^(128+96), x^64 mod P,
+       then floor(x^64 / P) and P itself, all bit-reflected. */
+    static const Z_ALIGN16(unsigned long long k1k2[2]) = { 0x0154442bd4ULL, 0x01c6e41596ULL };
+    static const Z_ALIGN16(unsigned long long k3k4[2]) = { 0x01751997d0ULL, 0x00ccaa009eULL };
+    static const Z_ALIGN16(unsigned long long k5k0[2]) = { 0x0163cd6124ULL, 0x0000000000ULL };
+    static const Z_ALIGN16(unsigned long long poly[2]) = { 0x01db710641ULL, 0x01f7011641ULL };
+
+    __m128i x0, x1, x2, x3, x4, x5, x6, x7, x8, y5, y6, y7, y8;
+
+    x1 = _mm_loadu_si128((const __m128i *)(buf + 0x00));
+    x2 = _mm_loadu_si128((const __m128i *)(buf + 0x10));
+    x3 = _mm_loadu_si128((const __m128i *)(buf + 0x20));
+    x4 = _mm_loadu_si128((const __m128i *)(buf + 0x30));
+
+    x1 = _mm_xor_si128(x1, _mm_cvtsi32_si128((int)crc));
+
+    x0 = _mm_load_si128((const __m128i *)k1k2);
+
+    buf += 64;
+    len -= 64;
+
+    /* Fold 4 x 128 bits in parallel. */
+    while (len >= 64) {
+        x5 = _mm_clmulepi64_si128(x1, x0, 0x00);
+        x6 = _mm_clmulepi64_si128(x2, x0, 0x00);
+        x7 = _mm_clmulepi64_si128(x3, x0, 0x00);
+        x8 = _mm_clmulepi64_si128(x4, x0, 0x00);
+
+        x1 = _mm_clmulepi64_si128(x1, x0, 0x11);
+        x2 = _mm_clmulepi64_si128(x2, x0, 0x11);
+        x3 = _mm_clmulepi64_si128(x3, x0, 0x11);
+        x4 = _mm_clmulepi64_si128(x4, x0, 0x11);
+
+        y5 = _mm_loadu_si128((const __m128i *)(buf + 0x00));
+        y6 = _mm_loadu_si128((const __m128i *)(buf + 0x10));
+        y7 = _mm_loadu_si128((const __m128i *)(buf + 0x20));
+        y8 = _mm_loadu_si128((const __m128i *)(buf + 0x30));
+
+        x1 = _mm_xor_si128(x1, x5);
+        x2 = _mm_xor_si128(x2, x6);
+        x3 = _mm_xor_si128(x3, x7);
+        x4 = _mm_xor_si128(x4, x8);
+
+        x1 = _mm_xor_si128(x1, y5);
+        x2 = _mm_xor_si128(x2, y6);
+        x3 = _mm_xor_si128(x3, y7);
+        x4 = _mm_xor_si128(x4, y8);
+
+        buf += 64;
+        len -= 64;
+    }
+
+    /* Fold the 4 lanes into one. */
+    x0 = _mm_load_si128((const __m128i *)k3k4);
+
+    x5 = _mm_clmulepi64_si128(x1, x0, 0x00);
+    x1 = _mm_clmulepi64_si128(x1, x0, 0x11);
+    x1 = _mm_xor_si128(x1, x2);
+    x1 = _mm_xor_si128(x1, x5);
+
+    x5 = _mm_clmulepi64_si128(x1, x0, 0x00);
+    x1 = _mm_clmulepi64_si128(x1, x0, 0x11);
+    x1 = _mm_xor_si128(x1, x3);
+    x1 = _mm_xor_si128(x1, x5);
+
+    x5 = _mm_clmulepi64_si128(x1, x0, 0x00);
+    x1 = _mm_clmulepi64_si128(x1, x0, 0x11);
+    x1 = _mm_xor_si128(x1, x4);
+    x1 = _mm_xor_si128(x1, x5);
+
+    /* Fold the remaining 128 bit blocks. */
+    while (len >= 16) {
+        x2 = _mm_loadu_si128((const __m128i *)buf);
+
+        x5 = _mm_clmulepi64_si128(x1, x0, 0x00);
+        x1 = _mm_clmulepi64_si128(x1, x0, 0x11);
+        x1 = _mm_xor_si128(x1, x2);
+        x1 = _mm_xor_si128(x1, x5);
+
+        buf += 16;
+        len -= 16;
+    }
+
+    /* Fold 128 bits down to 64 bits. */
+    x2 = _mm_clmulepi64_si128(x1, x0, 0x10);
+    x3 = _mm_setr_epi32(~0, 0, ~0, 0);
+    x1 = _mm_srli_si128(x1, 8);
+    x1 = _mm_xor_si128(x1, x2);
+
+    x0 = _mm_loadl_epi64((const __m128i *)k5k0);
+
+    x2 = _mm_srli_si128(x1, 4);
+    x1 = _mm_and_si128(x1, x3);
+    x1 = _mm_clmulepi64_si128(x1, x0, 0x00);
+    x1 = _mm_xor_si128(x1, x2);
+
+    /* Barrett reduce to 32 bits. */
+    x0 = _mm_load_si128((const __m128i *)poly);
+
+    x2 = _mm_and_si128(x1, x3);
+    x2 = _mm_clmulepi64_si128(x2, x0, 0x10);
+    x2 = _mm_and_si128(x2, x3);
+    x2 = _mm_clmulepi64_si128(x2, x0, 0x00);
+    x1 = _mm_xor_si128(x1, x2);
+
+    return (z_crc_t)(unsigned)_mm_extract_epi32(x1, 1);
+}
+
+#endif /* CRC32_SIMD_SSE42_PCLMUL */
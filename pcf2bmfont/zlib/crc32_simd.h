@@ -0,0 +1,23 @@
+/* crc32_simd.h -- SIMD CRC-32
+ * For conditions of distribution and use, see copyright notice in zlib.h
+ */
+
+#ifndef CRC32_SIMD_H
+#define CRC32_SIMD_H
+
+#include "cpu_features.h"
+
+#ifdef CRC32_SIMD_SSE42_PCLMUL
+
+/* crc32_sse42_simd_() needs at least this many bytes, in a multiple of
+   16. crc is the shift register, that is without the pre and post
+   conditioning of crc32(). */
+#define Z_CRC32_SSE42_MINIMUM_LENGTH 64
+#define Z_CRC32_SSE42_CHUNKSIZE_MASK 15
+
+z_crc_t ZLIB_INTERNAL crc32_sse42_simd_ OF((const unsigned char *buf,
+                                            z_size_t len, z_crc_t crc));
+
+#endif
+
+#endif /* CRC32_SIMD_H */
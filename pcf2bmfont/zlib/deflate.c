@@ -51,6 +51,10 @@
 
 #include "deflate.h"
 
+#if defined(WORD_MATCH) && defined(_MSC_VER)
+#  include <intrin.h>
+#endif
+
 const char deflate_copyright[] =
    " deflate 1.2.11 Copyright 1995-2017 Jean-loup Gailly and Mark Adler ";
 /*
@@ -83,6 +87,9 @@ local block_state deflate_slow   OF((deflate_state *s, int flush));
 #endif
 local block_state deflate_rle    OF((deflate_state *s, int flush));
 local block_state deflate_huff   OF((deflate_state *s, int flush));
+local block_state deflate_quick  OF((deflate_state *s, int flush));
+local uInt common_length  OF((const Bytef *scan, const Bytef *match,
+                              uInt start));
 local void lm_init        OF((deflate_state *s));
 local void putShortMSB    OF((deflate_state *s, uInt b));
 local void flush_pending  OF((z_streamp strm));
@@ -297,7 +304,7 @@ int ZEXPORT deflateInit2_(strm, level, method, windowBits, memLevel, strategy,
 #endif
     if (memLevel < 1 || memLevel > MAX_MEM_LEVEL || method != Z_DEFLATED ||
         windowBits < 8 || windowBits > 15 || level < 0 || level > 9 ||
-        strategy < 0 || strategy > Z_FIXED || (windowBits == 8 && wrap != 1)) {
+        strategy < 0 || strategy > Z_QUICK || (windowBits == 8 && wrap != 1)) {
         return Z_STREAM_ERROR;
     }
     if (windowBits == 8) windowBits = 9;  /* until 256-byte window bug fixed */
@@ -318,7 +325,8 @@ int ZEXPORT deflateInit2_(strm, level, method, windowBits, memLevel, strategy,
     s->hash_mask = s->hash_size - 1;
     s->hash_shift =  ((s->hash_bits+MIN_MATCH-1)/MIN_MATCH);
 
-    s->window = (Bytef *) ZALLOC(strm, s->w_size, 2*sizeof(Byte));
+    s->window = (Bytef *) ZALLOC(strm, 2*s->w_size + WINDOW_PADDING,
+                                 sizeof(Byte));
     s->prev   = (Posf *)  ZALLOC(strm, s->w_size, sizeof(Pos));
     s->head   = (Posf *)  ZALLOC(strm, s->hash_size, sizeof(Pos));
 
@@ -337,6 +345,7 @@ int ZEXPORT deflateInit2_(strm, level, method, windowBits, memLevel, strategy,
         deflateEnd (strm);
         return Z_MEM_ERROR;
     }
+    zmemzero(s->window + 2*s->w_size, WINDOW_PADDING);
     s->d_buf = overlay + s->lit_bufsize/sizeof(ush);
     s->l_buf = s->pending_buf + (1+sizeof(ush))*s->lit_bufsize;
 
@@ -581,7 +590,7 @@ int ZEXPORT deflateParams(strm, level, strategy)
 #else
     if (level == Z_DEFAULT_COMPRESSION) level = 6;
 #endif
-    if (level < 0 || level > 9 || strategy < 0 || strategy > Z_FIXED) {
+    if (level < 0 || level > 9 || strategy < 0 || strategy > Z_QUICK) {
         return Z_STREAM_ERROR;
     }
     func = configuration_table[s->level].func;
@@ -1000,6 +1009,7 @@ int ZEXPORT deflate (strm, flush)
         bstate = s->level == 0 ? deflate_stored(s, flush) :
                  s->strategy == Z_HUFFMAN_ONLY ? deflate_huff(s, flush) :
                  s->strategy == Z_RLE ? deflate_rle(s, flush) :
+                 s->strategy == Z_QUICK ? deflate_quick(s, flush) :
                  (*(configuration_table[s->level].func))(s, flush);
 
         if (bstate == finish_started || bstate == finish_done) {
@@ -1125,7 +1135,8 @@ int ZEXPORT deflateCopy (dest, source)
     zmemcpy((voidpf)ds, (voidpf)ss, sizeof(deflate_state));
     ds->strm = dest;
 
-    ds->window = (Bytef *) ZALLOC(dest, ds->w_size, 2*sizeof(Byte));
+    ds->window = (Bytef *) ZALLOC(dest, 2*ds->w_size + WINDOW_PADDING,
+                                  sizeof(Byte));
     ds->prev   = (Posf *)  ZALLOC(dest, ds->w_size, sizeof(Pos));
     ds->head   = (Posf *)  ZALLOC(dest, ds->hash_size, sizeof(Pos));
     overlay = (ushf *) ZALLOC(dest, ds->lit_bufsize, sizeof(ush)+2);
@@ -1137,7 +1148,8 @@ int ZEXPORT deflateCopy (dest, source)
         return Z_MEM_ERROR;
     }
     /* following zmemcpy do not work for 16-bit MSDOS */
-    zmemcpy(ds->window, ss->window, ds->w_size * 2 * sizeof(Byte));
+    zmemcpy(ds->window, ss->window,
+            (ds->w_size * 2 + WINDOW_PADDING) * sizeof(Byte));
     zmemcpy((voidpf)ds->prev, (voidpf)ss->prev, ds->w_size * sizeof(Pos));
     zmemcpy((voidpf)ds->head, (voidpf)ss->head, ds->hash_size * sizeof(Pos));
     zmemcpy(ds->pending_buf, ss->pending_buf, (uInt)ds->pending_buf_size);
@@ -1219,6 +1231,42 @@ local void lm_init (s)
 #endif
 }
 
+/* ===========================================================================
+ * Return how many bytes scan and match have in common, at most MAX_MATCH.
+ * The first start bytes are known to match already. Like longest_match(),
+ * this may read beyond the lookahead; callers limit the result to it.
+ */
+local uInt common_length(scan, match, start)
+    const Bytef *scan;
+    const Bytef *match;
+    uInt start;
+{
+    uInt len = start;
+#ifdef WORD_MATCH
+    while (len < MAX_MATCH) {
+        unsigned long long sw, mw, diff;
+        zmemcpy(&sw, scan + len, sizeof(sw));
+        zmemcpy(&mw, match + len, sizeof(mw));
+        diff = sw ^ mw;
+        if (diff != 0) {
+#  if defined(_MSC_VER)
+            unsigned long bit;
+            _BitScanForward64(&bit, diff);
+            len += (uInt)bit >> 3;
+#  else
+            len += (uInt)__builtin_ctzll(diff) >> 3;
+#  endif
+            break;
+        }
+        len += sizeof(sw);
+    }
+#else
+    while (len < MAX_MATCH && scan[len] == match[len])
+        len++;
+#endif
+    return len < MAX_MATCH ? len : MAX_MATCH;
+}
+
 #ifndef FASTEST
 /* ===========================================================================
  * Set match_start to the longest match starting at the given string and
@@ -1259,7 +1307,9 @@ local uInt longest_match(s, cur_match)
     register ush scan_start = *(ushf*)scan;
     register ush scan_end   = *(ushf*)(scan+best_len-1);
 #else
+#ifndef WORD_MATCH
     register Bytef *strend = s->window + s->strstart + MAX_MATCH;
+#endif
     register Byte scan_end1  = scan[best_len-1];
     register Byte scan_end   = scan[best_len];
 #endif
@@ -1330,7 +1380,15 @@ local uInt longest_match(s, cur_match)
         if (match[best_len]   != scan_end  ||
             match[best_len-1] != scan_end1 ||
             *match            != *scan     ||
-            *++match          != scan[1])      continue;
+            match[1]          != scan[1])      continue;
+
+#ifdef WORD_MATCH
+        /* Same result as the loop below. scan[2] is not compared there
+         * either, see its comment.
+         */
+        len = (int)common_length(scan, match, 3);
+#else
+        match++;
 
         /* The check at best_len-1 can be removed because it will be made
          * again later. (This heuristic is not always a win.)
@@ -1355,6 +1413,7 @@ local uInt longest_match(s, cur_match)
 
         len = MAX_MATCH - (int)(strend - scan);
         scan = strend - MAX_MATCH;
+#endif /* WORD_MATCH */
 
 #endif /* UNALIGNED_OK */
 
@@ -2123,6 +2182,111 @@ local block_state deflate_rle(s, flush)
     return block_done;
 }
 
+/* ===========================================================================
+ * For Z_QUICK, look for a match among the QUICK_CHAIN most recent strings
+ * with the same hash only, with no lazy evaluation. Runs of the previous
+ * byte are found as well, as deflate_rle() does, and the longest candidate
+ * is taken. Strings inside matches are never inserted in the hash table:
+ * this keeps the short chains on the strings where matches start, which
+ * pays off on images made mostly of empty space and of a few repeated row
+ * patterns, such as glyph atlases, and saves the time of the inserts.
+ */
+#define QUICK_CHAIN 8
+
+local block_state deflate_quick(s, flush)
+    deflate_state *s;
+    int flush;
+{
+    IPos hash_head;       /* head of the hash chain */
+    int bflush;           /* set if current block must be flushed */
+    Bytef *scan;          /* current string */
+    Bytef *match;         /* candidate string */
+    IPos limit;           /* oldest string still in reach */
+    unsigned chain_length; /* candidates left to try */
+    uInt match_dist;      /* distance of the match to emit */
+
+    for (;;) {
+        /* Make sure that we always have enough lookahead, except
+         * at the end of the input file. We need MAX_MATCH bytes
+         * for the next match, plus MIN_MATCH bytes to insert the
+         * string following the next match.
+         */
+        if (s->lookahead < MIN_LOOKAHEAD) {
+            fill_window(s);
+            if (s->lookahead < MIN_LOOKAHEAD && flush == Z_NO_FLUSH) {
+                return need_more;
+            }
+            if (s->lookahead == 0) break; /* flush the current block */
+        }
+
+        s->match_length = 0;
+        match_dist = 0;
+        if (s->lookahead >= MIN_MATCH) {
+            INSERT_STRING(s, s->strstart, hash_head);
+            scan = s->window + s->strstart;
+
+            /* Run of the previous byte, a match at distance one. */
+            if (s->strstart > 0 && scan[-1] == scan[0] &&
+                scan[0] == scan[1] && scan[1] == scan[2]) {
+                s->match_length = common_length(scan, scan - 1, MIN_MATCH);
+                match_dist = 1;
+            }
+
+            /* Short walk of the hash chain. */
+            limit = s->strstart > (IPos)MAX_DIST(s) ?
+                s->strstart - (IPos)MAX_DIST(s) : NIL;
+            chain_length = QUICK_CHAIN;
+            while (s->match_length < MAX_MATCH && hash_head > limit &&
+                   chain_length-- != 0) {
+                match = s->window + hash_head;
+                if (match[s->match_length] == scan[s->match_length] &&
+                    match[0] == scan[0] && match[1] == scan[1] &&
+                    match[2] == scan[2]) {
+                    uInt len = common_length(scan, match, MIN_MATCH);
+                    if (len > s->match_length) {
+                        s->match_length = len;
+                        match_dist = s->strstart - hash_head;
+                    }
+                }
+                hash_head = s->prev[hash_head & s->w_mask];
+            }
+
+            if (s->match_length > s->lookahead)
+                s->match_length = s->lookahead;
+        }
+
+        if (s->match_length >= MIN_MATCH) {
+            check_match(s, s->strstart, s->strstart - match_dist, s->match_length);
+
+            _tr_tally_dist(s, match_dist, s->match_length - MIN_MATCH, bflush);
+
+            s->lookahead -= s->match_length;
+            s->strstart += s->match_length;
+            s->match_length = 0;
+            s->ins_h = s->window[s->strstart];
+            UPDATE_HASH(s, s->ins_h, s->window[s->strstart+1]);
+#if MIN_MATCH != 3
+            Call UPDATE_HASH() MIN_MATCH-3 more times
+#endif
+        } else {
+            /* No match, output a literal byte */
+            Tracevv((stderr,"%c", s->window[s->strstart]));
+            _tr_tally_lit (s, s->window[s->strstart], bflush);
+            s->lookahead--;
+            s->strstart++;
+        }
+        if (bflush) FLUSH_BLOCK(s, 0);
+    }
+    s->insert = s->strstart < MIN_MATCH-1 ? s->strstart : MIN_MATCH-1;
+    if (flush == Z_FINISH) {
+        FLUSH_BLOCK(s, 1);
+        return finish_done;
+    }
+    if (s->last_lit)
+        FLUSH_BLOCK(s, 0);
+    return block_done;
+}
+
 /* ===========================================================================
  * For Z_HUFFMAN_ONLY, do not look for matches.  Do not maintain a hash table.
  * (It will be regenerated if this run of deflate switches away from Huffman.)
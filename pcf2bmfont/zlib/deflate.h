@@ -295,6 +295,16 @@ typedef struct internal_state {
 /* Number of bytes after end of data in window to initialize in order to avoid
    memory checker errors from longest match routines */
 
+/* Matches are compared a machine word at a time on 64-bit little endian
+ * targets. Such a compare may read up to WINDOW_PADDING bytes past the
+ * window, which is allocated that much larger.
+ */
+#if !defined(NO_WORD_MATCH) && \
+    (defined(_M_X64) || defined(__x86_64__) || defined(_M_ARM64) || defined(__aarch64__))
+#  define WORD_MATCH
+#endif
+#define WINDOW_PADDING 8
+
         /* in trees.c */
 void ZLIB_INTERNAL _tr_init OF((deflate_state *s));
 int ZLIB_INTERNAL _tr_tally OF((deflate_state *s, unsigned dist, unsigned lc));